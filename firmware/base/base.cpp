@@ -1,9 +1,13 @@
 /* Main program */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
 #include "common.hpp"
 #include "delay.hpp"
 #include "shared.hpp"
@@ -15,6 +19,10 @@
 #include "i2c-hardware.hpp"
 #include "bmp085.hpp"
 #include "nrf24.hpp"
+#include "eeprom.hpp"
+#include "timers.hpp"
+#include "tendency.hpp"
+#include "profile.hpp"
 
 /* Peripherals are configured for 8 MHz system clock */
 static_assert(F_CPU == 8e6, "");
@@ -27,31 +35,95 @@ constexpr Gpio::Pin mosi = Gpio::B3, miso = Gpio::B4, sck = Gpio::B5;
 
 constexpr uint8_t light_adc_channel = 0;
 
+/* Rotary encoder timings (Timer0 counts, 8 us) */
+constexpr uint32_t enc_debounce = 2e-3*F_CPU/64;    /* Ignore reversals faster than that */
+constexpr uint32_t enc_fast = 60e-3*F_CPU/64;       /* Accelerate detents faster than that */
+
 constexpr uint32_t i2c_freq = 200e3;        /* I2C frequency (Hz) */
 
 constexpr uint8_t full_brightness = 160;    /* Ambient light level for full matrix brightness (0..255) */
-constexpr uint8_t hysteresis = 16;          /* Hysteresis of the automatic brightness control (0..255) */
+constexpr uint8_t light_ema_shift = 7;      /* Ambient light filter, 128 samples (~0.26 s) */
 
 constexpr int32_t outdoor_reliable_time = 10*60;        /* How long the outdoor temperature is reliable (s) */
 constexpr int32_t clock_reliable_time = 7*24*3600ul;    /* How long the clock is reliable (s) */
 constexpr uint8_t measure_indoor_interval = 10;         /* Interval for indoor weather measurement (s) */
 constexpr uint8_t reset_screen_timeout = 10;            /* Timeout to reset screen (s) */
 
+constexpr double timer0_tick = 256*64/(F_CPU/1e3);      /* Timer0 overflow (ms) */
+constexpr uint8_t frame_ticks = 10;             /* Timer0 overflows per frame (~49 fps) */
+constexpr uint8_t slide_frames = 8;             /* A slide between screens (~0.16 s) */
+constexpr uint8_t scroll_frames = 3;            /* Frames per pixel of scrolling (~16 px/s) */
+constexpr uint8_t scroll_hold = 49;             /* Frames to hold a wide picture at its ends (~1 s) */
+
 constexpr uint8_t history_size = 128;   /* How many weather records per day */
+constexpr uint8_t week_size = 13;       /* 12-hour extremes for a week, after the history */
+constexpr uint8_t month_size = 30;      /* Daily aggregates for a month, after the history */
+constexpr uint8_t week_days = 7;        /* The oldest day to compare with for the change for a week */
+
+/* Pressure tendency and forecast */
+constexpr uint8_t tendency_short = 3*3600/(86400/history_size);    /* 3 hours of history records */
+constexpr uint8_t tendency_long = 12*3600/(86400/history_size);    /* 12 hours */
+constexpr int16_t tendency_threshold = 12;      /* Rising or falling for 3 hours, 1.6 hPa (mmHg/10) */
+constexpr int16_t sea_level_correction = 0;     /* Add to the pressure for the forecast, 0.12 hPa/m (hPa) */
+constexpr uint8_t checkpoint_interval = 60;     /* Interval for saving the clock to EEPROM (s) */
 
 constexpr uint8_t low_battery_level = 3.6/4.2*255;  /* Threshold for low battery warning (0..255, 255 is 4.2 V) */
 
-/* NRF24 network adresses and payload lengths */
+/* NRF24 network adresses and payload lengths (all are dynamic) */
 constexpr uint8_t pc_link_addr[] = {0xe7, 0x4f, 0xec, 0xe8, 0x37};  /* Pipe 0 */
-constexpr uint8_t pc_link_payload_length = 3;
-constexpr uint8_t outdoor_addr[] = {0xc8, 0xb4, 0xe1, 0x65, 0x3b};  /* Pipe 1 */
-constexpr uint8_t outdoor_payload_length = 2;
-
-struct Weather {
+constexpr uint8_t pc_link_time_length = 3;        /* Hours, minutes, seconds */
+constexpr uint8_t pc_link_update[] = {'B'};       /* Reset into the bootloader (see boot.cpp) */
+constexpr uint8_t pc_link_frame = 'F';            /* A frame pushed to the display (see remote_frame) */
+constexpr uint8_t pc_link_text = 'T';             /* Text pushed to the display (see remote_text) */
+constexpr uint8_t remote_text_size = 32 - 2;      /* Characters of the text in a payload */
+constexpr uint8_t outdoor_addr[] = {0xc8, 0xb4, 0xe1, 0x65, 0x3b};  /* Pipe 1, pipes 2..5 are LSB + 1..4 */
+constexpr uint8_t outdoor_header_length = 4;      /* Dynamic length, then samples */
+constexpr uint8_t outdoor_sample_length = 3;
+
+/*
+ * Outdoor nodes: slots are enrolled from the table (slot 0 is the outdoor
+ * temperature of the weather), and unknown node IDs take free slots at run
+ * time. A node may transmit on any of the pipes 1..5.
+ */
+constexpr uint8_t nr_nodes = 5;
+constexpr uint8_t known_nodes[] = {1};
+constexpr uint8_t node_buckets = 4;     /* Extremes for a day in 6-hour buckets */
+
+/*
+ * Beacon, sent after every packet from a node: the base time in the 256 s
+ * cycle (1/256 s, LSB first), the node IDs by slots, the handover: the
+ * next channel, its rate (RF_SETUP bits) and the cycles until the switch (0
+ * is none), and the cycles a node batches its samples for. The node in the
+ * slot i transmits in the middle of the 32 s from i*32 s of the cycle (the
+ * same as in outdoor.cpp), the last slots are left for pc-link.
+ */
+constexpr uint8_t beacon_addr[] = {0xa5, 0xb4, 0xe1, 0x65, 0x3b};
+constexpr uint8_t beacon_payload_length = 2 + nr_nodes + 3 + 1;
+constexpr uint8_t outdoor_batch_cycles = 2;     /* A packet in 512 s, up to 4 (the samples in outdoor.cpp) */
+static_assert(outdoor_batch_cycles*256 < outdoor_reliable_time, "");
+
+/*
+ * Radio channel and air rate: all modules power on at the home channel and
+ * 1 Mbit/s. The base surveys the band with the received power detector at
+ * power on (and on the survey view), and hands the nodes over to the quietest
+ * channel at radio_rate: RF_DR_2Mbps halves the air time, RF_DR_250kbps gives
+ * the range. A module which missed the handover hunts for the base over the
+ * channels survey_first..survey_last (the same as in outdoor.cpp, pc-link.cpp).
+ */
+constexpr uint8_t home_channel = 2;             /* 2402 MHz */
+constexpr uint8_t radio_rate = Nrf24::RF_DR_2Mbps;
+constexpr uint8_t survey_channels = 96;         /* 2400..2495 MHz, 2 channels per map column */
+constexpr uint8_t survey_first = 1, survey_last = 82;   /* Channels to choose, inside the band */
+constexpr uint8_t survey_samples = 16;          /* Detector samples per channel */
+constexpr uint8_t survey_dwell = 130 + 40;      /* RX settling and the detector delay (us) */
+constexpr uint8_t handover_cycles = 3;          /* Beacon cycles to announce the handover */
+
+/* Packed to keep the EEPROM layout the same in the host simulator */
+struct __attribute__((packed)) Weather {
         int8_t temperature_outdoor;     /* Outdoor temperature (°C) */
         int8_t temperature_indoor;      /* Indoor temperature (°C) */
         uint8_t humidity;               /* Relative humidity (%) */
-        uint16_t pressure;              /* Air pressure (mmHg) */
+        uint16_t pressure;              /* Air pressure (mmHg/10) */
 };
 
 struct Time {
@@ -64,6 +136,8 @@ enum class ScreenX: uint8_t {
         temperature_indoor,
         humidity,
         pressure,
+        forecast,
+        radio,
         nr_screens
 };
 
@@ -72,12 +146,19 @@ enum class ScreenY: uint8_t {
         change,
         minimal,
         maximal,
+        change_week,
+        minimal_week,
+        maximal_week,
+        change_month,
+        minimal_month,
+        maximal_month,
         nr_screens
 };
 
 struct Screen {
         ScreenX x;
         ScreenY y;
+        uint8_t node;                   /* Node slot on the outdoor temperature */
 };
 
 /* Faulty values */
@@ -91,194 +172,1262 @@ constexpr Weather bad_weather = {
         .pressure = bad_pressure,
 };
 
+/*
+ * Weather parameters in the archive are coded as bytes: temperature + 128,
+ * humidity as is, pressure in mmHg - 600. A day is kept as the minimal, mean
+ * and maximal codes of every parameter (12 bytes), a half day as the minimal
+ * and maximal ones (8 bytes).
+ */
+enum Param: uint8_t {
+        param_temperature_outdoor,
+        param_temperature_indoor,
+        param_humidity,
+        param_pressure,
+        nr_params
+};
+
+constexpr uint8_t bad_code = UINT8_MAX;
+constexpr uint16_t pressure_base = 600;         /* mmHg */
+constexpr uint16_t pressure_offset = 7600;      /* For the tendency sums (mmHg/10) */
+
+struct Range {
+        uint8_t lo, hi;
+};
+
+struct Aggregate {
+        uint8_t lo, mean, hi;
+};
+
+struct Period {
+        Aggregate param[nr_params];
+};
+
+constexpr Period bad_period = {{
+        {bad_code, bad_code, bad_code}, {bad_code, bad_code, bad_code},
+        {bad_code, bad_code, bad_code}, {bad_code, bad_code, bad_code},
+}};
+
+/*
+ * Round-robin weather archive behind the history: the history records are
+ * archived as the history starts to overwrite them, a half day into the week
+ * tier, a whole day into the month one. The summaries (extremes over a tier
+ * and the history, and the mean of the day to compare with) are updated with
+ * every history record, so a screen reads them at once. The archive survives
+ * a watchdog reset in .noinit, and is checked by the CRC-8 after it.
+ */
+struct Archive {
+        Range halves[week_size][nr_params];
+        Period days[month_size];
+        uint8_t week_current, month_current;    /* The oldest ones, the next to write */
+        Period week, month;                     /* Summaries */
+        uint8_t crc;
+};
+
+struct Node {
+        uint8_t id;                     /* 0 is a free slot */
+        int8_t temperature;             /* °C */
+        uint8_t battery;                /* 0..255, 255 is 4.2 V */
+        int32_t recent;                 /* Recent update time (s_uptime) */
+        int8_t lo[node_buckets], hi[node_buckets];
+
+        /* Link statistics: packets received, lost and retransmitted as the node reports */
+        uint16_t received, lost, retransmits;
+};
+
 /* Flags to control the main loop */
 union Flags {
         uint16_t all;
         struct {
-                bool enc_rotated_right: 1;      /* Rotary encoder was rotated right */
-                bool enc_rotated_left: 1;       /* Rotary encoder was rotated left */
                 bool nrf24_irq: 1;              /* NRF24 interrupt */
                 bool measure_indoor: 1;         /* Measure indoor weather */
                 bool refresh_screen: 1;         /* Refresh the screen */
                 bool light_changed: 1;          /* Ambient light level was changed */
                 bool reset_screen: 1;           /* Set screen to default (clock, current weather) */
                 bool update_history: 1;         /* Save current weather to the history */
+                bool checkpoint: 1;             /* Save the clock to EEPROM */
+                bool survey: 1;                 /* Survey the radio channels */
+                bool beacon_cycle: 1;           /* Next beacon cycle (256 s) */
+                bool frame: 1;                  /* Frame tick */
         };
 };
 
 static SpiHardware spi {mosi, miso, sck};
 static Max7221 max_chain {spi, max_cs};
-static Matrix matrix {max_chain};
+static Matrix<3> matrix {max_chain};          /* 24x8 */
+constexpr uint8_t display_width = decltype(matrix)::width;
+static Canvas<2*display_width> canvas;          /* Screens are rendered here (see frame_present) */
 static Nrf24 nrf24 {spi, nrf_csn, nrf_ce};
 static Dht22 dht22 {dht_data};
 static I2cHardware i2c;
 static Bmp085 bmp085 {i2c};
 
+/* Software timers on Timer0 overflows, the main loop takes the expired ones */
+enum TimerId: uint8_t {
+        timer_dht22,                    /* START is written */
+        timer_bmp085,                   /* A conversion is running */
+        nr_timers
+};
+static TimerWheel<nr_timers> timers;
+
+/* Timer0 overflows to wait at least the time (ms), the current one is partial */
+constexpr uint16_t timer_ticks(double ms)
+{
+        return static_cast<uint16_t>(ms/timer0_tick) + 2;
+}
+
 static Weather weather = bad_weather;           /* Current weather */
-static uint8_t battery_level;                   /* Outdoor battery level (0..255, 255 is 4.2 V) */
+
+static Node nodes[nr_nodes];
+static uint8_t node_bucket;                     /* Bucket of the current 6 hours */
+
+/* Rotary encoder detents, accelerated (right is positive) */
+struct EncoderEvent {
+        int8_t steps;
+        bool pushed;                    /* With the button pushed */
+};
 
 /* Recent update time (s_uptime) */
-static int32_t outdoor_recent = -outdoor_reliable_time - 1;
 static int32_t clock_recent = -clock_reliable_time - 1;
 
+/* Time of day at the zero uptime (s): the 1 Hz interrupt counts the uptime only */
+static int32_t clock_offset;
+
 /* Weather history for the last day */
 static struct {
         Weather weather[history_size];
         uint8_t current;
 } history;
 
+/* Weather archive for a week and a month, kept over a watchdog reset */
+static Archive archive __attribute__((section(".noinit")));
+
+/* Pressure tendencies over the history, as the change for 3 hours (see tendency.hpp) */
+static_assert(tendency_long < history_size, "");
+static Tendency<tendency_short, tendency_short> tendency_3h;
+static Tendency<tendency_long, tendency_short> tendency_12h;
+
+/* Samples of the outdoor temperature (1/16 °C) by the time taken: the current history record and the previous one */
+static struct {
+        int32_t start;                          /* Uptime of the current record */
+        int32_t sum[2];
+        uint8_t count[2];
+} outdoor_samples;
+
+/* Zambretti forecast letters for the Z numbers 1..32: falling, steady, rising */
+static const char zambretti[] PROGMEM = "ABDHORUVX" "ABEKNPSWXZ" "ABCFGIJLMMQTY";
+
+/*
+ * EEPROM layout: the history slot by slot (a slot is rewritten once a day),
+ * and a log of clock records written in turn (32 records, so a record is
+ * rewritten every 32 minutes, ~16000 times a year). Every entry has a CRC-8,
+ * the latest clock record has the highest sequence number.
+ */
+struct __attribute__((packed)) HistoryEntry {
+        Weather weather;
+        uint8_t crc;
+};
+
+struct __attribute__((packed)) ClockEntry {
+        uint8_t seq;
+        uint8_t history_current;
+        Time time;
+        uint16_t clock_age;             /* Since the last clock sync (min) */
+        uint8_t crc;
+};
+
+constexpr uint8_t eeprom_layout = 1;           /* CRC seed, change with the layout */
+constexpr uint16_t history_eeprom = 0;
+constexpr uint16_t clock_log_eeprom = history_eeprom + history_size*sizeof(HistoryEntry);
+constexpr uint8_t clock_log_size = (Eeprom::size - clock_log_eeprom)/sizeof(ClockEntry);
+static_assert(clock_log_size >= 2, "");
+
+/* Radio channel and rate, the announced handover, and the survey map by columns (0..8) */
+static struct {
+        uint8_t channel, rate;
+        uint8_t next_channel, next_rate;
+        uint8_t countdown;                      /* Cycles until the switch, 0 is none */
+        uint8_t survey[survey_channels/4];      /* Two columns a byte, the even one in the low nibble */
+} radio = {home_channel, Nrf24::RF_DR_1Mbps, home_channel, Nrf24::RF_DR_1Mbps, 0, {}};
+
+/* The latest clock record */
+static struct {
+        uint8_t seq;
+        uint8_t pos;
+} clock_log = {0, clock_log_size - 1};
+
 /* Shared variables (changed in interrupts) */
 static Flags s_flags;                           /* Flags to control the main loop */
-static Time s_time;                             /* Current time */
-static int32_t s_uptime;                        /* Uptime (s) */
+static Seqlock<int32_t> s_uptime;               /* Uptime (s), the epoch of the clock */
 static uint8_t s_inactivity_timer;              /* User inactivity timer (s) */
-static uint8_t s_light;                         /* Ambient light level (0..255) */
+static uint16_t s_light;                        /* Filtered ambient light level (0..255, 8.7 fixed point) */
+static uint16_t s_ticks;                        /* Timer0 overflows */
+static uint8_t s_frame;                         /* Frame counter */
+static Queue<EncoderEvent, 8> s_encoder_events;
+
+/*
+ * Automatic brightness curve: light levels (8.7 fixed point) to enter the
+ * matrix intensity level i from below (up[i]), and to leave it downwards
+ * (down[i]). Centres of the levels follow gamma 2 up to full_brightness, so
+ * steps are fine in the dark; hysteresis is a quarter of the step.
+ */
+struct BrightnessCurve {
+        uint16_t up[16];
+        uint16_t down[16];
+
+        static constexpr uint16_t centre(uint8_t i) {
+                return static_cast<uint32_t>(full_brightness << light_ema_shift)*i*i/(15*15);
+        }
 
-/* 1 Hz interrupt (RTC, timers) */
-ISR(TIMER2_OVF_vect)
-{
-        /* RTC */
-        if (++s_time.s >= 60) {
-                s_time.s -= 60;
-                if (++s_time.m >= 60) {
-                        s_time.m -= 60;
-                        if (++s_time.h >= 24)
-                                s_time.h -= 24;
+        constexpr BrightnessCurve(): up(), down() {
+                for (uint8_t i = 1; i < 16; i++) {
+                        const uint16_t step = centre(i) - centre(i - 1);
+                        up[i] = centre(i - 1) + step*3/4;
+                        down[i] = centre(i - 1) + step/4;
                 }
         }
+};
+
+static constexpr BrightnessCurve brightness_curve PROGMEM {};
+
+/* Quadrature decoder: [previous A:B << 2 | current A:B] -> quarter step */
+static const int8_t quadrature[16] PROGMEM = {
+        0, +1, -1,  0,
+       -1,  0,  0, +1,
+       +1,  0,  0, -1,
+        0, -1, +1,  0,
+};
+
+/* Time in Timer0 counts (8 us), 24 bits that wrap every ~134 s, call with interrupts disabled */
+static uint32_t timestamp()
+{
+        const uint8_t low = TCNT0;
+        uint16_t high = s_ticks;
+
+        /* Overflow is pending, and the low part is after it */
+        if ((TIFR0 & 1<<TOV0) && low < 0x80)
+                high++;
+        return static_cast<uint32_t>(high) << 8 | low;
+}
+
+/*
+ * 1 Hz interrupt (uptime, timers). The time of day is derived from the uptime
+ * in the main loop (clock_time), the timers count down: no divisions here.
+ */
+ISR(TIMER2_OVF_vect)
+{
+        PROFILE_SCOPE(timer2);
 
         /* Uptime */
-        s_uptime++;
+        const int32_t uptime = s_uptime.get() + 1;
+        s_uptime.write(uptime);
 
         /* Refresh the screen every second */
         s_flags.refresh_screen = 1;     
 
         /* Measure indoor weather */
-        {
-                static uint8_t cnt = 0;
-                if (++cnt == measure_indoor_interval) {
-                        cnt = 0;
-                        s_flags.measure_indoor = 1;
-                }
+        static uint8_t measure_countdown = measure_indoor_interval;
+        if (--measure_countdown == 0) {
+                measure_countdown = measure_indoor_interval;
+                s_flags.measure_indoor = 1;
         }
 
-        /* Update history */
+        /* Update history, at multiples of the record time of the uptime */
         static_assert(86400 % history_size == 0, "");
-        if (s_uptime % (86400/history_size) == 0)
+        static uint16_t history_countdown = 86400/history_size;
+        if (--history_countdown == 0) {
+                history_countdown = 86400/history_size;
                 s_flags.update_history = 1;
+        }
+
+        /* Save the clock */
+        static uint8_t checkpoint_countdown = checkpoint_interval;
+        if (--checkpoint_countdown == 0) {
+                checkpoint_countdown = checkpoint_interval;
+                s_flags.checkpoint = 1;
+        }
+
+        /* The beacon time wraps */
+        if (static_cast<uint8_t>(uptime) == 0)
+                s_flags.beacon_cycle = 1;
 
         /* Reset screen by inactivity */
         if (++s_inactivity_timer == reset_screen_timeout)
                 s_flags.reset_screen = 1;
+
+#ifdef PROFILE
+        Profile::second();
+#endif
+}
+
+/* Rotary encoder */
+ISR(PCINT2_vect)
+{
+        static uint8_t prev_state = 0b11;
+        static int8_t quarters = 0;
+        static int8_t prev_dir = 0;
+        static uint32_t prev_time = 0;
+
+        /* Count quarter steps, a detent is when both contacts are open */
+        const uint8_t state = Gpio::read(enc_a) << 1 | Gpio::read(enc_b);
+        quarters += static_cast<int8_t>(pgm_read_byte(&quadrature[prev_state << 2 | state]));
+        prev_state = state;
+        if (state != 0b11 || quarters == 0)
+                return;
+
+        const int8_t dir = (quarters > 0) ? 1 : -1;
+        quarters = 0;
+
+        /* Contact bounce at the detent */
+        const uint32_t t = timestamp();
+        const uint32_t dt = (t - prev_time) & 0xffffff;        /* Across the wrap of the timestamp */
+        if (dir != prev_dir && dt < enc_debounce)
+                return;
+
+        /* Velocity acceleration */
+        int8_t steps = dir;
+        if (dir == prev_dir && dt < enc_fast)
+                steps *= (dt < enc_fast/2) ? 3 : 2;
+        prev_dir = dir;
+        prev_time = t;
+
+        s_encoder_events.push(EncoderEvent {steps, Gpio::read(enc_button) == 0});
 }
 
 /* ~500 Hz general-purpose interrupt */
 ISR(TIMER0_OVF_vect)
 {
-        /* Rotary encoder */
-        {
-                static uint8_t cnt = 0;
-                static bool prev_state = 1;
-                if (Gpio::read(enc_a) != prev_state) {
-                        if (++cnt > 1) {
-                                if (prev_state != 0) {  /* Negative edge */
-                                        if (Gpio::read(enc_b))
-                                                s_flags.enc_rotated_left = 1;
-                                        else
-                                                s_flags.enc_rotated_right = 1;
-                                }
-                                prev_state = !prev_state;
-                        }
-                } else
-                        cnt = 0;
+        PROFILE_SCOPE(timer0);
+
+        s_ticks++;
+        timers.tick();
+
+        /* Frame tick */
+        static uint8_t cnt = 0;
+        if (++cnt == frame_ticks) {
+                cnt = 0;
+                s_frame++;
+                s_flags.frame = 1;
         }
 
         /* NRF24 interrupt */
         if (Gpio::read(nrf_irq) == 0)
                 s_flags.nrf24_irq = 1;
-        
-        /* Ambient light level */
-        {
-                static uint8_t cnt = 0;
-                static uint16_t acc = 0;
-                static uint8_t prev_value = 0;
-
-                acc += ADCH;
-                if (++cnt == 0) {  /* Accumulate ~0.5 seconds */
-                        s_light = acc/256;
-                        if (s_light != prev_value) {
-                                s_flags.light_changed = 1;
-                                prev_value = s_light;
+}
+
+/* Ambient light level, converted on every Timer0 overflow */
+ISR(ADC_vect)
+{
+        PROFILE_SCOPE(adc);
+
+        static bool seeded;
+
+        /* Exponential moving average: ema += sample - ema/128 (seeded by the first sample) */
+        const uint16_t prev = s_light;
+        if (!seeded)
+                s_light = ADCH << light_ema_shift;
+        else
+                s_light = prev + ADCH - (prev >> light_ema_shift);
+        seeded = true;
+
+        /* Wake the main loop when the rounded level changes */
+        constexpr uint16_t half = 1 << (light_ema_shift - 1);
+        if ((prev + half) >> light_ema_shift != (s_light + half) >> light_ema_shift)
+                s_flags.light_changed = 1;
+}
+
+/* Move the index i in 0..n-1 by steps (wrapping) */
+static uint8_t rotate(uint8_t i, int8_t steps, uint8_t n)
+{
+        int8_t r = (i + steps) % n;
+        return (r < 0) ? r + n : r;
+}
+
+static uint8_t crc8(const void *data, uint16_t len)
+{
+        auto p = static_cast<const uint8_t *>(data);
+        uint8_t crc = eeprom_layout;
+        while (len--)
+                crc = _crc8_ccitt_update(crc, *p++);
+        return crc;
+}
+
+static void save_history(uint8_t i)
+{
+        HistoryEntry e;
+        e.weather = history.weather[i];
+        e.crc = crc8(&e, offsetof(HistoryEntry, crc));
+        Eeprom::write(history_eeprom + i*sizeof(e), &e, sizeof(e));
+}
+
+static void set_clock(const Time &t)
+{
+        clock_offset = t.h*3600L + t.m*60 + t.s - s_uptime.read();
+}
+
+static Time clock_time()
+{
+        int32_t s = (s_uptime.read() + clock_offset) % 86400;
+        if (s < 0)
+                s += 86400;
+        const uint16_t m = s/60;
+        return Time {static_cast<int8_t>(m/60), static_cast<int8_t>(m % 60),
+                static_cast<int8_t>(s - m*60L)};
+}
+
+static void save_clock()
+{
+        const int32_t age = (s_uptime.read() - clock_recent)/60;
+
+        ClockEntry e;
+        e.seq = clock_log.seq + 1;
+        e.history_current = history.current;
+        e.time = clock_time();
+        e.clock_age = min<int32_t>(age, UINT16_MAX);
+        e.crc = crc8(&e, offsetof(ClockEntry, crc));
+
+        const uint8_t pos = (clock_log.pos + 1) % clock_log_size;
+        if (Eeprom::write(clock_log_eeprom + pos*sizeof(e), &e, sizeof(e))) {
+                clock_log.seq = e.seq;
+                clock_log.pos = pos;
+        }
+}
+
+/* Restore the history and the clock, the clock is reliable after a reset only */
+static void restore(bool clock_reliable)
+{
+        for (uint8_t i = 0; i < history_size; i++) {
+                HistoryEntry e;
+                Eeprom::read(history_eeprom + i*sizeof(e), &e, sizeof(e));
+                if (e.crc == crc8(&e, offsetof(HistoryEntry, crc)))
+                        history.weather[i] = e.weather;
+        }
+
+        /* Sequence numbers of valid records are within clock_log_size */
+        bool found = false;
+        ClockEntry latest;
+        for (uint8_t i = 0; i < clock_log_size; i++) {
+                ClockEntry e;
+                Eeprom::read(clock_log_eeprom + i*sizeof(e), &e, sizeof(e));
+                if (e.crc != crc8(&e, offsetof(ClockEntry, crc)) || e.history_current >= history_size)
+                        continue;
+                if (!found || static_cast<int8_t>(e.seq - latest.seq) > 0) {
+                        latest = e;
+                        clock_log.pos = i;
+                        found = true;
+                }
+        }
+        if (!found)
+                return;
+
+        clock_log.seq = latest.seq;
+        history.current = latest.history_current;
+        set_clock(latest.time);
+        if (clock_reliable)
+                clock_recent = -static_cast<int32_t>(latest.clock_age + 1)*60;
+}
+
+/* Pressure rounded to mmHg */
+static uint16_t mmhg(uint16_t p)
+{
+        return (p + 5)/10;
+}
+
+static uint8_t encode(const Weather &w, uint8_t param)
+{
+        switch (param) {
+        case param_temperature_outdoor:
+                return (w.temperature_outdoor != bad_temperature) ? w.temperature_outdoor + 128 : bad_code;
+        case param_temperature_indoor:
+                return (w.temperature_indoor != bad_temperature) ? w.temperature_indoor + 128 : bad_code;
+        case param_humidity:
+                return w.humidity;
+        default:
+                return (w.pressure != bad_pressure) ?
+                        clamp<uint16_t>(mmhg(w.pressure), pressure_base, pressure_base + bad_code - 1) - pressure_base :
+                        bad_code;
+        }
+}
+
+static int16_t decode(uint8_t code, uint8_t param)
+{
+        switch (param) {
+        case param_temperature_outdoor:
+        case param_temperature_indoor:
+                return code - 128;
+        case param_humidity:
+                return code;
+        default:
+                return code + pressure_base;
+        }
+}
+
+/* Aggregate of the parameter over n history records from i */
+static Aggregate history_aggregate(uint8_t i, uint8_t n, uint8_t param)
+{
+        static_assert(history_size*254ul <= UINT16_MAX, "");
+
+        Aggregate a = bad_period.param[param];
+        uint16_t sum = 0;
+        uint8_t count = 0;
+        for (; n != 0; n--, i = (i + 1) % history_size) {
+                const uint8_t c = encode(history.weather[i], param);
+                if (c == bad_code)
+                        continue;
+                a.lo = (count == 0) ? c : min(a.lo, c);
+                a.hi = (count == 0) ? c : max(a.hi, c);
+                sum += c;
+                count++;
+        }
+        if (count != 0)
+                a.mean = sum/count;
+        return a;
+}
+
+/* Widen the extremes by the range */
+static void widen(Aggregate &a, uint8_t lo, uint8_t hi)
+{
+        if (lo == bad_code)
+                return;
+        a.lo = (a.lo == bad_code) ? lo : min(a.lo, lo);
+        a.hi = (a.hi == bad_code) ? hi : max(a.hi, hi);
+}
+
+static void archive_seal()
+{
+        archive.crc = crc8(&archive, offsetof(Archive, crc));
+}
+
+/* Keep the archive after a reset, if it's intact, or start it over */
+static void archive_init(bool keep)
+{
+        if (keep && archive.week_current < week_size && archive.month_current < month_size &&
+                        archive.crc == crc8(&archive, offsetof(Archive, crc)))
+                return;
+
+        for (auto &h : archive.halves)
+                for (auto &r : h)
+                        r = Range {bad_code, bad_code};
+        for (auto &d : archive.days)
+                d = bad_period;
+        archive.week_current = 0;
+        archive.month_current = 0;
+        archive.week = archive.month = bad_period;
+        archive_seal();
+}
+
+/* Archive the records the next history record starts to overwrite */
+static void archive_push()
+{
+        static_assert(history_size % 2 == 0, "");
+        const uint8_t i = history.current;
+        if (i % (history_size/2) == 0) {
+                auto &h = archive.halves[archive.week_current];
+                for (uint8_t p = 0; p < nr_params; p++) {
+                        const Aggregate a = history_aggregate(i, history_size/2, p);
+                        h[p] = Range {a.lo, a.hi};
+                }
+                archive.week_current = (archive.week_current + 1) % week_size;
+        }
+        if (i == 0) {
+                Period &d = archive.days[archive.month_current];
+                for (uint8_t p = 0; p < nr_params; p++)
+                        d.param[p] = history_aggregate(0, history_size, p);
+                archive.month_current = (archive.month_current + 1) % month_size;
+        }
+        archive_seal();
+}
+
+/*
+ * Summaries: the extremes over the history and the tier, and the mean of the
+ * oldest day (a week back at most for the week, the history is the newest
+ * day) for the change
+ */
+static void archive_update()
+{
+        static_assert(week_days <= month_size, "");
+        for (uint8_t p = 0; p < nr_params; p++) {
+                const Aggregate h = history_aggregate(0, history_size, p);
+                Aggregate &w = archive.week.param[p];
+                Aggregate &m = archive.month.param[p];
+                w = m = Aggregate {h.lo, bad_code, h.hi};
+
+                for (const auto &r : archive.halves)
+                        widen(w, r[p].lo, r[p].hi);
+                for (uint8_t k = 1; k <= month_size; k++) {
+                        const Aggregate &d = archive.days[(archive.month_current + month_size - k) % month_size].param[p];
+                        if (d.mean == bad_code)
+                                continue;
+                        widen(m, d.lo, d.hi);
+                        m.mean = d.mean;
+                        if (k < week_days)
+                                w.mean = d.mean;
+                }
+        }
+        archive_seal();
+}
+
+/* Pressure of the history record i for the tendencies (mmHg/10 from pressure_offset) */
+static int16_t tendency_sample(uint8_t i)
+{
+        const uint16_t p = history.weather[i].pressure;
+        return (p != bad_pressure) ? p - pressure_offset : tendency_bad;
+}
+
+/* Sums over the whole history, after it is cleared and restored */
+static void tendency_init()
+{
+        tendency_3h.init(tendency_sample, history_size, history.current);
+        tendency_12h.init(tendency_sample, history_size, history.current);
+}
+
+/*
+ * Zambretti forecast letter (A is settled fine, Z is stormy) by the pressure
+ * (mmHg/10) and its tendency. The 12-hour tendency stands in when the 3-hour
+ * one is unknown, or shows a slow steady change.
+ */
+static char forecast(uint16_t pressure, int16_t t3, int16_t t12)
+{
+        int16_t t = (t3 != tendency_unknown) ? t3 : t12;
+        if (t == tendency_unknown)
+                return 0;
+        if (abs(t) < tendency_threshold && t12 != tendency_unknown && abs(t12) >= tendency_threshold/2)
+                t = t12*2;
+
+        const int16_t p = (pressure*4 + 15)/30 + sea_level_correction;   /* hPa */
+        int16_t z;
+        if (t <= -tendency_threshold)
+                z = clamp<int16_t>((12700 - 12*p)/100, 1, 9);
+        else if (t >= tendency_threshold)
+                z = clamp<int16_t>((18500 - 16*p)/100, 20, 32);
+        else
+                z = clamp<int16_t>((14400 - 13*p)/100, 10, 19);
+        return pgm_read_byte(&zambretti[z - 1]);
+}
+
+static char forecast_icon(char letter)
+{
+        if (letter <= 'B')
+                return MatrixBase::special_sunny;
+        else if (letter <= 'G')
+                return MatrixBase::special_fair;
+        else if (letter <= 'M')
+                return MatrixBase::special_cloudy;
+        else if (letter <= 'X')
+                return MatrixBase::special_rain;
+        else
+                return MatrixBase::special_storm;
+}
+
+static void nodes_clear_bucket(uint8_t b)
+{
+        for (auto &n : nodes)
+                n.lo[b] = n.hi[b] = bad_temperature;
+}
+
+static void nodes_init()
+{
+        static_assert(size(known_nodes) <= nr_nodes, "");
+
+        for (uint8_t i = 0; i < nr_nodes; i++) {
+                Node &n = nodes[i];
+                n.id = (i < size(known_nodes)) ? known_nodes[i] : 0;
+                n.temperature = bad_temperature;
+                n.battery = UINT8_MAX;
+                n.recent = -outdoor_reliable_time - 1;
+                n.received = n.lost = n.retransmits = 0;
+        }
+        for (uint8_t b = 0; b < node_buckets; b++)
+                nodes_clear_bucket(b);
+}
+
+/* Slot of the node, an unknown node is enrolled to a free slot (nullptr if none) */
+static Node *find_node(uint8_t id)
+{
+        Node *free = nullptr;
+
+        if (id == 0)
+                return nullptr;
+        for (auto &n : nodes) {
+                if (n.id == id)
+                        return &n;
+                if (n.id == 0 && free == nullptr)
+                        free = &n;
+        }
+        if (free != nullptr)
+                free->id = id;
+        return free;
+}
+
+/* Round 1/16 °C to °C */
+static int8_t celsius(int32_t t)
+{
+        return (t + 8) >> 4;
+}
+
+/*
+ * Add a sample of the outdoor temperature taken age seconds ago to the record
+ * of its time, return true if it updated the previous record (already saved)
+ */
+static bool outdoor_sample(int16_t t, uint16_t age)
+{
+        constexpr uint16_t record_time = 86400/history_size;
+        const int32_t taken = s_uptime.read() - age;
+        auto &s = outdoor_samples;
+
+        if (taken >= s.start) {
+                s.sum[0] += t;
+                s.count[0]++;
+                return false;
+        }
+        if (taken < s.start - record_time || s.count[1] == UINT8_MAX)
+                return false;
+
+        s.sum[1] += t;
+        s.count[1]++;
+        const uint8_t prev = (history.current + history_size - 1) % history_size;
+        history.weather[prev].temperature_outdoor = celsius(s.sum[1]/s.count[1]);
+        return true;
+}
+
+/* Extreme temperature of the node for 24 hours, bad_temperature if unknown */
+static int8_t node_extreme(const Node &n, bool minimal)
+{
+        int8_t m = n.temperature;
+        for (uint8_t b = 0; b < node_buckets; b++) {
+                const int8_t t = minimal ? n.lo[b] : n.hi[b];
+                if (t == bad_temperature)
+                        continue;
+                if (m == bad_temperature)
+                        m = t;
+                else
+                        m = minimal ? min(m, t) : max(m, t);
+        }
+        return m;
+}
+
+/* Base time in the beacon cycle (1/256 s) */
+static uint16_t beacon_time()
+{
+        uint16_t t;
+
+        atomic_block {
+                const uint8_t low = TCNT2;
+                uint8_t high = static_cast<uint8_t>(s_uptime.get());
+
+                /* Overflow is pending, and the low part is after it */
+                if ((TIFR2 & 1<<TOV2) && low < 0x80)
+                        high++;
+                t = concat16(high, low);
+        }
+        return t;
+}
+
+/* Move the screen by X, stepping through the enrolled nodes on the outdoor temperature */
+static void rotate_x(Screen &screen, int8_t steps)
+{
+        const int8_t dir = (steps > 0) ? 1 : -1;
+
+        for (; steps != 0; steps -= dir) {
+                if (screen.x == ScreenX::temperature_outdoor) {
+                        uint8_t i = screen.node;
+                        do
+                                i += dir;
+                        while (i != 0 && i < nr_nodes && nodes[i].id == 0);
+                        if (i < nr_nodes) {
+                                screen.node = i;
+                                continue;
                         }
-                        acc = 0;
                 }
 
-                /* Start the next conversion (1.1 V reference, 62.5 kHz clock) */
-                static_assert(light_adc_channel <= 7, "");
-                ADMUX = 1<<REFS1 | 1<<REFS0 | 1<<ADLAR | light_adc_channel;
-                ADCSRA = 1<<ADEN | 1<<ADSC | 1<<ADPS2 | 1<<ADPS1 | 1<<ADPS0;
+                screen.x = static_cast<ScreenX>(rotate(static_cast<uint8_t>(screen.x),
+                        dir, static_cast<uint8_t>(ScreenX::nr_screens)));
+                screen.node = 0;
+
+                /* Enter the outdoor temperature from the right at the last node */
+                if (screen.x == ScreenX::temperature_outdoor && dir < 0)
+                        for (uint8_t i = 1; i < nr_nodes; i++)
+                                if (nodes[i].id != 0)
+                                        screen.node = i;
+        }
+}
+
+enum class Slide: uint8_t {
+        none,
+        left,                           /* The new picture comes from the right */
+        right,
+        up,                             /* From the bottom */
+        down,
+};
+
+/*
+ * Frame pipeline: screens render into the canvas and present it, the frame
+ * tick composes the display from it and syncs the chain. A presented picture
+ * slides in over what is displayed, a picture wider than the display scrolls
+ * to its end and back, holding at the ends.
+ */
+static struct {
+        uint8_t prev[display_width];    /* The display when the slide started */
+        Slide next;                     /* For the next presented picture */
+        Slide slide;
+        uint8_t step;                   /* Frames of the slide */
+        uint8_t width;                  /* Width of the picture in the canvas */
+        uint8_t scroll;                 /* Horizontal scroll (px) */
+        uint8_t wait;                   /* Frames until the next scroll step */
+        bool dirty;                     /* Compose at the next frame */
+        uint8_t origin;                 /* Column of the picture at the canvas start */
+        uint8_t (*render)(uint8_t x);   /* Renders a picture wider than the canvas */
+        uint8_t frame;                  /* The last frame counter */
+        uint16_t dropped;               /* Frames missed while moving */
+} frames = {{}, Slide::none, Slide::none, 0, display_width, 0, 0, false, 0, nullptr, 0, 0};
+
+/* Slide the next presented picture in */
+static void frame_slide(Slide s)
+{
+        frames.next = s;
+}
+
+/*
+ * The canvas has a new picture, a slide starts from what is displayed. A
+ * picture wider than the canvas is drawn in parts as it scrolls: render(x)
+ * draws it into the canvas from about the column x, and returns the column
+ * it started from. The canvas holds the start of the picture at first.
+ */
+static void frame_present(uint8_t width = display_width, uint8_t (*render)(uint8_t x) = nullptr)
+{
+        frames.render = render;
+        frames.origin = 0;
+        if (frames.next != Slide::none) {
+                memcpy(frames.prev, matrix.data(), display_width);
+                frames.slide = frames.next;
+                frames.next = Slide::none;
+                frames.step = 0;
+                frames.scroll = 0;
+                frames.wait = scroll_hold;
+        }
+        if (width != frames.width) {
+                frames.width = width;
+                frames.scroll = 0;
+                frames.wait = scroll_hold;
+        }
+        frames.dirty = true;
+}
+
+/* The picture moves, slow work waits to hold the frame rate */
+static bool frame_moving()
+{
+        return frames.slide != Slide::none ||
+                (frames.scroll != 0 && frames.scroll != frames.width - display_width);
+}
+
+/* Frame tick: advance the slide or the scroll, compose the display and sync it */
+static void frame_step()
+{
+        /* Frames are skipped if the main loop was busy */
+        const uint8_t frame = atomic_read(s_frame);
+        const uint8_t n = frame - frames.frame;
+        frames.frame = frame;
+        if (n > 1 && frame_moving())
+                frames.dropped += n - 1;
+
+        if (frames.slide != Slide::none) {
+                frames.step = min<uint8_t>(frames.step + n, slide_frames);
+                if (frames.step == slide_frames)
+                        frames.slide = Slide::none;
+                frames.dirty = true;
+        } else if (frames.width > display_width) {
+                if (frames.wait > n)
+                        frames.wait -= n;
+                else {
+                        const uint8_t end = frames.width - display_width;
+                        frames.scroll = (frames.scroll == end) ? 0 : min<uint8_t>(frames.scroll + n, end);
+                        frames.wait = (frames.scroll == 0 || frames.scroll == end) ? scroll_hold : scroll_frames;
+                        frames.dirty = true;
+                }
+        }
+
+        if (!frames.dirty)
+                return;
+
+        /* The part of a wide picture under the display */
+        if (frames.render && (frames.scroll < frames.origin ||
+                        frames.scroll - frames.origin > canvas.width - display_width))
+                frames.origin = frames.render(frames.scroll);
+
+        /* Compose to the display's buffer, then sync it at once */
+        uint8_t *d = matrix.data();
+        const uint8_t *p = frames.prev;
+        const uint8_t *c = canvas.data() + (frames.scroll - frames.origin);
+        const uint8_t dx = frames.step*display_width/slide_frames;
+        const uint8_t dy = frames.step*8/slide_frames;
+        for (uint8_t x = 0; x < display_width; x++) {
+                switch (frames.slide) {
+                case Slide::none:
+                        d[x] = c[x];
+                        break;
+                case Slide::left:
+                        d[x] = (x + dx < display_width) ? p[x + dx] : c[x + dx - display_width];
+                        break;
+                case Slide::right:
+                        d[x] = (x >= dx) ? p[x - dx] : c[x + display_width - dx];
+                        break;
+                case Slide::up:
+                        d[x] = p[x] << dy | c[x] >> (8 - dy);
+                        break;
+                case Slide::down:
+                        d[x] = p[x] >> dy | c[x] << (8 - dy);
+                        break;
+                }
         }
+        matrix.sync();
+        frames.dirty = false;
+}
+
+/* Content pushed from the PC through pc-link, it holds the display until the timeout */
+static struct {
+        bool active;
+        bool delta;                             /* The next frame may change the previous one */
+        uint8_t frame;                          /* Number of the previous frame */
+        int32_t until;                          /* Uptime to give the display back */
+        uint8_t text_length;
+        char text[remote_text_size];            /* Drawn as it scrolls (see remote_text_render) */
+} remote;
+
+static void remote_hold(uint8_t timeout)
+{
+        if (!remote.active)
+                frame_slide(Slide::up);
+        remote.active = true;
+        remote.until = s_uptime.read() + timeout;
+}
+
+/*
+ * A frame: 'F', frame number, timeout (s), a bit per column (LSB first),
+ * then the columns with the bits set. A frame with all columns replaces the
+ * display, the others change the previous frame, and are dropped if it was
+ * missed.
+ */
+static void remote_frame(const uint8_t *d, uint8_t len)
+{
+        constexpr uint8_t header = 3 + (display_width + 7)/8;
+        if (len < header)
+                return;
+
+        const uint8_t *mask = d + 3;
+        uint8_t n = 0;
+        for (uint8_t x = 0; x < display_width; x++)
+                n += (mask[x/8] >> x%8) & 1;
+        if (n != len - header)
+                return;
+        if (n != display_width && !(remote.active && remote.delta && d[1] == static_cast<uint8_t>(remote.frame + 1)))
+                return;
+
+        uint8_t *b = canvas.data();
+        const uint8_t *c = d + header;
+        for (uint8_t x = 0; x < display_width; x++)
+                if ((mask[x/8] >> x%8) & 1)
+                        b[x] = *c++;
+        remote.delta = true;
+        remote.frame = d[1];
+        remote_hold(d[2]);
+        frame_present();
+}
+
+/* Draw the pushed text from the glyph at the column x on, return the column of that glyph */
+static uint8_t remote_text_render(uint8_t x)
+{
+        const uint8_t first = x/6;
+        canvas.putc('\n');
+        for (uint8_t i = first; i < remote.text_length; i++)
+                canvas.putc(remote.text[i]);
+        return first*6;
+}
+
+/* Text: 'T', timeout (s), the text, it scrolls if it's wider than the display */
+static void remote_text(const uint8_t *d, uint8_t len)
+{
+        if (len < 2)
+                return;
+
+        remote.text_length = min<uint8_t>(len - 2, remote_text_size);
+        memcpy(remote.text, d + 2, remote.text_length);
+        remote.delta = false;
+        remote_hold(d[1]);
+        remote_text_render(0);
+        frame_present(max<uint8_t>(6*remote.text_length, display_width), remote_text_render);
+}
+
+#ifdef PROFILE
+constexpr uint8_t nr_link_pages = 2;
+constexpr uint8_t nr_frame_pages = 1;
+
+/*
+ * Radio link pages after the profiler ones, for all nodes: 'L' is packets
+ * lost in % with a decimal point, 'R' is retransmits per packet with two
+ * decimals
+ */
+static void show_link(uint8_t page)
+{
+        uint32_t received = 0, lost = 0, retransmits = 0;
+        for (const auto &n : nodes) {
+                received += n.received;
+                lost += n.lost;
+                retransmits += n.retransmits;
+        }
+
+        uint32_t v;
+        if (page == 0)
+                v = (received + lost != 0) ? lost*1000/(received + lost) : 0;
+        else
+                v = (received != 0) ? retransmits*100/received : 0;
+
+        canvas.printf(PSTR("\r%c%3u"), page == 0 ? 'L' : 'R', static_cast<uint16_t>(min<uint32_t>(v, 999)));
+        canvas.invert(0, 5);
+        canvas.draw_point(page == 0 ? 17 : 11, 0);
+}
+
+/* Frame pipeline page after the link ones: 'F' is frames dropped while moving */
+static void show_frames()
+{
+        canvas.printf(PSTR("\rF%3u"), min<uint16_t>(frames.dropped, 999));
+        canvas.invert(0, 5);
+}
+#endif
+
+static void nrf24_tune()
+{
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_CH, radio.channel);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP, radio.rate | Nrf24::RF_PWR_0dBm);
 }
 
 void nrf24_setup()
 {
-        /* 3-byte address, 2402 MHz, 1 Mbit/s */
+        /* 3-byte address, the home channel and rate */
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
                 Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT | Nrf24::EN_CRC |
                 Nrf24::PWR_UP | Nrf24::CRC0 | Nrf24::PRIM_RX);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP,
-                Nrf24::RF_DR_1Mbps | Nrf24::RF_PWR_0dBm);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DYN_ACK);
+        nrf24_tune();
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DYN_ACK | Nrf24::EN_DPL);
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_AW, Nrf24::AW_5_BYTES);
 
-        /* Enable data pipes 0 and 1 */
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR, Nrf24::ERX_P0 | Nrf24::ERX_P1);
+        /* Acknowledge packets on all pipes (senders retransmit until then) */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_AA,
+                Nrf24::ENAA_P0 | Nrf24::ENAA_P1 | Nrf24::ENAA_P2 |
+                Nrf24::ENAA_P3 | Nrf24::ENAA_P4 | Nrf24::ENAA_P5);
+
+        /* Enable data pipes 0 (pc-link) and 1..5 (outdoor nodes) */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR,
+                Nrf24::ERX_P0 | Nrf24::ERX_P1 | Nrf24::ERX_P2 |
+                Nrf24::ERX_P3 | Nrf24::ERX_P4 | Nrf24::ERX_P5);
 
-        /* Set the payload lengths */
-        static_assert(pc_link_payload_length < 32, "");
-        static_assert(outdoor_payload_length < 32, "");
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_PW_P0, pc_link_payload_length);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_PW_P1, outdoor_payload_length);
+        /* Dynamic payload length: commands of pc-link, batches of outdoor nodes */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_DYNPD,
+                Nrf24::DPL_P0 | Nrf24::DPL_P1 | Nrf24::DPL_P2 |
+                Nrf24::DPL_P3 | Nrf24::DPL_P4 | Nrf24::DPL_P5);
 
-        /* Set the addresses */
+        /* Set the addresses, pipes 2..5 have only the LSB */
         static_assert(size(pc_link_addr) == 5, "");
         static_assert(size(outdoor_addr) == 5, "");
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P0, pc_link_addr, size(pc_link_addr));
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P1, outdoor_addr, size(outdoor_addr));
+        for (uint8_t p = 2; p <= 5; p++)
+                nrf24.write(Nrf24::CMD_W_REGISTER | (Nrf24::REG_RX_ADDR_P0 + p), outdoor_addr[0] + p - 1);
 
         /* Start the receiver */
         delay_ms(Nrf24::tpd2stby);
         nrf24.set_ce(1);
 }
 
+/*
+ * Sample the received power detector (> -64 dBm) over the band to the survey
+ * map, and announce the handover to radio_rate, and to the quietest channel if
+ * it's quieter than the current one. A channel is scored with its neighbours,
+ * as the 2 Mbit/s signal takes 2 MHz.
+ */
+static void nrf24_survey()
+{
+        uint8_t busy[3] = {};                   /* Channels ch-2, ch-1, ch */
+        uint8_t column = 0;
+        uint8_t best = radio.channel;
+        uint8_t best_score = UINT8_MAX, current_score = UINT8_MAX;
+
+        static_assert(survey_channels == 4*size(radio.survey), "");
+        static_assert(survey_last + 1 < survey_channels, "");
+        nrf24.set_ce(0);
+        for (uint8_t ch = 0; ch < survey_channels; ch++) {
+                nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_CH, ch);
+                uint8_t n = 0;
+                for (uint8_t i = 0; i < survey_samples; i++) {
+                        nrf24.set_ce(1);
+                        delay_us(survey_dwell);
+                        n += nrf24.read(Nrf24::CMD_R_REGISTER | Nrf24::REG_RPD) & Nrf24::RPD;
+                        nrf24.set_ce(0);
+                }
+                busy[0] = busy[1];
+                busy[1] = busy[2];
+                busy[2] = n;
+
+                /* Score the previous channel */
+                const uint8_t prev = ch - 1;
+                if (prev >= survey_first && prev <= survey_last) {
+                        const uint8_t score = busy[0] + 2*busy[1] + busy[2];
+                        if (score < best_score) {
+                                best = prev;
+                                best_score = score;
+                        }
+                        if (prev == radio.channel)
+                                current_score = score;
+                }
+
+                column = max(column, n);
+                if (ch % 2 == 1) {
+                        const uint8_t h = (column*8 + survey_samples - 1)/survey_samples;
+                        uint8_t &m = radio.survey[ch/4];
+                        m = (ch % 4 == 1) ? (m & 0xf0) | h : (m & 0x0f) | h << 4;
+                        column = 0;
+                }
+        }
+        nrf24_tune();
+
+        radio.next_channel = (best_score < current_score) ? best : radio.channel;
+        radio.next_rate = radio_rate;
+        if (radio.next_channel != radio.channel || radio.next_rate != radio.rate)
+                radio.countdown = handover_cycles;
+}
+
+/* Send the beacon, the receiver should be stopped */
+static void nrf24_beacon()
+{
+        uint8_t d[beacon_payload_length];
+        const uint16_t t = beacon_time();
+        d[0] = t;
+        d[1] = t >> 8;
+        for (uint8_t i = 0; i < nr_nodes; i++)
+                d[2 + i] = nodes[i].id;
+        d[2 + nr_nodes] = radio.next_channel;
+        d[3 + nr_nodes] = radio.next_rate;
+        d[4 + nr_nodes] = radio.countdown;
+        d[5 + nr_nodes] = outdoor_batch_cycles;
+
+        /* Switch to the transmitter */
+        static_assert(size(beacon_addr) == 5, "");
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
+                Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT | Nrf24::EN_CRC |
+                Nrf24::PWR_UP | Nrf24::CRC0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_TX_ADDR, beacon_addr, size(beacon_addr));
+
+        /* Transmit, wait until done */
+        nrf24.write(Nrf24::CMD_FLUSH_TX);
+        nrf24.write(Nrf24::CMD_W_TX_PAYLOAD_NOACK, d, size(d));
+        nrf24.ce_pulse();
+        while ((nrf24.status() & (Nrf24::TX_DS | Nrf24::MAX_RT)) == 0)
+                memory_barrier();
+
+        /* Back to the receiver */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
+                Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT | Nrf24::EN_CRC |
+                Nrf24::PWR_UP | Nrf24::CRC0 | Nrf24::PRIM_RX);
+}
+
+/* Firmware update: the bootloader listens for it after a watchdog reset */
+static void reset_to_bootloader()
+{
+        cli();
+        WDTCSR = 1<<WDCE | 1<<WDE;
+        WDTCSR = 1<<WDE;        /* 16 ms */
+        while (true)
+                memory_barrier();
+}
+
 void nrf24_receive()
 {
-        uint8_t d[3];
+        PROFILE_SCOPE(nrf24_receive);
+
+        uint8_t d[32];
+        uint8_t pipe;
+        bool beacon = false;
+        bool late = false;                      /* The previous history record changed */
 
         /* Stop the receiver */
         nrf24.set_ce(0);
 
-        /* Get the received data */
-        switch (nrf24.status() & Nrf24::RX_P_NO) {
-        case Nrf24::RX_P_NO_0:  /* pc-link */
-                nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, d, 3);      /* Hours, minutes, seconds */
-                atomic_block {
-                        s_time.h = d[0];
-                        s_time.m = d[1];
-                        s_time.s = d[2];
-                        clock_recent = s_uptime;
-                }
-                break;
-        case Nrf24::RX_P_NO_1:  /* outdoor */
-                nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, d, 2);      /* Temperature, battery level */
-                weather.temperature_outdoor = d[0];
-                battery_level = d[1];
-                outdoor_recent = atomic_read(s_uptime);
-                break;
+        /* Get the received data, several nodes may be in the FIFO */
+        while ((pipe = nrf24.status() & Nrf24::RX_P_NO) != Nrf24::RX_P_NO) {
+                switch (pipe) {
+                case Nrf24::RX_P_NO_0: {        /* pc-link */
+                        const uint8_t len = nrf24.read(Nrf24::CMD_R_RX_PL_WID);
+                        if (len > size(d)) {
+                                nrf24.write(Nrf24::CMD_FLUSH_RX);
+                                break;
+                        }
+                        nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, d, len);
+                        if (len == size(pc_link_update) && d[0] == pc_link_update[0])
+                                reset_to_bootloader();
+                        if (d[0] == pc_link_frame) {
+                                remote_frame(d, len);
+                                break;
+                        }
+                        if (d[0] == pc_link_text) {
+                                remote_text(d, len);
+                                break;
+                        }
+                        if (len != pc_link_time_length)
+                                break;
+                        set_clock(Time {static_cast<int8_t>(d[0]), static_cast<int8_t>(d[1]),
+                                static_cast<int8_t>(d[2])});
+                        clock_recent = s_uptime.read();
+                        break;
+                }
+                case Nrf24::RX_P_NO_1:  /* outdoor nodes */
+                case Nrf24::RX_P_NO_2:
+                case Nrf24::RX_P_NO_3:
+                case Nrf24::RX_P_NO_4:
+                case Nrf24::RX_P_NO_5: {
+                        /* Node ID, battery level, packets lost since the previous one,
+                           retransmits of the previous one, then samples: temperature
+                           (1/16 °C, LSB first) and age (4 s), the freshest one last */
+                        const uint8_t len = nrf24.read(Nrf24::CMD_R_RX_PL_WID);
+                        if (len > size(d)) {
+                                nrf24.write(Nrf24::CMD_FLUSH_RX);
+                                break;
+                        }
+                        nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, d, len);
+                        beacon = true;
+                        Node *n = (len >= outdoor_header_length) ? find_node(d[0]) : nullptr;
+                        if (n == nullptr)
+                                break;
+                        n->battery = d[1];
+                        n->recent = s_uptime.read();
+                        n->received++;
+                        n->lost += d[2];
+                        n->retransmits += d[3];
+                        for (uint8_t i = outdoor_header_length; i + outdoor_sample_length <= len;
+                                        i += outdoor_sample_length) {
+                                const int16_t t = concat16(d[i + 1], d[i]);
+                                n->temperature = celsius(t);
+                                int8_t &lo = n->lo[node_bucket], &hi = n->hi[node_bucket];
+                                lo = (lo == bad_temperature) ? n->temperature : min(lo, n->temperature);
+                                hi = (hi == bad_temperature) ? n->temperature : max(hi, n->temperature);
+                                if (n == &nodes[0])
+                                        late |= outdoor_sample(t, d[i + 2]*4);
+                        }
+                        weather.temperature_outdoor = nodes[0].temperature;
+                        break;
+                }
+                default:
+                        nrf24.write(Nrf24::CMD_FLUSH_RX);
+                        break;
+                }
         }
 
-        /* Flush the receiver and clear the interrupt flags */
-        nrf24.write(Nrf24::CMD_FLUSH_RX);
+        /* The node listens for the beacon right after its packet */
+        if (beacon)
+                nrf24_beacon();
+
+        /* Samples were taken before the last history record */
+        if (late)
+                save_history((history.current + history_size - 1) % history_size);
+
+        /* Clear the interrupt flags */
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
                 Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT);
 
@@ -289,10 +1438,21 @@ void nrf24_receive()
 int main()
 {
         Flags flags = {};
-        Screen screen = {ScreenX::clock, ScreenY::current};
+        Screen screen = {ScreenX::clock, ScreenY::current, 0};
         bool temperature_indoor_reliable = false;
         bool humidity_reliable = false;
         bool pressure_reliable = false;
+        Bmp085::Conversion bmp085_conversion = Bmp085::temperature;
+        uint16_t timeouts = 0;                  /* Expired timers (TimerId bits) */
+        bool dht22_due = false;                 /* Start the DHT22 when the picture stands still */
+#ifdef PROFILE
+        uint8_t diagnostics = 0;                /* Diagnostics page + 1, 0 is off */
+#endif
+
+        /* Reset cause, the bootloader passes it in GPIOR0 */
+        const uint8_t reset_cause = MCUSR | GPIOR0;
+        MCUSR = 0;
+        GPIOR0 = 0;
 
         /* GPIO init */
         PORTB = 0b00000011;
@@ -306,10 +1466,25 @@ int main()
         ACSR = 1<<ACD;
         PRR = 1<<PRTIM1 | 1<<PRUSART0;
 
+#ifdef PROFILE
+        /* 16-bit T/C1 for the cycle profiler */
+        Profile::init();
+#endif
+
         /* 8-bit T/C0 for the ~500 Hz interrupt */
         TCCR0B = 1<<CS01 | 1<<CS00;
         TIMSK0 |= 1<<TOIE0;
 
+        /* ADC triggered by Timer0 overflows (1.1 V reference, 62.5 kHz clock) */
+        static_assert(light_adc_channel <= 7, "");
+        ADMUX = 1<<REFS1 | 1<<REFS0 | 1<<ADLAR | light_adc_channel;
+        ADCSRB = 1<<ADTS2;
+        ADCSRA = 1<<ADEN | 1<<ADATE | 1<<ADIE | 1<<ADPS2 | 1<<ADPS1 | 1<<ADPS0;
+
+        /* Pin change interrupt for the rotary encoder */
+        PCMSK2 = 1<<PCINT18 | 1<<PCINT19;
+        PCICR = 1<<PCIE2;
+
         /* 8-bit T/C2 for the 1 Hz interrupt */
         ASSR = 1<<AS2;
         TCCR2B = 1<<CS22 | 1<<CS20;
@@ -323,7 +1498,7 @@ int main()
         WDTCSR = 1<<WDE | 1<<WDP3;
 
         /* Other setups */
-        spi.init(SpiHardware::div_16);
+        spi.init();
         max_chain.init();
         matrix.init();
         nrf24.init();
@@ -331,42 +1506,89 @@ int main()
         dht22.init();
         bool bmp085_ok = i2c.init(i2c_freq) && bmp085.init();
 
-        /* Clear the weather history */
+        /* Clear the weather history, and restore what was saved */
         for (auto &w : history.weather)
                 w = bad_weather;
+        nodes_init();
+        restore(!(reset_cause & (1<<PORF | 1<<BORF)));
+        archive_init(!(reset_cause & (1<<PORF | 1<<BORF)));
+        archive_update();
+        tendency_init();
 
         /* Initial flags */
         flags.measure_indoor = 1;
         flags.light_changed = 1;
+        flags.survey = 1;
 
         sei();
 
         while (true)
         {
+                PROFILE_SCOPE(loop);
+
                 atomic_block {
                         flags.all |= s_flags.all;
                         s_flags.all = 0;
                 }
+                const bool moving = frame_moving();
 
-                /* Indoor weather measurements */
-                if (flags.measure_indoor) {
-                        temperature_indoor_reliable = humidity_reliable = dht22.read();
-                        if (temperature_indoor_reliable) {
-                                weather.temperature_indoor = dht22.get_temperature()/10;
-                                weather.humidity = dht22.get_humidity()/10;
-                        }
+                /* Indoor weather measurements: start the sensors, read them when their timers expire */
+                if (flags.measure_indoor && !moving) {
+                        dht22_due = true;
+
+                        bmp085_conversion = Bmp085::temperature;
+                        if (bmp085_ok && bmp085.start(bmp085_conversion))
+                                timers.start(timer_bmp085, timer_ticks(Bmp085::conversion_time(bmp085_conversion)));
+                        else
+                                pressure_reliable = false;
+
+                        flags.measure_indoor = 0;
+                }
+
+                /* The DHT22 reading blocks interrupts for ~5 ms, so it's done while the picture stands still */
+                if (dht22_due && !moving) {
+                        dht22.start();
+                        timers.start(timer_dht22, timer_ticks(Dht22::start_time));
+                        dht22_due = false;
+                }
+                timeouts |= timers.take();
 
-                        pressure_reliable = bmp085_ok && bmp085.read();
-                        if (pressure_reliable) {
-                                weather.pressure = bmp085.get_pressure()*760/101325;
-                                if (!temperature_indoor_reliable) {
-                                        weather.temperature_indoor = bmp085.get_temperature()/10;
-                                        temperature_indoor_reliable = true;
+                if (timeouts & 1<<timer_dht22) {
+                        if (moving) {
+                                /* Don't hold START for the whole slide, start again after it */
+                                dht22.cancel();
+                                dht22_due = true;
+                        } else {
+                                temperature_indoor_reliable = humidity_reliable = dht22.read();
+                                if (temperature_indoor_reliable) {
+                                        weather.temperature_indoor = dht22.get_temperature()/10;
+                                        weather.humidity = dht22.get_humidity()/10;
                                 }
+                                flags.refresh_screen = 1;
                         }
+                        timeouts &= ~(1<<timer_dht22);
+                }
 
-                        flags.measure_indoor = 0;
-                        flags.refresh_screen = 1;
+                /* The temperature conversion of the BMP085, then the pressure one */
+                if (timeouts & 1<<timer_bmp085) {
+                        if (bmp085_conversion == Bmp085::temperature) {
+                                bmp085_conversion = Bmp085::pressure;
+                                if (bmp085.read(Bmp085::temperature) && bmp085.start(bmp085_conversion))
+                                        timers.start(timer_bmp085, timer_ticks(Bmp085::conversion_time(bmp085_conversion)));
+                                else
+                                        pressure_reliable = false;
+                        } else {
+                                pressure_reliable = bmp085.read(Bmp085::pressure);
+                                if (pressure_reliable) {
+                                        weather.pressure = bmp085.get_pressure()*7600/101325;
+                                        if (!temperature_indoor_reliable) {
+                                                weather.temperature_indoor = bmp085.get_temperature()/10;
+                                                temperature_indoor_reliable = true;
+                                        }
+                                }
+                                flags.refresh_screen = 1;
+                        }
+                        timeouts &= ~(1<<timer_bmp085);
                 }
 
                 /* Receive data from NRF24 */
@@ -377,38 +1599,47 @@ int main()
                 }
 
                 /* Rotate screens */
-                if (flags.enc_rotated_left || flags.enc_rotated_right) {
-                        if (Gpio::read(enc_button)) {
-                                constexpr auto n = static_cast<uint8_t>(ScreenX::nr_screens);
-                                const auto i = static_cast<uint8_t>(screen.x);
-                                screen.x = static_cast<ScreenX>(
-                                        (flags.enc_rotated_right ? i + 1 : i + n - 1) % n);
+                EncoderEvent e;
+                while (s_encoder_events.pop(e)) {
+                        if (!e.pushed) {
+                                rotate_x(screen, e.steps);
+                                frame_slide(e.steps > 0 ? Slide::left : Slide::right);
+#ifdef PROFILE
+                                diagnostics = 0;
+                        } else if (screen.x == ScreenX::clock) {
+                                diagnostics = rotate(diagnostics, e.steps, Profile::nr_pages + nr_link_pages + nr_frame_pages + 1);
+#endif
                         } else {
-                                constexpr auto n = static_cast<uint8_t>(ScreenY::nr_screens);
-                                const auto i = static_cast<uint8_t>(screen.y);
-                                screen.y = static_cast<ScreenY>(
-                                        (flags.enc_rotated_right ? i + 1 : i + n - 1) % n);
+                                const ScreenY prev_y = screen.y;
+                                screen.y = static_cast<ScreenY>(rotate(static_cast<uint8_t>(screen.y),
+                                        e.steps, static_cast<uint8_t>(ScreenY::nr_screens)));
+                                frame_slide(e.steps > 0 ? Slide::up : Slide::down);
+
+                                /* Entering the survey map */
+                                if (screen.x == ScreenX::radio && prev_y == ScreenY::current &&
+                                                screen.y != ScreenY::current)
+                                        flags.survey = 1;
                         }
 
+                        remote.active = false;
                         atomic_write(s_inactivity_timer, 0);
-                        flags.enc_rotated_left = 0;
-                        flags.enc_rotated_right = 0;
                         flags.refresh_screen = 1;
                 }
 
                 /* Set matrix brightness */ 
                 if (flags.light_changed) {
                         static uint8_t prev_brightness = 255;
-                        uint8_t adc = atomic_read(s_light);
+                        const uint16_t light = atomic_read(s_light);
 
-                        /* Ambient light level -> 0..6 linearly */
-                        uint8_t brightness = adc*6/full_brightness;
-                        brightness = min<uint8_t>(brightness, 6);
+                        /* Walk the curve from the current level */
+                        uint8_t brightness = (prev_brightness > 15) ? 0 : prev_brightness;
+                        while (brightness < 15 && light >= pgm_read_word(&brightness_curve.up[brightness + 1]))
+                                brightness++;
+                        while (brightness > 0 && light < pgm_read_word(&brightness_curve.down[brightness]))
+                                brightness--;
 
-                        /* Add hysteresis */
-                        int16_t diff = adc - prev_brightness*full_brightness/6;
-                        if (brightness != prev_brightness && abs(diff) > hysteresis) {
-                                matrix.set_brightness(brightness*2+3);  /* Map 0..6 to 3,5..15 */
+                        if (brightness != prev_brightness) {
+                                matrix.set_brightness(brightness);
                                 prev_brightness = brightness;
                         }
                         flags.light_changed = 0;
@@ -416,70 +1647,240 @@ int main()
 
                 /* Reset screen */
                 if (flags.reset_screen) {
+                        if (!remote.active && (screen.x != ScreenX::clock || screen.y != ScreenY::current))
+                                frame_slide(Slide::right);
                         screen.x = ScreenX::clock;
                         screen.y = ScreenY::current;
+                        screen.node = 0;
                         flags.reset_screen = 0;
                         flags.refresh_screen = 1;
                 }
 
                 /* Save current weather to the history */
-                if (flags.update_history) {
-                        history.weather[history.current] = weather;
+                if (flags.update_history && !moving) {
+                        /* The outdoor temperature is the mean of samples taken for the record */
+                        Weather w = weather;
+                        auto &s = outdoor_samples;
+                        if (s.count[0] != 0)
+                                w.temperature_outdoor = celsius(s.sum[0]/s.count[0]);
+                        s.sum[1] = s.sum[0];
+                        s.count[1] = s.count[0];
+                        s.sum[0] = 0;
+                        s.count[0] = 0;
+                        s.start = s_uptime.read();
+
+                        archive_push();
+                        history.weather[history.current] = w;
+                        tendency_3h.add(tendency_sample, history_size, history.current);
+                        tendency_12h.add(tendency_sample, history_size, history.current);
+                        archive_update();
+                        save_history(history.current);
                         history.current = (history.current + 1) % history_size;
+                        save_clock();
+
+                        /* Next 6 hours of the node extremes */
+                        static_assert(history_size % node_buckets == 0, "");
+                        if (history.current % (history_size/node_buckets) == 0) {
+                                node_bucket = (node_bucket + 1) % node_buckets;
+                                nodes_clear_bucket(node_bucket);
+                        }
                         flags.update_history = 0;
                 }
 
+                /* Save the clock to EEPROM */
+                if (flags.checkpoint && !moving) {
+                        save_clock();
+                        flags.checkpoint = 0;
+                }
+
+                /* Survey the radio channels, the receiver is off for ~0.4 s */
+                if (flags.survey && !moving) {
+                        nrf24_survey();
+                        nrf24.set_ce(1);
+                        flags.survey = 0;
+                        flags.refresh_screen = 1;
+                }
+
+                /* Switch to the announced channel and rate */
+                if (flags.beacon_cycle) {
+                        if (radio.countdown != 0 && --radio.countdown == 0) {
+                                radio.channel = radio.next_channel;
+                                radio.rate = radio.next_rate;
+                                nrf24.set_ce(0);
+                                nrf24_tune();
+                                nrf24.set_ce(1);
+                        }
+                        flags.beacon_cycle = 0;
+                }
+
+                /* Pushed content holds the display, then the screens slide back */
+                if (remote.active) {
+                        if (s_uptime.read() - remote.until < 0)
+                                flags.refresh_screen = 0;
+                        else {
+                                remote.active = false;
+                                frame_slide(Slide::down);
+                                flags.refresh_screen = 1;
+                        }
+                }
+
+                /* Show the forecast (it has no views by Y, so goes first) */
+                if (flags.refresh_screen && screen.x == ScreenX::forecast) {
+                        PROFILE_SCOPE(refresh);
+
+                        const int16_t t3 = tendency_3h.get();
+                        const int16_t t12 = tendency_12h.get();
+                        const char letter = (weather.pressure != bad_pressure) ?
+                                forecast(weather.pressure, t3, t12) : 0;
+
+                        if (letter != 0) {
+                                const int16_t t = (t3 != tendency_unknown) ? t3 : t12;
+                                char arrow = '-';
+                                if (t <= -tendency_threshold)
+                                        arrow = MatrixBase::special_down_arrow;
+                                else if (t >= tendency_threshold)
+                                        arrow = MatrixBase::special_up_arrow;
+                                const uint8_t change = min<uint16_t>(abs(t), 99);
+                                canvas.printf(PSTR("\r%c%c%u%u"), forecast_icon(letter), arrow,
+                                        change/10, change%10);
+                                canvas.draw_point(17, 0);       /* mmHg for 3 hours */
+                                canvas.draw_point(23, 0, !pressure_reliable);
+                        } else
+                                canvas.printf(PSTR("\r%c---"), MatrixBase::special_cloudy);
+
+                        frame_present();
+                        flags.refresh_screen = 0;
+                }
+
+                /* Show the radio channel, or the survey map (goes first as well) */
+                if (flags.refresh_screen && screen.x == ScreenX::radio) {
+                        PROFILE_SCOPE(refresh);
+
+                        uint8_t width = display_width;
+                        if (screen.y == ScreenY::current) {
+                                /* The label is the rate: 'C' is 1 Mbit/s, 'F' is 2 Mbit/s, 'R' is 250 kbit/s */
+                                const char label = (radio.rate == Nrf24::RF_DR_2Mbps) ? 'F' :
+                                        (radio.rate == Nrf24::RF_DR_250kbps) ? 'R' : 'C';
+                                canvas.printf(PSTR("\r%c%3u"), label, radio.channel);
+                                canvas.draw_point(23, 0, radio.countdown != 0);
+                        } else {
+                                canvas.clear();
+                                for (uint8_t x = 0; x < survey_channels/2; x++)
+                                        for (uint8_t y = 0; y < (radio.survey[x/2] >> (x % 2)*4 & 0x0f); y++)
+                                                canvas.draw_point(x, y);
+                                width = survey_channels/2;
+                        }
+
+                        frame_present(width);
+                        flags.refresh_screen = 0;
+                }
+
+                /* Show other outdoor nodes (they have extremes for 24 hours only, so go first) */
+                if (flags.refresh_screen && screen.x == ScreenX::temperature_outdoor && screen.node != 0) {
+                        PROFILE_SCOPE(refresh);
+
+                        const Node &n = nodes[screen.node];
+                        const char label = '1' + screen.node;
+
+                        switch (screen.y) {
+                        case ScreenY::current:
+                                if (n.temperature != bad_temperature) {
+                                        canvas.printf(PSTR("\r%c%+3d"), label, n.temperature);
+                                        auto uptime = s_uptime.read();
+                                        canvas.draw_point(23, 0, uptime - n.recent > outdoor_reliable_time);
+                                        canvas.draw_point(23, 7, n.battery < low_battery_level);
+                                } else
+                                        canvas.printf(PSTR("\r%c---"), label);
+                                break;
+                        case ScreenY::minimal:
+                        case ScreenY::maximal: {
+                                const bool minimal = (screen.y == ScreenY::minimal);
+                                const char symbol = minimal ? MatrixBase::special_min : MatrixBase::special_max;
+                                const int8_t m = node_extreme(n, minimal);
+                                if (m != bad_temperature)
+                                        canvas.printf(PSTR("\r%c%+3d"), symbol, m);
+                                else
+                                        canvas.printf(PSTR("\r%c---"), symbol);
+                                break;
+                        }
+                        default:
+                                canvas.printf(PSTR("\r%c---"), label);
+                                break;
+                        }
+
+                        frame_present();
+                        flags.refresh_screen = 0;
+                }
+
                 /* Show clock, current weather and warning marks */
                 if (flags.refresh_screen && (screen.x == ScreenX::clock || screen.y == ScreenY::current)) {
+                        PROFILE_SCOPE(refresh);
+
                         switch (screen.x) {
                         case ScreenX::clock: {
-                                auto time = atomic_read(s_time);
-                                matrix.printf(PSTR("\r%02u%02u"), time.h, time.m);
-                                matrix.draw_point(11, 0, time.s % 2);
-                                auto uptime = atomic_read(s_uptime);
-                                matrix.draw_point(23, 0, uptime - clock_recent > clock_reliable_time);
+#ifdef PROFILE
+                                if (diagnostics > Profile::nr_pages + nr_link_pages) {
+                                        show_frames();
+                                        break;
+                                }
+                                if (diagnostics > Profile::nr_pages) {
+                                        show_link(diagnostics - 1 - Profile::nr_pages);
+                                        break;
+                                }
+                                if (diagnostics != 0) {
+                                        Profile::show(canvas, diagnostics - 1);
+                                        break;
+                                }
+#endif
+                                auto time = clock_time();
+                                canvas.printf(PSTR("\r%02u%02u"), time.h, time.m);
+                                canvas.draw_point(11, 0, time.s % 2);
+                                auto uptime = s_uptime.read();
+                                canvas.draw_point(23, 0, uptime - clock_recent > clock_reliable_time);
                                 break;
                         }
                         case ScreenX::temperature_outdoor:
                                 if (weather.temperature_outdoor != bad_temperature) {
-                                        matrix.printf(PSTR("\rO%+3d"), weather.temperature_outdoor);
-                                        auto uptime = atomic_read(s_uptime);
-                                        matrix.draw_point(23, 0, uptime - outdoor_recent > outdoor_reliable_time);
-                                        matrix.draw_point(23, 7, battery_level < low_battery_level);
+                                        canvas.printf(PSTR("\rO%+3d"), weather.temperature_outdoor);
+                                        auto uptime = s_uptime.read();
+                                        canvas.draw_point(23, 0, uptime - nodes[0].recent > outdoor_reliable_time);
+                                        canvas.draw_point(23, 7, nodes[0].battery < low_battery_level);
                                 } else
-                                        matrix.printf(PSTR("\rO---"));
+                                        canvas.printf(PSTR("\rO---"));
                                 break;
                         case ScreenX::temperature_indoor:
                                 if (weather.temperature_indoor != bad_temperature) {
-                                        matrix.printf(PSTR("\rI%+3d"), weather.temperature_indoor);
-                                        matrix.draw_point(23, 0, !temperature_indoor_reliable);
+                                        canvas.printf(PSTR("\rI%+3d"), weather.temperature_indoor);
+                                        canvas.draw_point(23, 0, !temperature_indoor_reliable);
                                 } else
-                                        matrix.printf(PSTR("\rI---"));
+                                        canvas.printf(PSTR("\rI---"));
                                 break;
                         case ScreenX::humidity:
                                 if (weather.humidity != bad_humidity) {
-                                        matrix.printf(PSTR("\rH%3u"), weather.humidity);
-                                        matrix.draw_point(23, 0, !humidity_reliable);
+                                        canvas.printf(PSTR("\rH%3u"), weather.humidity);
+                                        canvas.draw_point(23, 0, !humidity_reliable);
                                 } else
-                                        matrix.printf(PSTR("\rH---"));
+                                        canvas.printf(PSTR("\rH---"));
                                 break;
                         case ScreenX::pressure:
                                 if (weather.pressure != bad_pressure) {
-                                        matrix.printf(PSTR("\rP%3u"), weather.pressure);
-                                        matrix.draw_point(23, 0, !pressure_reliable);
+                                        canvas.printf(PSTR("\rP%3u"), mmhg(weather.pressure));
+                                        canvas.draw_point(23, 0, !pressure_reliable);
                                 } else
-                                        matrix.printf(PSTR("\rP---"));
+                                        canvas.printf(PSTR("\rP---"));
                                 break;
                         default:
                                 break;
                         }
 
-                        matrix.sync();
+                        frame_present();
                         flags.refresh_screen = 0;
                 }
 
                 /* Show the weather change for 24 hours */
                 if (flags.refresh_screen && screen.x != ScreenX::clock && screen.y == ScreenY::change) {
+                        PROFILE_SCOPE(refresh);
+
                         Weather old = history.weather[(history.current + 1) % history_size];
                         int16_t diff = INT16_MAX;
 
@@ -502,26 +1903,28 @@ int main()
                         case ScreenX::pressure:
                                 if (weather.pressure != bad_pressure
                                                 && old.pressure != bad_pressure)
-                                        diff = weather.pressure - old.pressure;
+                                        diff = mmhg(weather.pressure) - mmhg(old.pressure);
                                 break;
                         default:
                                 break;
                         }
 
                         if (diff != INT16_MAX) {
-                                matrix.printf(
+                                canvas.printf(
                                         PSTR("\r%c%3u"),
-                                        diff < 0 ? Matrix::special_down_arrow : Matrix::special_up_arrow,
+                                        diff < 0 ? MatrixBase::special_down_arrow : MatrixBase::special_up_arrow,
                                         abs(diff));
                         } else
-                                matrix.printf(PSTR("\r%c---"), Matrix::special_up_arrow);
+                                canvas.printf(PSTR("\r%c---"), MatrixBase::special_up_arrow);
 
-                        matrix.sync();
+                        frame_present();
                         flags.refresh_screen = 0;
                 }
 
                 /* Show minimal values of weather parameters for 24 hours */
                 if (flags.refresh_screen && screen.x != ScreenX::clock && screen.y == ScreenY::minimal) {
+                        PROFILE_SCOPE(refresh);
+
                         switch (screen.x) {
                         case ScreenX::temperature_outdoor: {
                                 auto m = weather.temperature_outdoor;
@@ -530,9 +1933,9 @@ int main()
                                                 m = min(m, w.temperature_outdoor);
 
                                 if (m != bad_temperature)
-                                        matrix.printf(PSTR("\r%c%+3d"), Matrix::special_min, m);
+                                        canvas.printf(PSTR("\r%c%+3d"), MatrixBase::special_min, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_min);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_min);
                                 break;
                         }
                         case ScreenX::temperature_indoor: {
@@ -542,9 +1945,9 @@ int main()
                                                 m = min(m, w.temperature_indoor);
 
                                 if (m != bad_temperature)
-                                        matrix.printf(PSTR("\r%c%+3d"), Matrix::special_min, m);
+                                        canvas.printf(PSTR("\r%c%+3d"), MatrixBase::special_min, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_min);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_min);
                                 break;
                         }
                         case ScreenX::humidity: {
@@ -554,9 +1957,9 @@ int main()
                                                 m = min(m, w.humidity);
 
                                 if (m != bad_humidity)
-                                        matrix.printf(PSTR("\r%c%3u"), Matrix::special_min, m);
+                                        canvas.printf(PSTR("\r%c%3u"), MatrixBase::special_min, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_min);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_min);
                                 break;
                         }
                         case ScreenX::pressure: {
@@ -566,21 +1969,23 @@ int main()
                                                 m = min(m, w.pressure);
 
                                 if (m != bad_pressure)
-                                        matrix.printf(PSTR("\r%c%3u"), Matrix::special_min, m);
+                                        canvas.printf(PSTR("\r%c%3u"), MatrixBase::special_min, mmhg(m));
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_min);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_min);
                                 break;
                         }
                         default:
                                 break;
                         }
 
-                        matrix.sync();
+                        frame_present();
                         flags.refresh_screen = 0;
                 }
 
                 /* Show maximal values of wether parameters for 24 hours */
                 if (flags.refresh_screen && screen.x != ScreenX::clock && screen.y == ScreenY::maximal) {
+                        PROFILE_SCOPE(refresh);
+
                         switch (screen.x) {
                         case ScreenX::temperature_outdoor: {
                                 auto m = weather.temperature_outdoor;
@@ -589,9 +1994,9 @@ int main()
                                                 m = max(m, w.temperature_outdoor);
 
                                 if (m != bad_temperature)
-                                        matrix.printf(PSTR("\r%c%+3d"), Matrix::special_max, m);
+                                        canvas.printf(PSTR("\r%c%+3d"), MatrixBase::special_max, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_max);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_max);
                                 break;
                         }
                         case ScreenX::temperature_indoor: {
@@ -601,9 +2006,9 @@ int main()
                                                 m = max(m, w.temperature_indoor);
 
                                 if (m != bad_temperature)
-                                        matrix.printf(PSTR("\r%c%+3d"), Matrix::special_max, m);
+                                        canvas.printf(PSTR("\r%c%+3d"), MatrixBase::special_max, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_max);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_max);
                                 break;
                         }
                         case ScreenX::humidity: {
@@ -613,9 +2018,9 @@ int main()
                                                 m = max(m, w.humidity);
 
                                 if (m != bad_humidity)
-                                        matrix.printf(PSTR("\r%c%3u"), Matrix::special_max, m);
+                                        canvas.printf(PSTR("\r%c%3u"), MatrixBase::special_max, m);
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_max);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_max);
                                 break;
                         }
                         case ScreenX::pressure: {
@@ -625,20 +2030,68 @@ int main()
                                                 m = max(m, w.pressure);
 
                                 if (m != bad_pressure)
-                                        matrix.printf(PSTR("\r%c%3u"), Matrix::special_max, m);
+                                        canvas.printf(PSTR("\r%c%3u"), MatrixBase::special_max, mmhg(m));
                                 else
-                                        matrix.printf(PSTR("\r%c---"), Matrix::special_max);
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_max);
                                 break;
                         }
                         default:
                                 break;
                         }
 
-                        matrix.sync();
+                        frame_present();
                         flags.refresh_screen = 0;
                 }
 
-                asm volatile ("wdr" ::: "memory");
+                /* Show the weather change and extremes for a week or a month */
+                if (flags.refresh_screen && screen.x != ScreenX::clock && screen.y >= ScreenY::change_week) {
+                        PROFILE_SCOPE(refresh);
+
+                        const uint8_t view = static_cast<uint8_t>(screen.y) - static_cast<uint8_t>(ScreenY::change_week);
+                        const uint8_t param = static_cast<uint8_t>(screen.x) - 1;
+                        const Aggregate &a = (view < 3 ? archive.week : archive.month).param[param];
+                        const uint8_t now = encode(weather, param);
+
+                        if (view % 3 == 0) {
+                                if (now != bad_code && a.mean != bad_code) {
+                                        const int16_t diff = now - a.mean;
+                                        canvas.printf(PSTR("\r%c%3u"),
+                                                diff < 0 ? MatrixBase::special_down_arrow : MatrixBase::special_up_arrow,
+                                                abs(diff));
+                                } else
+                                        canvas.printf(PSTR("\r%c---"), MatrixBase::special_up_arrow);
+                        } else {
+                                const bool minimal = (view % 3 == 1);
+                                uint8_t m = minimal ? a.lo : a.hi;
+                                if (m == bad_code)
+                                        m = now;
+                                else if (now != bad_code)
+                                        m = minimal ? min(m, now) : max(m, now);
+
+                                const char symbol = minimal ? MatrixBase::special_min : MatrixBase::special_max;
+                                if (m == bad_code)
+                                        canvas.printf(PSTR("\r%c---"), symbol);
+                                else if (param <= param_temperature_indoor)
+                                        canvas.printf(PSTR("\r%c%+3d"), symbol, decode(m, param));
+                                else
+                                        canvas.printf(PSTR("\r%c%3u"), symbol, decode(m, param));
+                        }
+
+                        /* Period mark under the symbol: a point for a week, a line for a month */
+                        for (uint8_t x = 0; x < (view < 3 ? 1 : 5); x++)
+                                canvas.draw_point(x, 0);
+
+                        frame_present();
+                        flags.refresh_screen = 0;
+                }
+
+                /* Compose and show a frame */
+                if (flags.frame) {
+                        frame_step();
+                        flags.frame = 0;
+                }
+
+                wdt_reset();
         }
 
         return 0;  /* Never be here */
@@ -1,12 +1,8 @@
 #include "bmp085.hpp"
 #include "common.hpp"
-#include "delay.hpp"
+#include "profile.hpp"
 
 constexpr uint8_t i2c_addr = 0x77;
-constexpr uint8_t oss = 3;
-
-constexpr double up_conversion_time = 1.5 + (3<<oss);  /* ms */
-constexpr double ut_conversion_time = 4.5;             /* ms */
 
 bool Bmp085::read_eeprom(uint8_t addr, uint16_t &data)
 {
@@ -34,42 +30,30 @@ bool Bmp085::read_calibration()
                 read_eeprom(0xbe, (uint16_t &)cal.md);
 }
 
-bool Bmp085::read_uncompensated(bool p, int32_t &val)
+bool Bmp085::start(Conversion c)
 {
-        /* Start conversion */
-        {
-                const uint8_t out[] = {0xf4, p ? 0x34+(oss<<6) : 0x2e};
-                if (i2c.write(i2c_addr, out, 2, 1) < 2)
-                        return false;
-        }
-
-        /* Wait */
-        if (p)
-                delay_ms(up_conversion_time);
-        else
-                delay_ms(ut_conversion_time);
+        const uint8_t out[] = {0xf4, c == pressure ? 0x34+(oss<<6) : 0x2e};
+        return i2c.write(i2c_addr, out, 2, 1) == 2;
+}
 
-        /* Read the measured value */
-        {
-                const uint8_t out[] = {0xf6};
-                uint8_t in[3];
-                const uint8_t len = p ? 3 : 2;
+bool Bmp085::read(Conversion c)
+{
+        PROFILE_SCOPE(bmp085_read);
 
-                if (i2c.write(i2c_addr, out, 1, 0) < 1 || i2c.read(i2c_addr, in, len, 1) < len)
-                        return false;
+        const uint8_t out[] = {0xf6};
+        uint8_t in[3];
+        const uint8_t len = (c == pressure) ? 3 : 2;
 
-                val = p ? concat32(0, in[0], in[1], in[2]) >> (8-oss)
-                        : concat16(in[0], in[1]);
-        }
+        if (i2c.write(i2c_addr, out, 1, 0) < 1 || i2c.read(i2c_addr, in, len, 1) < len)
+                return false;
 
+        if (c == pressure)
+                up = concat32(0, in[0], in[1], in[2]) >> (8-oss);
+        else
+                ut = concat16(in[0], in[1]);
         return true;
 }
 
-bool Bmp085::read()
-{
-        return read_uncompensated(0, ut) && read_uncompensated(1, up);
-}
-
 uint32_t Bmp085::get_pressure()
 {
         int32_t b6, x1, x2, x3, b3, b5, b7, p;
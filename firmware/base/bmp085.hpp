@@ -14,19 +14,31 @@ private:
                 int16_t  b1, b2, mb, mc, md;
         };
 
+        static constexpr uint8_t oss = 3;       /* Ultra high resolution */
+
         I2c &i2c;
         Calibration cal;
         int32_t ut, up;
 
         bool read_eeprom(uint8_t addr, uint16_t &data);
         bool read_calibration();
-        bool read_uncompensated(bool p, int32_t &val);
 public:
         explicit Bmp085(I2c &i2c);
         bool init();
 
-        /* Make a measurement and read the measured data */
-        bool read();
+        /* A measurement is the temperature conversion, then the pressure one */
+        enum Conversion: uint8_t {
+                temperature,
+                pressure,
+        };
+
+        static constexpr double conversion_time(Conversion c) {         /* ms */
+                return (c == pressure) ? 1.5 + (3<<oss) : 4.5;
+        }
+
+        /* Start a conversion, read it conversion_time() later */
+        bool start(Conversion c);
+        bool read(Conversion c);
 
         /* Air pressure in Pa */
         uint32_t get_pressure();
@@ -48,4 +48,10 @@ constexpr uint32_t concat32(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
                 static_cast<uint16_t>(c) << 8 | d;
 }
 
+constexpr uint8_t reverse_bits(uint8_t x) {
+        x = (x & 0xf0) >> 4 | (x & 0x0f) << 4;
+        x = (x & 0xcc) >> 2 | (x & 0x33) << 2;
+        return (x & 0xaa) >> 1 | (x & 0x55) << 1;
+}
+
 #endif
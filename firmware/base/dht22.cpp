@@ -2,6 +2,7 @@
 #include "delay.hpp"
 #include "common.hpp"
 #include "shared.hpp"
+#include "profile.hpp"
 
 static_assert(F_CPU >= 8e6, "");
 
@@ -46,13 +47,21 @@ void Dht22::init()
         Gpio::set(data_pin, Gpio::tri);
 }
 
+void Dht22::start()
+{
+        Gpio::write(data_pin, 0);
+}
+
+void Dht22::cancel()
+{
+        Gpio::set(data_pin, Gpio::tri);
+}
+
 bool Dht22::read()
 {
-        uint8_t data[5];
+        PROFILE_SCOPE(dht22_read);
 
-        /* Write START */
-        Gpio::write(data_pin, 0);
-        delay_ms(20);
+        uint8_t data[5];
 
         atomic_block
         {
@@ -15,7 +15,12 @@ public:
         explicit Dht22(Gpio::Pin data_pin);
         void init();
 
-        /* Read the sensor. Returns true if received valid data. */
+        /* Write START, call read() start_time later */
+        static constexpr double start_time = 20;        /* ms */
+        void start();
+        void cancel();                                  /* Release the line without reading */
+
+        /* Read the sensor after start(). Returns true if received valid data. */
         bool read();
 
         /* Temperature in °C/10 */
@@ -0,0 +1,65 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "eeprom.hpp"
+#include "shared.hpp"
+
+static_assert(Eeprom::size == E2END + 1, "");
+
+struct Byte {
+        uint16_t addr;
+        uint8_t data;
+};
+
+/* Shared variables (changed in interrupts) */
+static Queue<Byte, Eeprom::queue_size> s_queue;
+
+static uint8_t read_byte(uint16_t addr)
+{
+        EEAR = addr;
+        EECR |= 1<<EERE;
+        return EEDR;
+}
+
+/* Program the next byte, disable itself when the queue is empty */
+ISR(EE_READY_vect)
+{
+        Byte b;
+
+        while (s_queue.pop(b)) {
+                if (read_byte(b.addr) == b.data)
+                        continue;
+                EEDR = b.data;
+                EECR |= 1<<EEMPE;       /* Erase and write, 3.4 ms */
+                EECR |= 1<<EEPE;
+                return;
+        }
+        EECR &= ~(1<<EERIE);
+}
+
+void Eeprom::read(uint16_t addr, void *dst, uint8_t len)
+{
+        while (busy())
+                memory_barrier();
+
+        auto d = static_cast<uint8_t *>(dst);
+        while (len--)
+                *d++ = read_byte(addr++);
+}
+
+bool Eeprom::write(uint16_t addr, const void *src, uint8_t len)
+{
+        if (s_queue.size() + len > queue_size)
+                return false;
+
+        auto s = static_cast<const uint8_t *>(src);
+        while (len--)
+                s_queue.push(Byte {addr++, *s++});
+
+        EECR |= 1<<EERIE;
+        return true;
+}
+
+bool Eeprom::busy()
+{
+        return !s_queue.empty() || (EECR & (1<<EEPE | 1<<EERIE));
+}
@@ -0,0 +1,28 @@
+/*
+ * EEPROM with background writes
+ *
+ * write() queues the bytes and returns at once. The EEPROM ready interrupt
+ * programs them one by one (3.4 ms each), skipping the bytes which are
+ * already there, so rewriting the same data costs no endurance.
+ */
+
+#ifndef EEPROM_HPP_
+#define EEPROM_HPP_
+
+#include <stdint.h>
+
+namespace Eeprom
+{
+        constexpr uint16_t size = 1024;
+        constexpr uint8_t queue_size = 32;      /* Bytes */
+
+        /* Read at once (waits for the queued writes) */
+        void read(uint16_t addr, void *dst, uint8_t len);
+
+        /* Queue a write. Returns false, if there is no room for all the bytes. */
+        bool write(uint16_t addr, const void *src, uint8_t len);
+
+        bool busy();
+}
+
+#endif
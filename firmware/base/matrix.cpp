@@ -3,55 +3,25 @@
 #include "matrix.hpp"
 #include "font5x8.hpp"  /* Auto-generated */
 
-Matrix::Matrix(Max7221 &m): max_chain(m), cur_x(0)
+void MatrixBase::clear()
 {
-        clear();
-}
-
-void Matrix::clear()
-{
-        for (uint8_t i = 0; i < 24; i++)
+        for (uint8_t i = 0; i < width; i++)
                 buffer[i] = 0;
 }
 
-void Matrix::init()
-{
-        max_all(Max7221::REG_DISPLAY_TEST | 0);
-        max_all(Max7221::REG_SCAN_LIMIT | 7);
-        max_all(Max7221::REG_DECODE_MODE | 0);
-        max_all(Max7221::REG_SHUTDOWN | 1);
-}
-
-void Matrix::max_all(uint16_t data)
+void MatrixBase::draw_point(uint8_t x, uint8_t y, bool val)
 {
-        uint16_t d[] = {data, data, data};
-        max_chain.write(d, 3);
-}
-
-void Matrix::set_brightness(uint8_t br)
-{
-        max_all(Max7221::REG_INTENSITY | (br & 15));
-}
-
-void Matrix::sync()
-{
-        for (uint8_t col = 1; col <= 8; col++) {
-                uint16_t d[] = {
-                        concat16(col, buffer[col+15]),
-                        concat16(col, buffer[col+7]),
-                        concat16(col, buffer[col-1])
-                };
-                max_chain.write(d, 3);
-        }
+        if (x < width && y < 8)
+                set_bits(buffer[x], 1<<y, val);
 }
 
-void Matrix::draw_point(uint8_t x, uint8_t y, bool val)
+void MatrixBase::invert(uint8_t x0, uint8_t x1)
 {
-        if (x < 24 && y < 8)
-                set_bits(buffer[x], 1<<y, val);
+        for (uint8_t x = x0; x < x1 && x < width; x++)
+                buffer[x] = ~buffer[x];
 }
 
-void Matrix::putc(char c)
+void MatrixBase::putc(char c)
 {
         uint8_t d = c;
 
@@ -62,7 +32,7 @@ void Matrix::putc(char c)
                 return;
         }
 
-        if (cur_x > 18)
+        if (cur_x + 5 > width)
                 return;
 
         uint8_t *p = &buffer[cur_x];
@@ -70,6 +40,8 @@ void Matrix::putc(char c)
         for (uint8_t i = 0; i < 5; i++)
                 *p++ = pgm_read_byte(q++);
 
-        *p = 0;
+        /* The spacer column, if the glyph is not at the right edge */
+        if (cur_x + 5 < width)
+                *p = 0;
         cur_x += 6;
 }
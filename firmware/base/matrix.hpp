@@ -1,18 +1,38 @@
-/* 24x8 LED matrix display */
+/*
+ * LED matrix display: a chain of 8x8 panels on daisy-chained MAX7221
+ *
+ * MatrixBase draws to the buffer, the Matrix template syncs it to the chain,
+ * a Canvas is an off-screen buffer. The buffer is a byte per column, left to
+ * right, with a bit per row. The first panel of the chain (next to the MCU)
+ * is the leftmost one.
+ */
 
 #ifndef MATRIX_HPP_
 #define MATRIX_HPP_
 
 #include <stdint.h>
+#include "common.hpp"
 #include "max7221.hpp"
 #include "print.hpp"
+#include "profile.hpp"
 
-class Matrix: public Print {
+/* How a panel is mounted: digit d and segment bit b of its MAX7221 are */
+enum class Orientation: uint8_t {
+        normal,                 /* Column d, row b */
+        mirrored,               /* Column 7-d, row b */
+        flipped,                /* Column d, row 7-b */
+        rotated_180,            /* Column 7-d, row 7-b */
+        rotated_90,             /* Row d, column 7-b */
+        rotated_270,            /* Row 7-d, column b */
+};
+
+class MatrixBase: public Print {
 private:
-        Max7221 &max_chain;             /* 3 daisy-chained MAX7221 */
-        uint8_t buffer[24];             /* Display's buffer (byte per column) */
+        uint8_t *const buffer;          /* Display's buffer (byte per column) */
+        const uint8_t width;
         uint8_t cur_x;                  /* Current x position for putc */
-        void max_all(uint16_t data);    /* Write the same word to all MAX chips */
+protected:
+        MatrixBase(uint8_t *b, uint8_t w): buffer(b), width(w), cur_x(0) {}
 public:
         /* Special characters for putc */
         enum {
@@ -20,20 +40,123 @@ public:
                 special_down_arrow      = 2,
                 special_min             = 3,
                 special_max             = 4,
+                special_sunny           = 5,
+                special_fair            = 6,
+                special_cloudy          = 7,
+                special_rain            = 8,
+                special_storm           = 9,
         };
 
-        explicit Matrix(Max7221 &max_chain);
-        void init();
-        void set_brightness(uint8_t br);    /* 0..15 */
-        void sync();
-
-        /* 
+        /*
          * The following methods works only in the buffer.
          * Call sync() to apply changes.
          */
         void clear();
         void draw_point(uint8_t x, uint8_t y, bool val = 1);
+        void invert(uint8_t x0, uint8_t x1);    /* Columns x0..x1-1 */
         void putc(char c) override;
+
+        /* The buffer, for copying between displays and canvases */
+        uint8_t *data() { return buffer; }
+        const uint8_t *data() const { return buffer; }
+};
+
+template<uint8_t Width>
+class Canvas: public MatrixBase {
+public:
+        static constexpr uint8_t width = Width;
+private:
+        uint8_t columns[width];
+public:
+        Canvas(): MatrixBase(columns, width) { clear(); }
+};
+
+template<uint8_t Panels, Orientation O = Orientation::normal>
+class Matrix: public MatrixBase {
+public:
+        static constexpr uint8_t width = Panels * 8;
+private:
+        static_assert(Panels >= 1 && Panels <= 31, "");
+
+        Max7221 &max_chain;             /* Panels daisy-chained MAX7221 */
+        uint8_t columns[width];
+        void max_all(uint16_t data);    /* Write the same word to all MAX chips */
+        static uint8_t segments(const uint8_t *panel, uint8_t digit);
+public:
+        explicit Matrix(Max7221 &m): MatrixBase(columns, width), max_chain(m) { clear(); }
+        void init();
+        void set_brightness(uint8_t br);    /* 0..15 */
+        void sync();
 };
 
+template<uint8_t Panels, Orientation O>
+void Matrix<Panels, O>::init()
+{
+        max_all(Max7221::REG_DISPLAY_TEST | 0);
+        max_all(Max7221::REG_SCAN_LIMIT | 7);
+        max_all(Max7221::REG_DECODE_MODE | 0);
+        max_all(Max7221::REG_SHUTDOWN | 1);
+}
+
+template<uint8_t Panels, Orientation O>
+void Matrix<Panels, O>::max_all(uint16_t data)
+{
+        uint16_t d[Panels];
+        for (uint8_t i = 0; i < Panels; i++)
+                d[i] = data;
+        max_chain.write(d, Panels);
+}
+
+template<uint8_t Panels, Orientation O>
+void Matrix<Panels, O>::set_brightness(uint8_t br)
+{
+        max_all(Max7221::REG_INTENSITY | (br & 15));
+}
+
+/* Row y of a panel, bit b is column b */
+static inline uint8_t panel_row(const uint8_t *panel, uint8_t y)
+{
+        const uint8_t mask = 1<<y;
+        uint8_t r = 0;
+        for (uint8_t x = 8; x-- != 0; )
+                r = r<<1 | ((panel[x] & mask) != 0);
+        return r;
+}
+
+/* Segments of a digit, the orientation is resolved at compile time */
+template<uint8_t Panels, Orientation O>
+inline uint8_t Matrix<Panels, O>::segments(const uint8_t *panel, uint8_t digit)
+{
+        switch (O) {
+        case Orientation::normal:
+                return panel[digit];
+        case Orientation::mirrored:
+                return panel[7 - digit];
+        case Orientation::flipped:
+                return reverse_bits(panel[digit]);
+        case Orientation::rotated_180:
+                return reverse_bits(panel[7 - digit]);
+        case Orientation::rotated_90:
+                return reverse_bits(panel_row(panel, digit));
+        case Orientation::rotated_270:
+                return panel_row(panel, 7 - digit);
+        }
+        return 0;
+}
+
+template<uint8_t Panels, Orientation O>
+void Matrix<Panels, O>::sync()
+{
+        PROFILE_SCOPE(matrix_sync);
+
+        /* A word per panel for each digit, the first one goes to the last panel */
+        for (uint8_t digit = 0; digit < 8; digit++) {
+                uint16_t d[Panels];
+                const uint8_t *p = &columns[width - 8];
+                for (uint8_t i = 0; i < Panels; i++, p -= 8)
+                        d[i] = concat16(digit + 1, segments(p, digit));
+                max_chain.write(d, Panels);
+        }
+}
+
 #endif
@@ -1,12 +1,13 @@
 #include "max7221.hpp"
 
-constexpr Spi::Mode spi_mode = {
+constexpr SpiMode spi_mode = {
         .cpol = 0,
         .cpha = 0,
         .msb_first = 1,
+        .clock = SpiMode::clock_for(10000000),
 };
 
-Max7221::Max7221(Spi &spi_, Gpio::Pin cs_):
+Max7221::Max7221(SpiBus &spi_, Gpio::Pin cs_):
         spi(spi_), cs(cs_) {}
 
 void Max7221::init()
@@ -23,9 +24,6 @@ void Max7221::write(const uint16_t *data, size_t len)
 {
         spi.set_mode(spi_mode);
         Gpio::write(cs, 0);
-        for (; len-- != 0; data++) {
-                spi.write(*data >> 8);
-                spi.write(*data & 0xff);
-        }
+        spi.write(data, len);
         Gpio::write(cs, 1);
 }
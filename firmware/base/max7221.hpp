@@ -6,11 +6,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "gpio.hpp"
-#include "spi.hpp"
+#include "spi-bus.hpp"
 
 class Max7221 {
 private:
-        Spi &spi;
+        SpiBus &spi;
         const Gpio::Pin cs;
 public:
         enum {
@@ -30,7 +30,7 @@ public:
                 REG_DISPLAY_TEST        = 0x0f00,
         };
 
-        Max7221(Spi &spi, Gpio::Pin cs);
+        Max7221(SpiBus &spi, Gpio::Pin cs);
         void init();
 
         /* 16-bit write */
@@ -1,13 +1,14 @@
 #include "nrf24.hpp"
 #include "delay.hpp"
 
-constexpr Spi::Mode spi_mode = {
+constexpr SpiMode spi_mode = {
         .cpol = 0,
         .cpha = 0,
         .msb_first = 1,
+        .clock = SpiMode::clock_for(8000000),
 };
 
-Nrf24::Nrf24(Spi &spi_, Gpio::Pin csn_, Gpio::Pin ce_):
+Nrf24::Nrf24(SpiBus &spi_, Gpio::Pin csn_, Gpio::Pin ce_):
         spi(spi_), csn(csn_), ce(ce_) {}
 
 void Nrf24::init()
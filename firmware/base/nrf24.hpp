@@ -5,12 +5,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
-#include "spi.hpp"
+#include "spi-bus.hpp"
 #include "gpio.hpp"
 
 class Nrf24 {
 private:
-        Spi &spi;
+        SpiBus &spi;
         const Gpio::Pin csn, ce;
 public:
         /* Commands */
@@ -162,6 +162,12 @@ public:
                 TX_FIFO_FULL      = 0x01,
         };
 
+        /* REG_OBSERVE_TX */
+        enum {
+                PLOS_CNT          = 0xf0,
+                ARC_CNT           = 0x0f,
+        };
+
         /* REG_RPD */
         enum {
                 RPD               = 0x01,
@@ -196,7 +202,7 @@ public:
         /* Power Down -> Standby delay (ms) */
         static constexpr double tpd2stby = 5;
 
-        Nrf24(Spi &spi, Gpio::Pin csn, Gpio::Pin ce);
+        Nrf24(SpiBus &spi, Gpio::Pin csn, Gpio::Pin ce);
         void init();
 
         /* Set CE pin low (0) or high (1) */
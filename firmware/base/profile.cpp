@@ -0,0 +1,105 @@
+#ifdef PROFILE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "profile.hpp"
+#include "matrix.hpp"
+#include "common.hpp"
+#include "shared.hpp"
+
+/* Shared variables (changed in interrupts) */
+static uint16_t s_high;                         /* Timer1 overflows */
+static Profile::Counter s_counters[Profile::nr_slots];
+static uint32_t s_isr_cycles;                   /* In ISRs since the last second */
+static uint32_t s_second_start;
+static uint16_t s_isr_load;                     /* ISR load for the last second (0.1 %) */
+
+ISR(TIMER1_OVF_vect)
+{
+        s_high++;
+}
+
+void Profile::init()
+{
+        PRR &= ~(1<<PRTIM1);
+        TCCR1A = 0;
+        TCCR1B = 1<<CS10;       /* clk/1 */
+        TIMSK1 = 1<<TOIE1;
+
+        for (auto &c : s_counters)
+                c = Counter {UINT32_MAX, 0, 0, 0};
+}
+
+uint32_t Profile::now()
+{
+        uint32_t t;
+
+        atomic_block {
+                const uint16_t low = TCNT1;
+                uint16_t high = s_high;
+
+                /* Overflow is pending, and the low part is after it */
+                if ((TIFR1 & 1<<TOV1) && low < 0x8000)
+                        high++;
+                t = concat32(high, low);
+        }
+        return t;
+}
+
+void Profile::add(Slot s, uint32_t cycles)
+{
+        atomic_block {
+                Counter &c = s_counters[s];
+                c.min = min(c.min, cycles);
+                c.max = max(c.max, cycles);
+                c.total += cycles;
+                c.count++;
+                if (s < nr_isr_slots)
+                        s_isr_cycles += cycles;
+        }
+}
+
+void Profile::second()
+{
+        const uint32_t t = now();
+        const uint32_t elapsed = (t - s_second_start)/1000;
+
+        if (elapsed != 0)
+                s_isr_load = min<uint32_t>(s_isr_cycles/elapsed, 999);
+        s_isr_cycles = 0;
+        s_second_start = t;
+}
+
+/* 3 digits: us, or ms with a decimal point */
+static void show_cycles(MatrixBase &m, uint32_t cycles)
+{
+        const uint32_t us = cycles/(F_CPU/1000000);
+
+        if (us < 1000)
+                m.printf(PSTR("%3u"), static_cast<uint16_t>(us));
+        else {
+                m.printf(PSTR("%3u"), static_cast<uint16_t>(min<uint32_t>(us/100, 999)));
+                m.draw_point(17, 0);
+        }
+}
+
+void Profile::show(MatrixBase &m, uint8_t page)
+{
+        m.printf(PSTR("\r%u"), page);
+        m.invert(0, 5);
+
+        if (page == 0) {
+                m.printf(PSTR("%3u"), atomic_read(s_isr_load));
+                m.draw_point(17, 0);
+        } else if (page <= nr_slots) {
+                uint32_t cycles;
+                atomic_block {
+                        const Counter &c = s_counters[page - 1];
+                        cycles = c.max;
+                }
+                show_cycles(m, cycles);
+        }
+}
+
+#endif
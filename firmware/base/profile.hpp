@@ -0,0 +1,77 @@
+/*
+ * Cycle profiler (build with 'make PROFILE=1')
+ *
+ * Timer1 runs from the system clock as a free-running counter, extended to 32
+ * bits by its overflow interrupt. PROFILE_SCOPE(slot) counts the cycles until
+ * the end of the enclosing block. Without PROFILE it expands to nothing, and
+ * Timer1 stays powered down.
+ *
+ * The counters are shown on the hidden diagnostics pages: rotate the encoder
+ * with the button pushed on the clock screen. A page is its inverted number
+ * and the maximal time in us, or in ms with a decimal point. Page 0 is the
+ * ISR load for the last second in % with a decimal point. The pages after the
+ * counters are the radio link statistics of nodes and the dropped frames (see
+ * base.cpp).
+ */
+
+#ifndef PROFILE_HPP_
+#define PROFILE_HPP_
+
+#ifdef PROFILE
+
+#include <stdint.h>
+
+class MatrixBase;
+
+namespace Profile
+{
+        enum Slot: uint8_t {
+                /* Interrupts */
+                timer0,
+                timer2,
+                adc,
+                nr_isr_slots,
+
+                /* Main loop */
+                dht22_read = nr_isr_slots,
+                bmp085_read,
+                nrf24_receive,
+                refresh,
+                matrix_sync,
+                loop,
+                nr_slots
+        };
+
+        constexpr uint8_t nr_pages = nr_slots + 1;
+
+        struct Counter {
+                uint32_t min, max;
+                uint64_t total;
+                uint16_t count;
+        };
+
+        void init();
+        uint32_t now();
+        void add(Slot s, uint32_t cycles);
+        void second();                  /* Call every second from an ISR */
+        void show(MatrixBase &m, uint8_t page);
+
+        class Scope {
+        private:
+                const Slot slot;
+                const uint32_t start;
+        public:
+                explicit Scope(Slot s): slot(s), start(now()) {}
+                ~Scope() { add(slot, now() - start); }
+        };
+}
+
+#define PROFILE_SCOPE(slot) Profile::Scope profile_##slot##_ {Profile::slot}
+
+#else
+
+#define PROFILE_SCOPE(slot) do {} while (0)
+
+#endif
+
+#endif
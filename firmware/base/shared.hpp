@@ -17,6 +17,8 @@
 #ifndef SHARED_HPP_
 #define SHARED_HPP_
 
+#include <stdint.h>
+
 #ifdef __AVR_ARCH__
 #  include <util/atomic.h>
 #  define atomic_block ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
@@ -24,8 +26,16 @@
 #  error "Only AVR is supported"
 #endif
 
+/* The host tests preempt at every barrier (see sim/tests/shared.cpp) */
+#ifdef SHARED_PREEMPT
+void SHARED_PREEMPT();
+#endif
+
 inline void memory_barrier() {
         asm volatile ("" ::: "memory");
+#ifdef SHARED_PREEMPT
+        SHARED_PREEMPT();
+#endif
 }
 
 template<typename T>
@@ -47,4 +57,95 @@ inline void atomic_write(T &x, decltype(T{}) val) {
                 atomic_block { x = val; }
 }
 
+/*
+ * Single-producer single-consumer ring buffer, for example, events from an
+ * ISR to the main loop. Neither side disables interrupts: the producer only
+ * writes the head, the consumer only writes the tail, both are single bytes.
+ * The indexes run freely, so all N elements are usable.
+ */
+template<typename T, uint8_t N>
+class Queue {
+        static_assert(N >= 2 && N <= 128 && (N & (N - 1)) == 0, "N should be a power of 2");
+public:
+        bool push(const T &x) {
+                memory_barrier();
+                const uint8_t h = head;
+                if (static_cast<uint8_t>(h - tail) == N) {
+                        overflows++;
+                        return false;
+                }
+                buf[h % N] = x;
+                memory_barrier();       /* Data before the index */
+                head = h + 1;
+                return true;
+        }
+
+        bool pop(T &x) {
+                memory_barrier();
+                const uint8_t t = tail;
+                if (head == t)
+                        return false;
+                x = buf[t % N];
+                memory_barrier();       /* Data before the index */
+                tail = t + 1;
+                return true;
+        }
+
+        bool empty() const {
+                memory_barrier();
+                return head == tail;
+        }
+
+        uint8_t size() const {
+                memory_barrier();
+                return head - tail;
+        }
+
+        uint8_t overflows = 0;          /* Pushes to the full queue (written by the producer) */
+private:
+        T buf[N];
+        uint8_t head = 0, tail = 0;
+};
+
+/*
+ * Sequence counter for a multi-byte shared object. The writer makes the
+ * counter odd for the time of the update, a reader retries until it sees the
+ * same even counter before and after the copy. Readers never disable
+ * interrupts, which suits an object updated in an ISR and read in the main
+ * loop. Writes should not interrupt each other: write from the ISR, or from
+ * the main loop in atomic_block.
+ */
+template<typename T>
+class Seqlock {
+public:
+        Seqlock() = default;
+        explicit Seqlock(const T &x): value(x) {}
+
+        T read() const {
+                T x;
+                uint8_t s;
+                do {
+                        s = seq;
+                        memory_barrier();
+                        x = value;
+                        memory_barrier();
+                } while ((s & 1) || s != seq);
+                return x;
+        }
+
+        void write(const T &x) {
+                seq++;
+                memory_barrier();
+                value = x;
+                memory_barrier();
+                seq++;
+        }
+
+        /* The current value for the writer */
+        const T &get() const { return value; }
+private:
+        T value {};
+        uint8_t seq = 0;
+};
+
 #endif
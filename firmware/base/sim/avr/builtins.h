@@ -0,0 +1,9 @@
+/* Simulated delay builtin: advances the virtual time */
+
+#ifndef SIM_AVR_BUILTINS_H_
+#define SIM_AVR_BUILTINS_H_
+
+void sim_delay_cycles(unsigned long cycles);
+#define __builtin_avr_delay_cycles(cycles) sim_delay_cycles(cycles)
+
+#endif
@@ -0,0 +1,12 @@
+/* Simulated interrupts: vectors are plain functions called by the simulator */
+
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+#define ISR(vector, ...) extern "C" void vector(void); extern "C" void vector(void)
+#define EMPTY_INTERRUPT(vector) ISR(vector) {}
+
+void sei();
+void cli();
+
+#endif
@@ -0,0 +1,127 @@
+/* Simulated ATmega328P I/O registers: plain memory, see io.cpp */
+
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define SIM_REG8(name) extern uint8_t name;
+#define SIM_REG16(name) extern uint16_t name;
+#include "registers.def"
+#undef SIM_REG8
+#undef SIM_REG16
+
+/* PRR */
+#define PRADC           0
+#define PRUSART0        1
+#define PRSPI           2
+#define PRTIM1          3
+#define PRTIM0          5
+#define PRTIM2          6
+#define PRTWI           7
+
+/* PCICR */
+#define PCIE0           0
+#define PCIE1           1
+#define PCIE2           2
+
+/* PCMSK2 */
+#define PCINT16         0
+#define PCINT17         1
+#define PCINT18         2
+#define PCINT19         3
+#define PCINT20         4
+#define PCINT21         5
+#define PCINT22         6
+#define PCINT23         7
+
+/* MCUSR */
+#define PORF            0
+#define EXTRF           1
+#define BORF            2
+#define WDRF            3
+
+/* ACSR */
+#define ACD             7
+
+/* TCCR0B, TCCR1B, TCCR2B */
+#define CS00            0
+#define CS01            1
+#define CS02            2
+#define CS10            0
+#define CS11            1
+#define CS12            2
+#define CS20            0
+#define CS21            1
+#define CS22            2
+
+/* TIMSKn, TIFRn */
+#define TOIE0           0
+#define TOIE1           0
+#define TOIE2           0
+#define TOV0            0
+#define TOV1            0
+#define TOV2            0
+
+/* ASSR */
+#define TCR2BUB         0
+#define TCR2AUB         1
+#define OCR2BUB         2
+#define OCR2AUB         3
+#define TCN2UB          4
+#define AS2             5
+
+/* WDTCSR */
+#define WDP0            0
+#define WDP1            1
+#define WDP2            2
+#define WDE             3
+#define WDCE            4
+#define WDP3            5
+#define WDIE            6
+#define WDIF            7
+
+/* ADMUX */
+#define MUX0            0
+#define ADLAR           5
+#define REFS0           6
+#define REFS1           7
+
+/* ADCSRA */
+#define ADPS0           0
+#define ADPS1           1
+#define ADPS2           2
+#define ADIE            3
+#define ADIF            4
+#define ADATE           5
+#define ADSC            6
+#define ADEN            7
+
+/* ADCSRB */
+#define ADTS0           0
+#define ADTS1           1
+#define ADTS2           2
+
+/* SPCR, SPSR */
+#define SPR0            0
+#define SPR1            1
+#define CPHA            2
+#define CPOL            3
+#define MSTR            4
+#define DORD            5
+#define SPE             6
+#define SPIE            7
+#define SPI2X           0
+#define WCOL            6
+#define SPIF            7
+
+/* TWCR */
+#define TWIE            0
+#define TWEN            2
+#define TWWC            3
+#define TWSTO           4
+#define TWSTA           5
+#define TWEA            6
+#define TWINT           7
+
+#endif
@@ -0,0 +1,8 @@
+/* Simulated watchdog: wdt_reset() is where the simulator takes control */
+
+#ifndef SIM_AVR_WDT_H_
+#define SIM_AVR_WDT_H_
+
+void wdt_reset();
+
+#endif
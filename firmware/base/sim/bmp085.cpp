@@ -0,0 +1,44 @@
+/* Simulated BMP085 sensor: ut and up hold the compensated values */
+
+#include <math.h>
+#include "bmp085.hpp"
+#include "sim.hpp"
+
+Bmp085::Bmp085(I2c &bus): i2c(bus) {}
+
+bool Bmp085::init()
+{
+        Sim::spend(Sim::seconds(11*100e-6));    /* Calibration readout */
+        return true;
+}
+
+bool Bmp085::start(Conversion)
+{
+        Sim::spend(Sim::seconds(100e-6));       /* The command */
+        return true;
+}
+
+bool Bmp085::read(Conversion c)
+{
+        Sim::spend(Sim::seconds(c == pressure ? 150e-6 : 100e-6));
+
+        const Sim::Environment env = Sim::environment();
+        if (c == temperature) {
+                ut = lround(env.temperature_indoor*10);
+                return true;
+        }
+        if (Sim::sensor_fault())
+                return false;
+        up = lround(env.pressure);
+        return true;
+}
+
+uint32_t Bmp085::get_pressure()
+{
+        return up;
+}
+
+int16_t Bmp085::get_temperature()
+{
+        return ut;
+}
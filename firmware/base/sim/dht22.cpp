@@ -0,0 +1,44 @@
+/* Simulated DHT22 sensor */
+
+#include <math.h>
+#include "dht22.hpp"
+#include "sim.hpp"
+
+Dht22::Dht22(Gpio::Pin p): data_pin(p) {}
+
+void Dht22::init()
+{
+        Gpio::set(data_pin, Gpio::tri);
+}
+
+void Dht22::start()
+{
+}
+
+void Dht22::cancel()
+{
+}
+
+bool Dht22::read()
+{
+        /* RESPONSE, and 40 bits of ~100 μs */
+        Sim::spend(Sim::seconds(160e-6 + 40*100e-6));
+
+        if (Sim::sensor_fault())
+                return false;
+
+        const Sim::Environment env = Sim::environment();
+        temperature = lround(env.temperature_indoor*10);
+        humidity = lround(env.humidity*10);
+        return true;
+}
+
+int16_t Dht22::get_temperature()
+{
+        return temperature;
+}
+
+uint16_t Dht22::get_humidity()
+{
+        return humidity;
+}
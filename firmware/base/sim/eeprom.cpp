@@ -0,0 +1,94 @@
+/* Simulated EEPROM: background writes take 3.4 ms per changed byte */
+
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include "eeprom.hpp"
+#include "sim.hpp"
+
+constexpr uint64_t write_cycles = 3.4e-3*Sim::f_cpu;
+constexpr uint64_t read_cycles = 4;
+
+struct Byte {
+        uint16_t addr;
+        uint8_t data;
+};
+
+static uint8_t memory[Eeprom::size];
+static std::deque<Byte> queue;
+static bool writing;
+static const char *image;
+static unsigned long written;
+
+/* Program the queued bytes one by one, like the EEPROM ready interrupt */
+static void program_next()
+{
+        while (!queue.empty()) {
+                const Byte b = queue.front();
+                queue.pop_front();
+                if (memory[b.addr] == b.data)
+                        continue;
+                memory[b.addr] = b.data;
+                written++;
+                Sim::at(Sim::now() + write_cycles, program_next);
+                return;
+        }
+        writing = false;
+}
+
+void Eeprom::read(uint16_t addr, void *dst, uint8_t len)
+{
+        while (busy())
+                Sim::spend(write_cycles);
+        memcpy(dst, memory + addr, len);
+        Sim::spend(read_cycles*len);
+}
+
+bool Eeprom::write(uint16_t addr, const void *src, uint8_t len)
+{
+        if (queue.size() + len > queue_size)
+                return false;
+
+        auto s = static_cast<const uint8_t *>(src);
+        for (uint8_t i = 0; i < len; i++)
+                queue.push_back(Byte {static_cast<uint16_t>(addr + i), s[i]});
+        Sim::spend(20*len);
+
+        if (!writing) {
+                writing = true;
+                Sim::at(Sim::now(), program_next);
+        }
+        return true;
+}
+
+bool Eeprom::busy()
+{
+        return writing;
+}
+
+void Sim::eeprom_load(const char *path)
+{
+        memset(memory, 0xff, sizeof(memory));
+        image = path;
+        if (!image)
+                return;
+
+        FILE *f = fopen(image, "rb");
+        if (f) {
+                if (fread(memory, 1, sizeof(memory), f) != sizeof(memory))
+                        fprintf(stderr, "%s: short EEPROM image\n", image);
+                fclose(f);
+        }
+}
+
+unsigned long Sim::eeprom_save()
+{
+        if (image) {
+                FILE *f = fopen(image, "wb");
+                if (!f || fwrite(memory, 1, sizeof(memory), f) != sizeof(memory))
+                        perror(image);
+                if (f)
+                        fclose(f);
+        }
+        return written;
+}
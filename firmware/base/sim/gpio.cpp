@@ -0,0 +1,65 @@
+/* Simulated GPIO: outputs are reported to the simulator, inputs are driven by it */
+
+#include "gpio.hpp"
+#include "sim.hpp"
+
+using namespace Gpio;
+
+constexpr uint8_t nr_ports = 7;
+
+static uint8_t ddr[nr_ports], port[nr_ports];
+
+static bool output_level(Pin pin)
+{
+        const uint8_t mask = 1 << (pin % 8);
+        return (ddr[pin/8] & mask) && (port[pin/8] & mask);
+}
+
+static bool is_output(Pin pin)
+{
+        return ddr[pin/8] & 1 << (pin % 8);
+}
+
+void Gpio::set(Pin pin, State state)
+{
+        if (pin/8 >= nr_ports)
+                return;
+
+        const bool was_output = is_output(pin);
+        const bool was_level = output_level(pin);
+        const uint8_t mask = 1 << (pin % 8);
+
+        state & 0b10 ? (ddr[pin/8] |= mask) : (ddr[pin/8] &= ~mask);
+        state & 0b01 ? (port[pin/8] |= mask) : (port[pin/8] &= ~mask);
+
+        if (is_output(pin) && (!was_output || output_level(pin) != was_level))
+                Sim::output_changed(pin, output_level(pin));
+}
+
+void Gpio::write(Pin pin, bool val)
+{
+        set(pin, val ? high : low);
+}
+
+void Gpio::toggle(Pin pin)
+{
+        if (pin/8 >= nr_ports)
+                return;
+
+        port[pin/8] ^= 1 << (pin % 8);
+        if (is_output(pin))
+                Sim::output_changed(pin, output_level(pin));
+}
+
+bool Gpio::read(Pin pin)
+{
+        if (pin/8 >= nr_ports)
+                return 0;
+        if (is_output(pin))
+                return output_level(pin);
+
+        bool level;
+        if (Sim::driven(pin, level))
+                return level;
+        return port[pin/8] & 1 << (pin % 8);   /* Pull-up or nothing */
+}
@@ -0,0 +1,5 @@
+#include <avr/io.h>
+
+#define SIM_REG8(name) uint8_t name;
+#define SIM_REG16(name) uint16_t name;
+#include "registers.def"
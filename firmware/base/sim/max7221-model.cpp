@@ -0,0 +1,74 @@
+#include "max7221-model.hpp"
+
+Max7221Model::Max7221Model(size_t nr_chips):
+        chips(nr_chips, Chip {{}, 0, 0, true, false}), changed(false) {}
+
+void Max7221Model::select()
+{
+        shift.clear();
+}
+
+void Max7221Model::transfer(uint8_t in)
+{
+        shift.push_back(in);
+}
+
+void Max7221Model::latch()
+{
+        /* The last 16 bits clocked in stay in the nearest chip */
+        const size_t n = shift.size()/2;
+        for (size_t k = 0; k < chips.size() && k < n; k++) {
+                const uint8_t *w = &shift[(n - 1 - k)*2];
+                Chip &c = chips[k];
+                const Chip old = c;
+
+                switch (w[0] & 0x0f) {
+                case 0x1: case 0x2: case 0x3: case 0x4:
+                case 0x5: case 0x6: case 0x7: case 0x8:
+                        c.digit[(w[0] & 0x0f) - 1] = w[1];
+                        break;
+                case 0xa:
+                        c.intensity = w[1] & 0x0f;
+                        break;
+                case 0xb:
+                        c.scan_limit = w[1] & 0x07;
+                        break;
+                case 0xc:
+                        c.shutdown = !(w[1] & 1);
+                        break;
+                case 0xf:
+                        c.test = w[1] & 1;
+                        break;
+                default:        /* No-op, decode mode */
+                        break;
+                }
+
+                for (uint8_t i = 0; i < 8; i++)
+                        changed |= c.digit[i] != old.digit[i];
+                changed |= c.intensity != old.intensity || c.shutdown != old.shutdown ||
+                        c.test != old.test || c.scan_limit != old.scan_limit;
+        }
+        shift.clear();
+}
+
+uint8_t Max7221Model::column(size_t x) const
+{
+        const Chip &c = chips[x/8];
+        if (c.test)
+                return 0xff;
+        if (c.shutdown || x%8 > c.scan_limit)
+                return 0;
+        return c.digit[x%8];
+}
+
+uint8_t Max7221Model::intensity() const
+{
+        return chips.empty() ? 0 : chips[0].intensity;
+}
+
+bool Max7221Model::take_changed()
+{
+        bool c = changed;
+        changed = false;
+        return c;
+}
@@ -0,0 +1,40 @@
+/* Model of daisy-chained MAX7221 chips driving 8x8 LED matrices */
+
+#ifndef MAX7221_MODEL_HPP_
+#define MAX7221_MODEL_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class Max7221Model {
+private:
+        struct Chip {
+                uint8_t digit[8];
+                uint8_t intensity;
+                uint8_t scan_limit;
+                bool shutdown;
+                bool test;
+        };
+
+        std::vector<Chip> chips;
+        std::vector<uint8_t> shift;     /* Bytes clocked in since LOAD went low */
+        bool changed;
+public:
+        explicit Max7221Model(size_t nr_chips);
+
+        void select();                  /* LOAD low */
+        void transfer(uint8_t in);
+        void latch();                   /* LOAD high */
+
+        size_t width() const { return chips.size()*8; }
+
+        /* Displayed column, bit 0 is the bottom row (blank when shut down) */
+        uint8_t column(size_t x) const;
+        uint8_t intensity() const;
+
+        /* True once after every visible change */
+        bool take_changed();
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include <string.h>
+#include "nrf24-model.hpp"
+#include "nrf24.hpp"
+
+Nrf24Model::Nrf24Model(): cmd(Nrf24::CMD_NOP), pos(0), ce(false)
+{
+        memset(regs, 0, sizeof(regs));
+
+        /* Reset values */
+        regs[Nrf24::REG_CONFIG][0] = Nrf24::EN_CRC;
+        regs[Nrf24::REG_EN_AA][0] = 0x3f;
+        regs[Nrf24::REG_EN_RXADDR][0] = Nrf24::ERX_P0 | Nrf24::ERX_P1;
+        regs[Nrf24::REG_SETUP_AW][0] = Nrf24::AW_5_BYTES;
+        regs[Nrf24::REG_SETUP_RETR][0] = Nrf24::ARD_250us | Nrf24::ARC_3;
+        regs[Nrf24::REG_RF_CH][0] = 2;
+        regs[Nrf24::REG_RF_SETUP][0] = Nrf24::RF_DR_2Mbps | Nrf24::RF_PWR_0dBm;
+        memset(regs[Nrf24::REG_RX_ADDR_P0], 0xe7, 5);
+        memset(regs[Nrf24::REG_RX_ADDR_P1], 0xc2, 5);
+        regs[Nrf24::REG_RX_ADDR_P2][0] = 0xc3;
+        regs[Nrf24::REG_RX_ADDR_P3][0] = 0xc4;
+        regs[Nrf24::REG_RX_ADDR_P4][0] = 0xc5;
+        regs[Nrf24::REG_RX_ADDR_P5][0] = 0xc6;
+        memset(regs[Nrf24::REG_TX_ADDR], 0xe7, 5);
+}
+
+uint8_t Nrf24Model::status() const
+{
+        uint8_t s = regs[Nrf24::REG_STATUS][0] & (Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT);
+        s |= rx_fifo.empty() ? Nrf24::RX_P_FIFO_EMPTY : rx_fifo.front().pipe << 1;
+        if (tx_fifo.size() >= 3)
+                s |= Nrf24::TX_FIFO_FULL;
+        return s;
+}
+
+uint8_t Nrf24Model::fifo_status() const
+{
+        uint8_t s = 0;
+        if (rx_fifo.empty())
+                s |= Nrf24::RX_EMPTY;
+        if (rx_fifo.size() >= 3)
+                s |= Nrf24::RX_FULL;
+        if (tx_fifo.empty())
+                s |= Nrf24::TX_EMPTY;
+        if (tx_fifo.size() >= 3)
+                s |= Nrf24::TX_FULL;
+        return s;
+}
+
+bool Nrf24Model::listening() const
+{
+        const uint8_t c = regs[Nrf24::REG_CONFIG][0];
+        return ce && (c & Nrf24::PWR_UP) && (c & Nrf24::PRIM_RX);
+}
+
+bool Nrf24Model::irq_pin() const
+{
+        const uint8_t c = regs[Nrf24::REG_CONFIG][0];
+        const uint8_t s = regs[Nrf24::REG_STATUS][0];
+        const bool irq =
+                ((s & Nrf24::RX_DR) && !(c & Nrf24::MASK_RX_DR)) ||
+                ((s & Nrf24::TX_DS) && !(c & Nrf24::MASK_TX_DS)) ||
+                ((s & Nrf24::MAX_RT) && !(c & Nrf24::MASK_MAX_RT));
+        return !irq;
+}
+
+void Nrf24Model::select()
+{
+        pos = 0;
+        buf.clear();
+}
+
+uint8_t Nrf24Model::transfer(uint8_t in)
+{
+        if (pos++ == 0) {
+                cmd = in;
+                if (cmd == Nrf24::CMD_FLUSH_RX)
+                        rx_fifo.clear();
+                else if (cmd == Nrf24::CMD_FLUSH_TX)
+                        tx_fifo.clear();
+                return status();
+        }
+
+        const size_t i = pos - 2;
+        const uint8_t r = cmd & 0x1f;
+
+        if ((cmd & 0xe0) == Nrf24::CMD_R_REGISTER) {
+                if (r == Nrf24::REG_STATUS)
+                        return status();
+                if (r == Nrf24::REG_FIFO_STATUS)
+                        return fifo_status();
+                if (r == Nrf24::REG_RPD)
+                        return listening() && carrier && carrier(regs[Nrf24::REG_RF_CH][0]) ? Nrf24::RPD : 0;
+                return i < 5 ? regs[r][i] : 0;
+        }
+
+        if ((cmd & 0xe0) == Nrf24::CMD_W_REGISTER) {
+                if (r == Nrf24::REG_STATUS)
+                        regs[r][0] &= ~(in & (Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT));
+                else if (i < 5)
+                        regs[r][i] = in;
+                return 0;
+        }
+
+        switch (cmd) {
+        case Nrf24::CMD_R_RX_PAYLOAD:
+                return !rx_fifo.empty() && i < rx_fifo.front().data.size() ?
+                        rx_fifo.front().data[i] : 0;
+        case Nrf24::CMD_R_RX_PL_WID:
+                return rx_fifo.empty() ? 0 : rx_fifo.front().data.size();
+        case Nrf24::CMD_W_TX_PAYLOAD:
+        case Nrf24::CMD_W_TX_PAYLOAD_NOACK:
+                if (buf.size() < 32)
+                        buf.push_back(in);
+                return 0;
+        default:
+                return 0;
+        }
+}
+
+void Nrf24Model::deselect()
+{
+        if (cmd == Nrf24::CMD_R_RX_PAYLOAD && pos > 1 && !rx_fifo.empty()) {
+                rx_fifo.pop_front();
+                if (!rx_fifo.empty())
+                        regs[Nrf24::REG_STATUS][0] |= Nrf24::RX_DR;
+        }
+        if ((cmd == Nrf24::CMD_W_TX_PAYLOAD || cmd == Nrf24::CMD_W_TX_PAYLOAD_NOACK) &&
+                        !buf.empty() && tx_fifo.size() < 3)
+                tx_fifo.push_back(buf);
+        cmd = Nrf24::CMD_NOP;
+        pos = 0;
+}
+
+void Nrf24Model::set_ce(bool level)
+{
+        const bool rising = level && !ce;
+        ce = level;
+
+        const uint8_t c = regs[Nrf24::REG_CONFIG][0];
+        if (rising && (c & Nrf24::PWR_UP) && !(c & Nrf24::PRIM_RX))
+                send();
+}
+
+void Nrf24Model::send()
+{
+        while (!tx_fifo.empty()) {
+                if (transmit)
+                        transmit(regs[Nrf24::REG_TX_ADDR], tx_fifo.front());
+                tx_fifo.pop_front();
+                regs[Nrf24::REG_STATUS][0] |= Nrf24::TX_DS;
+                transmitted++;
+        }
+}
+
+bool Nrf24Model::receive(const uint8_t *addr, const uint8_t *data, size_t len)
+{
+        if (!listening())
+                return false;
+
+        const uint8_t aw = regs[Nrf24::REG_SETUP_AW][0] + 2;
+        for (uint8_t p = 0; p < 6; p++) {
+                if (!(regs[Nrf24::REG_EN_RXADDR][0] & 1<<p))
+                        continue;
+
+                /* Pipes 2..5 share all but the LSB with pipe 1 */
+                const uint8_t *a = regs[Nrf24::REG_RX_ADDR_P0 + p];
+                if (a[0] != addr[0] || memcmp(p < 2 ? a + 1 : regs[Nrf24::REG_RX_ADDR_P1] + 1,
+                                addr + 1, aw - 1) != 0)
+                        continue;
+
+                const bool dynamic = (regs[Nrf24::REG_FEATURE][0] & Nrf24::EN_DPL) &&
+                        (regs[Nrf24::REG_DYNPD][0] & 1<<p);
+                if (!dynamic && len != regs[Nrf24::REG_RX_PW_P0 + p][0]) {
+                        dropped++;      /* CRC error on the other side */
+                        return false;
+                }
+                if (rx_fifo.size() >= 3) {
+                        dropped++;
+                        return false;
+                }
+
+                rx_fifo.push_back(Packet {p, std::vector<uint8_t>(data, data + len)});
+                regs[Nrf24::REG_STATUS][0] |= Nrf24::RX_DR;
+                received++;
+                return true;
+        }
+        return false;
+}
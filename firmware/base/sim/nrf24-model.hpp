@@ -0,0 +1,65 @@
+/* Model of the NRF24L01+ chip at the SPI command level */
+
+#ifndef NRF24_MODEL_HPP_
+#define NRF24_MODEL_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <functional>
+
+class Nrf24Model {
+public:
+        struct Packet {
+                uint8_t pipe;
+                std::vector<uint8_t> data;
+        };
+
+        /* Address bytes are in the order they are written, LSB first */
+        using Transmit = std::function<void(const uint8_t *addr, const std::vector<uint8_t> &data)>;
+
+        /* Received power detector on the channel (RF_CH) */
+        using Carrier = std::function<bool(uint8_t channel)>;
+
+        Nrf24Model();
+
+        void select();                  /* CSN low */
+        uint8_t transfer(uint8_t in);
+        void deselect();                /* CSN high */
+        void set_ce(bool level);
+
+        /* A packet on air, return true if it was taken into the RX FIFO */
+        bool receive(const uint8_t *addr, const uint8_t *data, size_t len);
+
+        /* Called for every transmitted packet */
+        void on_transmit(Transmit t) { transmit = t; }
+
+        /* Called for every RPD read in RX mode */
+        void on_carrier(Carrier c) { carrier = c; }
+
+        /* IRQ pin level (active low) */
+        bool irq_pin() const;
+
+        uint8_t reg(uint8_t r) const { return regs[r & 0x1f][0]; }
+        bool listening() const;
+
+        /* Statistics */
+        unsigned received = 0, dropped = 0, transmitted = 0;
+private:
+        uint8_t regs[0x20][5];
+        std::deque<Packet> rx_fifo;
+        std::deque<std::vector<uint8_t>> tx_fifo;
+        std::vector<uint8_t> buf;
+        uint8_t cmd;
+        size_t pos;
+        bool ce;
+        Transmit transmit;
+        Carrier carrier;
+
+        uint8_t status() const;
+        uint8_t fifo_status() const;
+        void send();
+};
+
+#endif
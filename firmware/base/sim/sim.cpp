@@ -0,0 +1,581 @@
+/* Simulator core: virtual time, events, interrupts, buses, output */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <queue>
+#include <chrono>
+#include <thread>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include "sim.hpp"
+#include "max7221-model.hpp"
+#include "nrf24-model.hpp"
+#include "nrf24.hpp"
+
+using namespace Sim;
+
+/* The firmware (compiled with -Dmain=base_main) */
+int base_main();
+
+/* Interrupt vectors of the firmware, missing ones are null */
+extern "C" {
+        void PCINT2_vect() __attribute__((weak));
+        void TIMER0_OVF_vect() __attribute__((weak));
+        void TIMER2_OVF_vect() __attribute__((weak));
+        void ADC_vect() __attribute__((weak));
+}
+
+constexpr uint64_t timer0_period = 64*256;              /* clk/64, 8-bit overflow */
+constexpr uint64_t adc_conversion = 13*128;            /* 13 ADC clocks at clk/128 */
+constexpr uint64_t timer2_period = f_cpu;               /* 32768 Hz/128, 8-bit overflow */
+constexpr uint64_t watchdog_timeout = 4*f_cpu;          /* 4 s */
+constexpr uint64_t loop_cycles = 100;                   /* Nominal cost of a main loop pass */
+
+struct Event {
+        uint64_t time;
+        uint64_t seq;
+        std::function<void()> f;
+
+        bool operator<(const Event &e) const {
+                return time != e.time ? time > e.time : seq > e.seq;
+        }
+};
+
+struct Output {
+        FILE *frames = nullptr;         /* Frame log */
+        bool terminal = false;          /* Render to the terminal */
+        double speed = 0;               /* Virtual/real time ratio for the terminal (0 is max) */
+        bool quiet = false;
+};
+
+struct Statistics {
+        uint64_t loops = 0;
+        uint64_t busy_loops = 0;        /* Passes that did any work */
+        uint64_t longest_loop = 0;      /* Cycles */
+        uint64_t busy_cycles = 0;
+        uint64_t spi_bytes = 0;
+        uint64_t frames = 0;
+        unsigned air_packets = 0;
+        unsigned watchdog_resets = 0;
+};
+
+/* Interrupt sources in the order of priority */
+enum Irq: uint8_t {
+        irq_pcint2,
+        irq_timer2_ovf,
+        irq_timer0_ovf,
+        irq_adc,
+        nr_irqs
+};
+
+struct Vector {
+        void (*isr)();
+        bool pending;
+        uint64_t count;
+};
+
+static Vector vectors[nr_irqs] = {
+        {PCINT2_vect, false, 0},
+        {TIMER2_OVF_vect, false, 0},
+        {TIMER0_OVF_vect, false, 0},
+        {ADC_vect, false, 0},
+};
+
+static uint64_t virtual_now;
+static uint64_t end_time;
+static uint64_t event_seq;
+static std::priority_queue<Event> events;
+static bool interrupts;                 /* Global interrupt enable */
+static uint64_t timer0_start;           /* Time of the last Timer0 overflow */
+static uint64_t timer2_start;           /* Time of the last Timer2 overflow */
+
+static bool pin_driven[7*8], pin_level[7*8];
+
+static Max7221Model display {3};
+static Nrf24Model radio;
+
+static Output output;
+static Statistics stats;
+static std::chrono::steady_clock::time_point wall_start;
+
+uint64_t Sim::now()
+{
+        return virtual_now;
+}
+
+/* Run all events due up to the time limit */
+static void run_events(uint64_t limit)
+{
+        while (!events.empty() && events.top().time <= limit) {
+                Event e = events.top();
+                events.pop();
+                if (e.time > virtual_now)
+                        virtual_now = e.time;
+                e.f();
+        }
+}
+
+/* Interrupts fire in the middle of busy work, as on the real chip */
+void Sim::spend(uint64_t cycles)
+{
+        const uint64_t end = virtual_now + cycles;
+        stats.busy_cycles += cycles;
+        run_events(end);
+        if (end > virtual_now)
+                virtual_now = end;
+}
+
+void Sim::at(uint64_t time, std::function<void()> f)
+{
+        events.push(Event {time, event_seq++, f});
+}
+
+static void raise(Irq irq);
+
+void Sim::drive(Gpio::Pin pin, bool level)
+{
+        bool prev;
+        const bool changed = !driven(pin, prev) || prev != level;
+
+        pin_driven[pin] = true;
+        pin_level[pin] = level;
+
+        /* Pin change interrupt (only port D is used) */
+        if (changed && pin >= Gpio::D0 && pin <= Gpio::D7 &&
+                        (PCICR & 1<<PCIE2) && (PCMSK2 & 1<<(pin - Gpio::D0)))
+                raise(irq_pcint2);
+}
+
+void Sim::release(Gpio::Pin pin)
+{
+        pin_driven[pin] = false;
+}
+
+bool Sim::driven(Gpio::Pin pin, bool &level)
+{
+        level = pin_level[pin];
+        return pin_driven[pin];
+}
+
+void Sim::output_changed(Gpio::Pin pin, bool level)
+{
+        switch (pin) {
+        case max_cs:
+                level ? display.latch() : display.select();
+                break;
+        case nrf_csn:
+                level ? radio.deselect() : radio.select();
+                drive(nrf_irq, radio.irq_pin());
+                break;
+        case nrf_ce:
+                radio.set_ce(level);
+                drive(nrf_irq, radio.irq_pin());
+                break;
+        default:
+                break;
+        }
+}
+
+uint8_t Sim::spi_transfer(uint8_t out)
+{
+        stats.spi_bytes++;
+
+        /* Chip selects are outputs, read them back through the GPIO model */
+        if (!Gpio::read(max_cs))
+                display.transfer(out);
+        if (!Gpio::read(nrf_csn))
+                return radio.transfer(out);
+        return 0xff;
+}
+
+Sim::Channel Sim::base_channel()
+{
+        return Channel {radio.reg(Nrf24::REG_RF_CH),
+                static_cast<uint8_t>(radio.reg(Nrf24::REG_RF_SETUP) & (Nrf24::RF_DR_250kbps | Nrf24::RF_DR_2Mbps))};
+}
+
+bool Sim::air(const Channel &channel, const uint8_t *addr, const uint8_t *data, size_t len)
+{
+        stats.air_packets++;
+        const bool ok = channel == base_channel() && radio.receive(addr, data, len);
+        drive(nrf_irq, radio.irq_pin());
+        return ok;
+}
+
+void sim_delay_cycles(unsigned long cycles)
+{
+        spend(cycles);
+}
+
+/* Timer counters and overflow flags, as the firmware would read them now */
+static void sync_timers()
+{
+        TCNT0 = (virtual_now - timer0_start)/64;
+        TCNT2 = (virtual_now - timer2_start)*256/timer2_period;
+        TIFR0 = vectors[irq_timer0_ovf].pending ? 1<<TOV0 : 0;
+        TIFR2 = vectors[irq_timer2_ovf].pending ? 1<<TOV2 : 0;
+}
+
+/* Run pending interrupt handlers if interrupts are enabled */
+static void deliver()
+{
+        for (uint8_t i = 0; interrupts && i < nr_irqs; i++) {
+                Vector &v = vectors[i];
+                if (!v.pending)
+                        continue;
+                v.pending = false;
+                if (!v.isr)
+                        continue;
+                v.count++;
+                sync_timers();
+                interrupts = false;
+                v.isr();
+                interrupts = true;
+                i = 0xff;       /* Rescan from the highest priority */
+        }
+}
+
+static void raise(Irq irq)
+{
+        vectors[irq].pending = true;
+        deliver();
+}
+
+void sei()
+{
+        interrupts = true;
+        deliver();
+}
+
+void cli()
+{
+        interrupts = false;
+}
+
+SimAtomic::SimAtomic(): saved(interrupts)
+{
+        interrupts = false;
+        sync_timers();
+}
+
+SimAtomic::~SimAtomic()
+{
+        interrupts = saved;
+        deliver();
+}
+
+static void adc_complete()
+{
+        const uint16_t v = adc(ADMUX & 0x0f) << 2;      /* 10 bits */
+
+        if (ADMUX & 1<<ADLAR) {
+                ADCH = v >> 2;
+                ADCL = v << 6;
+        } else {
+                ADCH = v >> 8;
+                ADCL = v;
+        }
+        ADCSRA &= ~(1<<ADSC);
+        if (ADCSRA & 1<<ADIE)
+                raise(irq_adc);
+}
+
+static void timer0_overflow()
+{
+        timer0_start = virtual_now;
+
+        if ((TIMSK0 & 1<<TOIE0) && (TCCR0B & 7))
+                raise(irq_timer0_ovf);
+
+        /* Auto triggered ADC conversion, or a single one started by ADSC */
+        const bool triggered = (ADCSRA & 1<<ADATE) && (ADCSRB & 7) == (1<<ADTS2);
+        if ((ADCSRA & 1<<ADEN) && (triggered || (ADCSRA & 1<<ADSC)))
+                at(virtual_now + adc_conversion, adc_complete);
+        at(virtual_now + timer0_period, timer0_overflow);
+}
+
+static void timer2_overflow()
+{
+        timer2_start = virtual_now;
+
+        if ((TIMSK2 & 1<<TOIE2) && (TCCR2B & 7))
+                raise(irq_timer2_ovf);
+        at(virtual_now + timer2_period, timer2_overflow);
+}
+
+static void format_time(char *buf, size_t len, double s)
+{
+        const unsigned long t = s;
+        snprintf(buf, len, "%lud%02lu:%02lu:%02lu", t/86400, t/3600%24, t/60%60, t%60);
+}
+
+static void write_frame(FILE *f, const char *on, const char *off)
+{
+        char up[32], tod[32];
+        format_time(up, sizeof(up), static_cast<double>(virtual_now)/f_cpu);
+        format_time(tod, sizeof(tod), time_of_day());
+
+        fprintf(f, "@ %s  true time %s  intensity %u\n", up, tod + 2, display.intensity());
+        for (int y = 7; y >= 0; y--) {
+                for (size_t x = 0; x < display.width(); x++)
+                        fputs(display.column(x) & 1<<y ? on : off, f);
+                fputc('\n', f);
+        }
+}
+
+static void show_frame()
+{
+        stats.frames++;
+
+        if (output.frames)
+                write_frame(output.frames, "#", ".");
+
+        if (output.terminal) {
+                if (output.speed > 0) {
+                        auto due = wall_start + std::chrono::duration<double>(
+                                static_cast<double>(virtual_now)/f_cpu/output.speed);
+                        std::this_thread::sleep_until(due);
+                }
+                fputs("\033[H\033[2J", stdout);
+                write_frame(stdout, "██", "  ");
+                fflush(stdout);
+        }
+}
+
+static void finish()
+{
+        const double wall = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - wall_start).count();
+        const double virt = static_cast<double>(virtual_now)/f_cpu;
+
+        if (output.frames)
+                fclose(output.frames);
+        const unsigned long eeprom_bytes = eeprom_save();
+
+        if (!output.quiet) {
+                fprintf(stderr, "virtual time:     %.0f s (%.2f days)\n", virt, virt/86400);
+                fprintf(stderr, "wall time:        %.3f s (x%.0f)\n", wall, virt/wall);
+                fprintf(stderr, "main loop passes: %llu, %llu busy, longest %.3f ms\n",
+                        (unsigned long long)stats.loops, (unsigned long long)stats.busy_loops,
+                        stats.longest_loop*1e3/f_cpu);
+                fprintf(stderr, "CPU busy:         %.3f %%\n", 100.0*stats.busy_cycles/virtual_now);
+                fprintf(stderr, "interrupts:       TIMER0_OVF %llu, ADC %llu, TIMER2_OVF %llu, PCINT2 %llu\n",
+                        (unsigned long long)vectors[irq_timer0_ovf].count,
+                        (unsigned long long)vectors[irq_adc].count,
+                        (unsigned long long)vectors[irq_timer2_ovf].count,
+                        (unsigned long long)vectors[irq_pcint2].count);
+                fprintf(stderr, "SPI bytes:        %llu\n", (unsigned long long)stats.spi_bytes);
+                const Channel ch = base_channel();
+                fprintf(stderr, "radio:            %u on air, %u received, %u dropped, %u sent, "
+                        "channel %u at %s\n",
+                        stats.air_packets, radio.received, radio.dropped, radio.transmitted, ch.number,
+                        ch.rate == Nrf24::RF_DR_2Mbps ? "2 Mbit/s" :
+                        ch.rate == Nrf24::RF_DR_250kbps ? "250 kbit/s" : "1 Mbit/s");
+                const NodeStats n = node_stats();
+                fprintf(stderr, "outdoor nodes:    %u, %s, %u packets, %u delivered (%.2f %%), "
+                        "%u retransmits, %u collided, %u beacons heard, %u hunts\n",
+                        n.nodes, n.slotted ? "slotted" : "unslotted", n.sent, n.delivered,
+                        n.sent ? 100.0*n.delivered/n.sent : 0.0, n.retransmits, n.collided, n.beacons,
+                        n.hunts);
+                fprintf(stderr, "frames:           %llu\n", (unsigned long long)stats.frames);
+                fprintf(stderr, "EEPROM:           %lu bytes programmed\n", eeprom_bytes);
+                fprintf(stderr, "watchdog resets:  %u\n", stats.watchdog_resets);
+        }
+
+        exit(stats.watchdog_resets ? 1 : 0);
+}
+
+/* End of a main loop pass: deliver interrupts, skip idle time */
+void wdt_reset()
+{
+        static uint64_t pass_start = 0;
+        static uint64_t pass_cycles = 0;
+
+        const uint64_t pass = virtual_now - pass_start;
+        stats.loops++;
+        if (stats.busy_cycles != pass_cycles) {
+                stats.busy_loops++;
+                pass_cycles = stats.busy_cycles;
+        }
+        if (pass > stats.longest_loop)
+                stats.longest_loop = pass;
+        if (pass > watchdog_timeout) {
+                stats.watchdog_resets++;
+                fprintf(stderr, "watchdog reset at %.3f s: main loop pass took %.3f s\n",
+                        static_cast<double>(virtual_now)/f_cpu, static_cast<double>(pass)/f_cpu);
+        }
+
+        virtual_now += loop_cycles;
+
+        /* Nothing to do until the next event */
+        if (!events.empty() && events.top().time > virtual_now)
+                virtual_now = events.top().time;
+
+        run_events(virtual_now);
+
+        if (display.take_changed())
+                show_frame();
+
+        if (virtual_now >= end_time)
+                finish();
+
+        pass_start = virtual_now;
+}
+
+static double parse_duration(const char *s)
+{
+        char *end;
+        double v = strtod(s, &end);
+        switch (*end) {
+        case 'd': return v*86400;
+        case 'h': return v*3600;
+        case 'm': return v*60;
+        default: return v;
+        }
+}
+
+static double parse_time_of_day(const char *s)
+{
+        unsigned h = 0, m = 0, sec = 0;
+        sscanf(s, "%u:%u:%u", &h, &m, &sec);
+        return h*3600 + m*60 + sec;
+}
+
+static bool parse_encoder(const char *s, Scenario &sc)
+{
+        const char *colon = strchr(s, ':');
+        if (!colon)
+                return false;
+
+        EncoderEvent e;
+        e.time = parse_duration(s);
+        const char *action = colon + 1;
+        e.pressed = strncmp(action, "push-", 5) == 0;
+        if (e.pressed)
+                action += 5;
+        if (strcmp(action, "right") == 0)
+                e.right = true;
+        else if (strcmp(action, "left") == 0)
+                e.right = false;
+        else
+                return false;
+
+        sc.encoder.push_back(e);
+        return true;
+}
+
+static bool parse_push(const char *s, Scenario &sc)
+{
+        const char *colon = strchr(s, ':');
+        if (!colon || strlen(colon + 1) > 32 - 2)       /* A payload */
+                return false;
+
+        sc.pushes.push_back(Push {parse_duration(s), colon + 1});
+        return true;
+}
+
+static void usage()
+{
+        fprintf(stderr,
+                "Usage: base-sim [options]\n"
+                "Durations are in seconds, or with a suffix: s, m, h, d.\n"
+                "  -t <duration>       Simulated time (default 1d)\n"
+                "  -S <hh:mm:ss>       True time of day at start (default 12:00:00)\n"
+                "  -y <duration>       pc-link sync interval, 0 is never (default 1h)\n"
+                "  -Y <duration>       Stop syncing after\n"
+                "  -o <duration>       Outdoor node interval (default 256)\n"
+                "  -d <ratio>          Outdoor watchdog error, e.g. 0.05\n"
+                "  -L <p>              Probability of a lost outdoor packet\n"
+                "  -O <duration>       Outdoor node dies after\n"
+                "  -n <count>          Outdoor nodes (default 1), the others are rooms\n"
+                "  -U                  Nodes ignore the beacon (no slots)\n"
+                "  -P                  Nodes power on together, with the same watchdog\n"
+                "  -w <channel>        Wi-Fi network on the channel (1..13), may repeat\n"
+                "  -f <p>              Probability of a failed sensor read\n"
+                "  -l <level>          Fixed ambient light (0..255), day/night by default\n"
+                "  -e <time>:<action>  Encoder detent: left, right, push-left, push-right\n"
+                "  -p <time>:<text>    pc-link pushes the text (up to 30 characters) to the display\n"
+                "  -s <seed>           Random seed (default 1)\n"
+                "  -E <file>           EEPROM image, loaded at start and saved at the end\n"
+                "  -W                  Start as after a watchdog reset, not a power-on\n"
+                "  -F <file>           Log every displayed frame\n"
+                "  -T                  Render to the terminal\n"
+                "  -x <ratio>          Virtual/real time ratio for -T (default max)\n"
+                "  -q                  No summary\n");
+}
+
+int main(int argc, char **argv)
+{
+        Scenario sc;
+        const char *eeprom_image = nullptr;
+        uint8_t reset_cause = 1<<PORF;
+
+        int c;
+        while ((c = getopt(argc, argv, "t:S:y:Y:o:d:L:O:n:UPw:f:l:e:p:s:E:WF:Tx:qh")) != -1) {
+                switch (c) {
+                case 't': sc.duration = parse_duration(optarg); break;
+                case 'S': sc.start_time = parse_time_of_day(optarg); break;
+                case 'y': sc.sync_interval = parse_duration(optarg); break;
+                case 'Y': sc.sync_until = parse_duration(optarg); break;
+                case 'o': sc.outdoor_interval = parse_duration(optarg); break;
+                case 'd': sc.outdoor_drift = atof(optarg); break;
+                case 'L': sc.outdoor_loss = atof(optarg); break;
+                case 'O': sc.outdoor_until = parse_duration(optarg); break;
+                case 'n': sc.nodes = strtoul(optarg, nullptr, 0); break;
+                case 'U': sc.slotted = false; break;
+                case 'P': sc.nodes_together = true; break;
+                case 'w': sc.wifi.push_back(strtoul(optarg, nullptr, 0)); break;
+                case 'f': sc.sensor_faults = atof(optarg); break;
+                case 'l': sc.light = atof(optarg); break;
+                case 'e':
+                        if (!parse_encoder(optarg, sc)) {
+                                fprintf(stderr, "Bad encoder event: %s\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'p':
+                        if (!parse_push(optarg, sc)) {
+                                fprintf(stderr, "Bad push: %s\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 's': sc.seed = strtoul(optarg, nullptr, 0); break;
+                case 'E': eeprom_image = optarg; break;
+                case 'W': reset_cause = 1<<WDRF; break;
+                case 'F':
+                        output.frames = fopen(optarg, "w");
+                        if (!output.frames) {
+                                perror(optarg);
+                                return 1;
+                        }
+                        break;
+                case 'T': output.terminal = true; break;
+                case 'x': output.speed = atof(optarg); break;
+                case 'q': output.quiet = true; break;
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+
+        end_time = seconds(sc.duration);
+        wall_start = std::chrono::steady_clock::now();
+
+        MCUSR = reset_cause;
+        eeprom_load(eeprom_image);
+        start_world(sc);
+        radio.on_transmit([](const uint8_t *addr, const std::vector<uint8_t> &data) {
+                base_transmit(base_channel(), addr, data);
+        });
+        radio.on_carrier(carrier);
+        at(timer0_period, timer0_overflow);
+        at(timer2_period, timer2_overflow);
+
+        base_main();
+        return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Host simulator of the base station
+ *
+ * The firmware (base.cpp, matrix.cpp, max7221.cpp, nrf24.cpp, print.cpp) is
+ * compiled for the host as is, against simulated avr-libc headers, GPIO, SPI,
+ * EEPROM and sensor drivers. Time is virtual and counted in CPU cycles: it advances
+ * only by busy delays, bus transfers and a nominal cost of every main loop
+ * pass. When the firmware has nothing to do, the virtual time jumps to the
+ * next event, so days of operation pass in seconds.
+ *
+ * The firmware gives control to the simulator in wdt_reset() at the end of
+ * every main loop pass. Interrupts are delivered there and in the middle of
+ * busy work, unless they are disabled by cli() or ATOMIC_BLOCK.
+ */
+
+#ifndef SIM_HPP_
+#define SIM_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "gpio.hpp"
+
+namespace Sim
+{
+        constexpr uint64_t f_cpu = F_CPU;
+
+        /* Board wiring (the same as in base.cpp) */
+        constexpr Gpio::Pin max_cs = Gpio::B1;
+        constexpr Gpio::Pin nrf_csn = Gpio::D7, nrf_ce = Gpio::B2, nrf_irq = Gpio::D6;
+        constexpr Gpio::Pin enc_a = Gpio::D2, enc_b = Gpio::D3, enc_button = Gpio::D4;
+
+        /* Virtual time in CPU cycles */
+        uint64_t now();
+        void spend(uint64_t cycles);
+
+        constexpr uint64_t seconds(double s) {
+                return static_cast<uint64_t>(s*f_cpu);
+        }
+
+        /* Run a function at the given virtual time */
+        void at(uint64_t time, std::function<void()> f);
+
+        /* Pins driven from outside (sensors, encoder, the radio IRQ) */
+        void drive(Gpio::Pin pin, bool level);
+        void release(Gpio::Pin pin);
+        bool driven(Gpio::Pin pin, bool &level);
+
+        /* Called by the GPIO driver on every output change */
+        void output_changed(Gpio::Pin pin, bool level);
+
+        /* Called by the SPI driver, return the MISO byte */
+        uint8_t spi_transfer(uint8_t out);
+
+        /* Radio channel (RF_CH) and air rate (RF_SETUP bits) */
+        struct Channel {
+                uint8_t number;
+                uint8_t rate;
+
+                bool operator==(const Channel &c) const {
+                        return number == c.number && rate == c.rate;
+                }
+        };
+
+        /* The base radio channel */
+        Channel base_channel();
+
+        /* A packet on air for the base, return true if it was received */
+        bool air(const Channel &channel, const uint8_t *addr, const uint8_t *data, size_t len);
+
+        /* A packet on air from the base (address LSB first) */
+        void base_transmit(const Channel &channel, const uint8_t *addr, const std::vector<uint8_t> &data);
+
+        /* Received power on the channel, for the base survey */
+        bool carrier(uint8_t channel);
+
+        /* EEPROM image file (null is none), the number of bytes programmed */
+        void eeprom_load(const char *path);
+        unsigned long eeprom_save();
+
+        /* Simulated world, see world.cpp */
+        struct EncoderEvent {
+                double time;                    /* s */
+                bool right;
+                bool pressed;
+        };
+
+        /* Text pushed to the display through pc-link */
+        struct Push {
+                double time;                    /* s */
+                std::string text;
+        };
+
+        struct Scenario {
+                double duration = 86400;        /* s */
+                double start_time = 12*3600;    /* True time of day at start (s) */
+                double sync_interval = 3600;    /* pc-link syncs (s, 0 is never) */
+                double sync_until = -1;         /* Stop syncing after (s, -1 is never) */
+                double outdoor_interval = 256;  /* Outdoor node transmissions (s) */
+                double outdoor_drift = 0;       /* Outdoor watchdog error (relative) */
+                double outdoor_loss = 0;        /* Probability of a lost outdoor packet */
+                double outdoor_until = -1;      /* Outdoor node dies after (s, -1 is never) */
+                unsigned nodes = 1;             /* Outdoor nodes, 1 is outdoors, others are rooms */
+                bool slotted = true;            /* Nodes follow the beacon */
+                bool nodes_together = false;    /* Nodes power on together, with the same watchdog */
+                std::vector<unsigned> wifi;     /* Wi-Fi networks by channels (1..13) */
+                double wifi_duty = 0.3;         /* Air time of a Wi-Fi network */
+                double sensor_faults = 0;       /* Probability of a failed sensor read */
+                double light = -1;              /* Ambient light (0..255, -1 is day/night) */
+                unsigned seed = 1;
+                std::vector<EncoderEvent> encoder;
+                std::vector<Push> pushes;
+        };
+
+        struct Environment {
+                double temperature_outdoor;     /* °C */
+                double temperature_indoor;      /* °C */
+                double humidity;                /* % */
+                double pressure;                /* Pa */
+                double light;                   /* 0..255 ADC units */
+                double battery;                 /* Outdoor battery (V) */
+        };
+
+        struct NodeStats {
+                unsigned nodes;
+                bool slotted;
+                unsigned sent, delivered, collided;
+                unsigned retransmits;
+                unsigned hunts;                 /* For the base after missed packets */
+                unsigned beacons;               /* Heard by nodes */
+        };
+
+        void start_world(const Scenario &s);
+        NodeStats node_stats();
+        Environment environment();
+        double time_of_day();                   /* True time of day (s) */
+        uint8_t adc(uint8_t channel);
+        bool sensor_fault();
+}
+
+#endif
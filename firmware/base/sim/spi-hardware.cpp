@@ -0,0 +1,57 @@
+/* Simulated hardware SPI: bytes go to the device selected on the bus */
+
+#include "spi-hardware.hpp"
+#include "sim.hpp"
+
+static uint16_t cycles_per_byte = 8*128;
+
+SpiHardware::SpiHardware(Gpio::Pin mosi_, Gpio::Pin miso_, Gpio::Pin sck_):
+        mosi(mosi_), miso(miso_), sck(sck_) {}
+
+void SpiHardware::init()
+{
+        Gpio::write(mosi, 0);
+        Gpio::set(miso, Gpio::tri);
+        cycles_per_byte = 8*128;
+        forget_mode();
+}
+
+uint8_t SpiHardware::transfer(uint8_t out)
+{
+        Sim::spend(cycles_per_byte + 4);        /* Shifting, polling SPIF */
+        return Sim::spi_transfer(out);
+}
+
+void SpiHardware::apply_mode(Mode m)
+{
+        Sim::spend(4);                          /* SPCR, SPSR */
+        cycles_per_byte = 8 << m.clock;
+        Gpio::write(sck, m.cpol);
+}
+
+/* Bulk transfers: the next byte is loaded while the previous one shifts */
+
+void SpiHardware::write(const uint8_t *data, size_t len)
+{
+        while (len-- != 0) {
+                Sim::spend(cycles_per_byte + 1);
+                Sim::spi_transfer(*data++);
+        }
+}
+
+void SpiHardware::read(uint8_t *data, size_t len)
+{
+        while (len-- != 0) {
+                Sim::spend(cycles_per_byte + 1);
+                *data++ = Sim::spi_transfer(0);
+        }
+}
+
+void SpiHardware::write(const uint16_t *data, size_t len)
+{
+        for (; len-- != 0; data++) {
+                Sim::spend(2*(cycles_per_byte + 1));
+                Sim::spi_transfer(*data >> 8);
+                Sim::spi_transfer(*data & 0xff);
+        }
+}
@@ -0,0 +1,223 @@
+/*
+ * Host test of Queue and Seqlock (shared.hpp) under simulated interleavings.
+ * A main loop operation is preempted by a whole operation of the interrupt
+ * side: at every memory barrier (SHARED_PREEMPT), and after every byte copied
+ * of an element. First the interrupt runs at each of these points in turn,
+ * once per operation, then at random ones, any number of times.
+ *
+ * An element has the same byte everywhere, a torn copy has different ones.
+ */
+
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <random>
+
+static void preempt();
+#define SHARED_PREEMPT preempt
+#include "shared.hpp"
+
+/* Preemption points, the interrupt runs at the point fire_at or by chance */
+static std::function<void()> interrupt;
+static bool in_interrupt;
+static unsigned points, fire_at;
+static bool fired;
+static std::mt19937 rng(1);
+static std::bernoulli_distribution by_chance(0);
+
+static unsigned checks, failures;
+
+static void preempt()
+{
+        if (in_interrupt || !interrupt)
+                return;
+        if (++points != fire_at && !by_chance(rng))
+                return;
+        in_interrupt = true;
+        interrupt();
+        in_interrupt = false;
+        fired = true;
+}
+
+/* Arm the interrupt for the next main loop operation */
+static void arm(std::function<void()> f, unsigned at, double chance = 0)
+{
+        interrupt = f;
+        points = 0;
+        fire_at = at;
+        fired = false;
+        by_chance = std::bernoulli_distribution(chance);
+}
+
+static void disarm()
+{
+        interrupt = nullptr;
+}
+
+static void expect(bool ok, const char *what, unsigned at)
+{
+        checks++;
+        if (!ok && failures++ < 10)
+                printf("FAIL: %s (preempted at %u)\n", what, at);
+}
+
+/* An element copied a byte at a time, with a preemption point after each */
+struct Probe {
+        uint8_t b[4];
+
+        Probe() = default;
+        Probe(const Probe &) = default;
+        Probe &operator=(const Probe &p) {
+                for (uint8_t i = 0; i < sizeof(b); i++) {
+                        b[i] = p.b[i];
+                        preempt();
+                }
+                return *this;
+        }
+
+        static Probe of(uint8_t v) {
+                Probe p;
+                for (auto &x : p.b)
+                        x = v;
+                return p;
+        }
+
+        bool whole() const {
+                for (auto x : b)
+                        if (x != b[0])
+                                return false;
+                return true;
+        }
+};
+
+/* The reader in the main loop, the writer in the interrupt */
+static void test_seqlock()
+{
+        /* Once at every point, until the read has no more points */
+        for (unsigned at = 1; ; at++) {
+                Seqlock<Probe> lock {Probe::of(1)};
+                uint8_t latest = 1;
+                arm([&] { lock.write(Probe::of(++latest)); }, at);
+                const Probe p = lock.read();
+                disarm();
+                if (!fired)
+                        break;
+                expect(p.whole(), "seqlock: a torn read", at);
+                expect(p.b[0] == 1 || p.b[0] == latest, "seqlock: a value never written", at);
+        }
+
+        /* Writes at random points, the read returns one written during it */
+        Seqlock<Probe> lock;
+        uint8_t latest = 0;
+        for (unsigned i = 0; i < 100000; i++) {
+                const uint8_t before = latest;
+                arm([&] { lock.write(Probe::of(++latest)); }, 0, 0.3);
+                const Probe p = lock.read();
+                disarm();
+                expect(p.whole(), "seqlock: a torn read", 0);
+                expect(static_cast<uint8_t>(p.b[0] - before) <= static_cast<uint8_t>(latest - before),
+                        "seqlock: a stale read", 0);
+        }
+}
+
+/*
+ * A queue with its model: the accepted elements in order. An interrupt
+ * operation sees the state between main loop ones, so it's checked exactly.
+ * A main loop operation is checked by its result and the final drain.
+ */
+constexpr uint8_t queue_size = 4;
+
+struct QueueTest {
+        Queue<Probe, queue_size> q;
+        std::deque<uint8_t> model;
+        uint8_t next = 1;
+        unsigned failed_pushes = 0;
+        unsigned at = 0;
+
+        void push(bool in_isr) {
+                const size_t size = model.size();
+                const bool ok = q.push(Probe::of(next));
+                if (in_isr)
+                        expect(ok == (size < queue_size), "queue: push by the interrupt", at);
+                else if (!ok)
+                        expect(size == queue_size, "queue: push failed, not full at the start", at);
+                if (ok)
+                        model.push_back(next);
+                else
+                        failed_pushes++;
+                next++;
+        }
+
+        void pop(bool in_isr) {
+                const size_t size = model.size();
+                Probe p;
+                const bool ok = q.pop(p);
+                if (in_isr)
+                        expect(ok == (size != 0), "queue: pop by the interrupt", at);
+                else if (!ok)
+                        expect(size == 0, "queue: pop failed, not empty at the start", at);
+                if (!ok)
+                        return;
+                expect(p.whole(), "queue: a torn element", at);
+                expect(!model.empty() && p.b[0] == model.front(), "queue: lost or out of order", at);
+                if (!model.empty())
+                        model.pop_front();
+        }
+
+        /* Nothing is left behind, and every failed push is counted (the counter wraps) */
+        void drain() {
+                disarm();
+                for (uint8_t i = 0; i < queue_size && !model.empty(); i++)
+                        pop(true);
+                expect(model.empty(), "queue: an element is lost", at);
+                Probe p;
+                expect(!q.pop(p), "queue: an element nobody pushed", at);
+                expect(q.overflows == static_cast<uint8_t>(failed_pushes), "queue: overflows", at);
+        }
+};
+
+static void test_queue(bool main_pops)
+{
+        /* From every fill level, once at every point */
+        for (uint8_t fill = 0; fill <= queue_size; fill++)
+                for (unsigned at = 1; ; at++) {
+                        QueueTest t;
+                        t.at = at;
+                        for (uint8_t i = 0; i < fill; i++)
+                                t.push(true);
+                        if (main_pops) {
+                                arm([&] { t.push(true); }, at);
+                                t.pop(false);
+                        } else {
+                                arm([&] { t.pop(true); }, at);
+                                t.push(false);
+                        }
+                        const bool f = fired;
+                        t.drain();
+                        if (!f)
+                                break;
+                }
+
+        /* The interrupt at random points, the main loop in random bursts */
+        QueueTest t;
+        for (unsigned i = 0; i < 100000; i++) {
+                if (main_pops) {
+                        arm([&] { t.push(true); }, 0, 0.2);
+                        t.pop(false);
+                } else {
+                        arm([&] { t.pop(true); }, 0, 0.2);
+                        t.push(false);
+                }
+        }
+        t.drain();
+}
+
+int main()
+{
+        test_seqlock();
+        test_queue(true);
+        test_queue(false);
+
+        printf("shared: %u checks, %u failed\n", checks, failures);
+        return failures != 0;
+}
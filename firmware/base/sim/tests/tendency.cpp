@@ -0,0 +1,94 @@
+/*
+ * Host test of the pressure tendency (tendency.hpp): the fixed-point change
+ * against a double least-squares fit, over random walks of the history with
+ * bad records. The sums are built once the ring is filled, as at boot after
+ * the restore, then kept by add() across several wraps of the ring.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <random>
+#include "tendency.hpp"
+
+/* History records per day and the tendency windows (the same as in base.cpp) */
+constexpr uint8_t history_size = 128;
+constexpr uint8_t tendency_short = 16, tendency_long = 64;
+
+static int16_t ring[history_size];
+static unsigned checks, failures;
+
+static int16_t sample(uint8_t i)
+{
+        return ring[i];
+}
+
+/* Change for span records by the fit of the n records before current, false if one is bad */
+static bool reference(uint8_t n, uint8_t span, uint8_t current, double &change)
+{
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (uint8_t x = 0; x < n; x++) {
+                const int16_t y = ring[(current + history_size - n + x) % history_size];
+                if (y == tendency_bad)
+                        return false;
+                sx += x;
+                sy += y;
+                sxx += x*x;
+                sxy += x*y;
+        }
+        change = (n*sxy - sx*sy)/(n*sxx - sx*sx)*span;
+        return true;
+}
+
+/* The integer division truncates, so the change is within 1 of the fit */
+template<uint8_t N>
+static void check(const Tendency<N, tendency_short> &t, uint8_t current, unsigned seed, unsigned step)
+{
+        double r;
+        const bool known = reference(N, tendency_short, current, r);
+        const int16_t v = t.get();
+        checks++;
+        if (known ? (v != tendency_unknown && fabs(v - r) < 1) : v == tendency_unknown)
+                return;
+        if (failures++ < 10)
+                printf("FAIL: N = %u, seed %u, step %u: %d, expected %s%.3f\n",
+                        N, seed, step, v, known ? "" : "unknown, the fit is ", known ? r : 0.0);
+}
+
+int main()
+{
+        for (unsigned seed = 1; seed <= 200; seed++) {
+                std::mt19937 rng(seed);
+                std::uniform_int_distribution<int> start(-600, 400), walk(-15, 15), any(0, history_size - 1);
+                std::uniform_real_distribution<double> coin(0, 1);
+                const double bad_rate = (seed % 4 == 0) ? 0 : (seed % 4)*0.005;
+
+                /* The restored history: a random walk (mmHg/10 from the offset) */
+                int y = start(rng);
+                auto next = [&]() -> int16_t {
+                        y = std::max(-1000, std::min(1000, y + walk(rng)));
+                        return (coin(rng) < bad_rate) ? tendency_bad : y;
+                };
+                for (auto &r : ring)
+                        r = next();
+
+                uint8_t current = any(rng);
+                Tendency<tendency_short, tendency_short> t3;
+                Tendency<tendency_long, tendency_short> t12;
+                t3.init(sample, history_size, current);
+                t12.init(sample, history_size, current);
+
+                /* New records, the window wraps the ring several times */
+                for (unsigned step = 0; step < 4*history_size; step++) {
+                        check(t3, current, seed, step);
+                        check(t12, current, seed, step);
+
+                        ring[current] = next();
+                        t3.add(sample, history_size, current);
+                        t12.add(sample, history_size, current);
+                        current = (current + 1) % history_size;
+                }
+        }
+
+        printf("tendency: %u checks, %u failed\n", checks, failures);
+        return failures != 0;
+}
@@ -0,0 +1,19 @@
+/* Simulated atomic blocks: interrupts are held back until the end of the block */
+
+#ifndef SIM_UTIL_ATOMIC_H_
+#define SIM_UTIL_ATOMIC_H_
+
+class SimAtomic {
+private:
+        bool saved;
+public:
+        SimAtomic();
+        ~SimAtomic();
+};
+
+/* The body runs once, visibly to the compiler (the address of a local is never null) */
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (SimAtomic sim_atomic_, *sim_once_ = &sim_atomic_; sim_once_; sim_once_ = nullptr)
+
+#endif
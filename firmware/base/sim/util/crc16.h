@@ -0,0 +1,17 @@
+/* avr-libc CRC functions (the ones used by the firmware) */
+
+#ifndef SIM_UTIL_CRC16_H_
+#define SIM_UTIL_CRC16_H_
+
+#include <stdint.h>
+
+/* CRC-8-CCITT, polynomial x^8 + x^2 + x + 1 */
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+        crc ^= data;
+        for (int i = 0; i < 8; i++)
+                crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        return crc;
+}
+
+#endif
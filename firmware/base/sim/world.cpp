@@ -0,0 +1,486 @@
+/*
+ * Simulated world around the base station: weather, ambient light, the
+ * outdoor nodes, pc-link and the user
+ */
+
+#include <math.h>
+#include <string.h>
+#include <random>
+#include <memory>
+#include <map>
+#include "sim.hpp"
+#include "nrf24.hpp"
+
+using namespace Sim;
+
+/* NRF24 network addresses (the same as in base.cpp) */
+static const uint8_t pc_link_addr[] = {0xe7, 0x4f, 0xec, 0xe8, 0x37};
+static const uint8_t outdoor_addr[] = {0xc8, 0xb4, 0xe1, 0x65, 0x3b};
+static const uint8_t beacon_addr[] = {0xa5, 0xb4, 0xe1, 0x65, 0x3b};
+
+/*
+ * Text pushed to the display: the command (the same as in base.cpp), and the
+ * timeout (s), longer for a wide text to scroll to its end at 16 px/s (the
+ * same as in matrix-clock.cpp)
+ */
+constexpr uint8_t pc_link_text = 'T';
+constexpr uint8_t push_timeout = 5;
+constexpr size_t push_scroll_speed = 16;
+
+/* Beacon cycle and slots, and the watchdog tick of nodes (the same as in outdoor.cpp) */
+constexpr uint8_t beacon_nodes = 5;
+constexpr uint16_t slot_length = 32*256;
+constexpr double tick_nominal = 16e-3;
+constexpr double beacon_window = 4*tick_nominal;
+
+/* Temperature samples taken a beacon cycle, sent together once in the batch cycles (the same as in outdoor.cpp) */
+constexpr uint8_t samples_per_cycle = 2;
+constexpr uint8_t max_batch_cycles = 4;
+
+/* Retransmits until the base acknowledges, and the delay between them (outdoor.cpp and pc-link.cpp) */
+constexpr uint8_t retransmit_count = 3;
+constexpr double retransmit_delay = 500e-6;
+
+/* Radio channels and rates to hunt for the base (the same as in outdoor.cpp and pc-link.cpp) */
+constexpr Channel home_channel = {2, Nrf24::RF_DR_1Mbps};
+constexpr uint8_t hunt_first = 1, hunt_last = 82;
+constexpr uint8_t hunt_rates[] = {Nrf24::RF_DR_2Mbps, Nrf24::RF_DR_1Mbps, Nrf24::RF_DR_250kbps};
+constexpr uint8_t hunt_after = 4;
+constexpr double hunt_try = 3e-3;               /* A channel tried with all retransmits (s) */
+
+/*
+ * Outdoor node, scheduled as in outdoor.cpp: the watchdog tick is off by the
+ * error, and is measured by the base time in beacons.
+ */
+struct Node {
+        uint8_t id;
+        double error;                   /* Watchdog error (relative) */
+        double tick = tick_nominal;     /* Measured watchdog tick (s) */
+        uint32_t ticks_slept = 0;       /* Since the last beacon */
+        bool synced = false;
+        uint16_t prev_time = 0;
+        bool listening = false;
+        uint8_t lost = 0;               /* Since the last delivered packet */
+        uint8_t retransmits = 0;        /* Of the last delivered packet */
+        Channel channel = home_channel;
+        Channel next = home_channel;    /* Announced by the beacon */
+        uint8_t switch_in = 0;          /* Cycles until the handover */
+        uint8_t batch = 1;              /* Cycles between wakes, by the beacon */
+        uint8_t misses = hunt_after - 1;/* Not delivered since the last hunt */
+        uint8_t samples = 1;            /* In the next packet, the first one is at once */
+};
+
+static Scenario scenario;
+static std::mt19937 rng;
+static std::vector<Node> nodes;
+static NodeStats node_counts;
+static Channel pc_link_channel = home_channel;
+
+/* The latest packet on air by channels, a packet overlapped by another one is lost */
+struct Air {
+        uint64_t end = 0;
+        std::shared_ptr<bool> collided;
+};
+static std::map<uint8_t, Air> air_state;
+
+static bool chance(double p)
+{
+        return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+static double elapsed()
+{
+        return static_cast<double>(now())/f_cpu;
+}
+
+double Sim::time_of_day()
+{
+        return fmod(scenario.start_time + elapsed(), 86400);
+}
+
+/* Environment at t seconds of the simulation */
+static Environment environment_at(double t)
+{
+        const double day = fmod(scenario.start_time + t, 86400)/86400;
+        const double pi2 = 2*M_PI;
+
+        Environment e;
+        e.temperature_outdoor = 8 + 6*sin(pi2*(day - 0.375)) + 5*sin(pi2*t/(5.3*86400));
+        e.temperature_indoor = 22 + 0.8*sin(pi2*(day - 0.4));
+        e.humidity = 45 - 8*sin(pi2*(day - 0.4)) + 5*sin(pi2*t/(2.9*86400));
+        e.pressure = 100500 + 900*sin(pi2*t/(3.7*86400)) + 250*sin(pi2*t/(0.9*86400));
+        e.battery = 4.1 - 0.6*t/(180*86400.0);
+
+        if (scenario.light >= 0)
+                e.light = scenario.light;
+        else {
+                /* Daylight from 6 to 20 o'clock */
+                const double sun = sin(M_PI*(day*24 - 6)/14);
+                e.light = sun > 0 ? 10 + 210*sun : 3;
+        }
+
+        return e;
+}
+
+Environment Sim::environment()
+{
+        return environment_at(elapsed());
+}
+
+uint8_t Sim::adc(uint8_t channel)
+{
+        return channel == 0 ? lround(environment().light) : 0;
+}
+
+bool Sim::sensor_fault()
+{
+        return chance(scenario.sensor_faults);
+}
+
+/* A Wi-Fi network over the channel (22 MHz wide) is on air */
+static bool wifi_busy(uint8_t channel)
+{
+        for (unsigned w : scenario.wifi) {
+                const int centre = 12 + 5*(static_cast<int>(w) - 1);
+                if (abs(channel - centre) <= 11 && chance(scenario.wifi_duty))
+                        return true;
+        }
+        return false;
+}
+
+bool Sim::carrier(uint8_t channel)
+{
+        return wifi_busy(channel) || now() < air_state[channel].end;
+}
+
+/*
+ * Put a packet on air (with the preamble, the packet control field and CRC),
+ * deliver it at the end unless it collided
+ */
+static void on_air(const Channel &channel, size_t len, std::function<void(bool)> deliver)
+{
+        const double bit = (channel.rate == Nrf24::RF_DR_2Mbps) ? 0.5e-6 :
+                (channel.rate == Nrf24::RF_DR_250kbps) ? 4e-6 : 1e-6;
+        Air &a = air_state[channel.number];
+        const uint64_t t = now();
+        auto collided = std::make_shared<bool>(false);
+        if (t < a.end) {
+                *collided = true;
+                *a.collided = true;
+        }
+
+        const uint64_t end = t + seconds(((1 + 5 + len + 1)*8 + 9)*bit);
+        if (end > a.end) {
+                a.end = end;
+                a.collided = collided;
+        }
+        at(end, [collided, deliver] { deliver(!*collided); });
+}
+
+static void outdoor_wake(uint8_t i);
+
+/* Sleep for whole watchdog ticks, the node time is ticks of the nominal length */
+static void outdoor_sleep(uint8_t i, double node_time)
+{
+        Node &n = nodes[i];
+        const uint32_t ticks = node_time/n.tick;
+        n.ticks_slept += ticks;
+        at(now() + seconds(ticks*tick_nominal*(1 + n.error)), [i] { outdoor_wake(i); });
+}
+
+/* Beacon heard by the node: measure the tick, sleep to the middle of the slot */
+static void outdoor_beacon(uint8_t i, const std::vector<uint8_t> &d)
+{
+        Node &n = nodes[i];
+        const uint16_t time = d[1] << 8 | d[0];
+
+        if (n.synced && n.ticks_slept != 0 && n.ticks_slept*tick_nominal < 2*max_batch_cycles*256) {
+                const double expected = n.ticks_slept*n.tick;
+                double actual = static_cast<uint16_t>(time - n.prev_time)/256.0;
+                while (actual + 128 < expected)
+                        actual += 256;
+                const double tick = actual/n.ticks_slept;
+                if (fabs(tick/tick_nominal - 1) <= 0.25)
+                        n.tick = tick;
+        }
+        n.synced = true;
+        n.prev_time = time;
+        n.ticks_slept = 0;
+
+        /* Handover, a wake is once in the batch cycles */
+        if (d[4 + beacon_nodes] != 0) {
+                n.next = Channel {d[2 + beacon_nodes], d[3 + beacon_nodes]};
+                n.switch_in = d[4 + beacon_nodes];
+        }
+        n.batch = std::max<uint8_t>(1, std::min(d[5 + beacon_nodes], max_batch_cycles));
+        n.samples = samples_per_cycle*n.batch;
+
+        uint32_t delay = 65536;
+        for (uint8_t s = 0; s < beacon_nodes; s++) {
+                if (d[2 + s] != n.id)
+                        continue;
+                delay = static_cast<uint16_t>(s*slot_length + slot_length/2 - time);
+                if (delay < slot_length/2)
+                        delay += 65536;
+        }
+        outdoor_sleep(i, (delay + (n.batch - 1)*65536)/256.0);
+}
+
+/*
+ * Transmit with Enhanced ShockBurst: the base acknowledges a delivered packet,
+ * a collided or a lost one is retransmitted after the delay, done(arc) is
+ * called with the retransmit count, or -1 if not delivered. The acknowledgement
+ * itself is never lost. Collisions and retransmits of nodes are counted.
+ */
+static void transmit_acked(const Channel &channel, const std::vector<uint8_t> &addr,
+        const std::vector<uint8_t> &d, double loss, bool node, std::function<void(int)> done,
+        uint8_t arc = 0)
+{
+        const bool lost = chance(loss) || wifi_busy(channel.number);
+        on_air(channel, d.size(), [channel, addr, d, loss, node, done, arc, lost](bool ok) {
+                if (!ok && node)
+                        node_counts.collided++;
+                if (ok && !lost && air(channel, addr.data(), d.data(), d.size())) {
+                        done(arc);
+                        return;
+                }
+                if (arc == retransmit_count) {
+                        done(-1);
+                        return;
+                }
+                if (node)
+                        node_counts.retransmits++;
+                at(now() + seconds(130e-6 + retransmit_delay), [channel, addr, d, loss, node, done, arc] {
+                        transmit_acked(channel, addr, d, loss, node, done, arc + 1);
+                });
+        });
+}
+
+/*
+ * Hunt for the base over the channels and rates, in the order of outdoor.cpp:
+ * done(arc, channel) is called after the channels tried before the base one,
+ * with arc -1 if the packet was not delivered on it either
+ */
+static void hunt(const std::vector<uint8_t> &addr, const std::vector<uint8_t> &d, double loss, bool node,
+        std::function<void(int, Channel)> done)
+{
+        const Channel base = base_channel();
+        unsigned tries = 0;
+        bool found = false;
+        for (uint8_t r : hunt_rates) {
+                for (uint8_t ch = hunt_first; ch <= hunt_last && !found; ch++) {
+                        found = (Channel {ch, r} == base);
+                        tries += !found;
+                }
+        }
+
+        at(now() + seconds(tries*hunt_try), [addr, d, loss, node, done, base, found] {
+                if (!found)
+                        done(-1, base);
+                else
+                        transmit_acked(base, addr, d, loss, node, [done, base](int arc) { done(arc, base); });
+        });
+}
+
+/* Sleep for the whole batch cycles, or the unslotted interval */
+static void outdoor_idle(uint8_t i)
+{
+        Node &n = nodes[i];
+        if (scenario.slotted)
+                outdoor_sleep(i, 256*n.batch + n.id);
+        else
+                at(now() + seconds(scenario.outdoor_interval*(1 + n.error)), [i] { outdoor_wake(i); });
+}
+
+/* Packet of the node delivered with arc retransmits (-1 is not), listen for the beacon then */
+static void outdoor_sent(uint8_t i, int arc)
+{
+        Node &n = nodes[i];
+        if (arc < 0) {
+                if (n.lost < UINT8_MAX)
+                        n.lost++;
+                outdoor_idle(i);
+                return;
+        }
+        node_counts.delivered++;
+        n.lost = 0;
+        n.misses = 0;
+        n.retransmits = arc;
+
+        /* Listen for the beacon, or sleep for the whole cycle */
+        n.listening = true;
+        at(now() + seconds(beacon_window), [i] {
+                Node &m = nodes[i];
+                if (!m.listening)
+                        return;
+                m.listening = false;
+                outdoor_idle(i);
+        });
+}
+
+/*
+ * Outdoor node: node ID, battery level (255 is 4.2 V), the link statistics
+ * and the samples taken evenly since the previous wake: temperature (1/16 °C,
+ * LSB first) and age (4 s), the freshest one last. Then listening for the
+ * beacon if delivered. Node 1 is outdoors, other nodes are rooms 2 °C apart,
+ * on the pipes 1..5. After a few packets not delivered, the node hunts for
+ * the base.
+ */
+static void outdoor_wake(uint8_t i)
+{
+        Node &n = nodes[i];
+        const double t = elapsed();
+        if (scenario.outdoor_until >= 0 && t > scenario.outdoor_until)
+                return;
+        if (n.switch_in != 0) {
+                n.switch_in = (n.switch_in > n.batch) ? n.switch_in - n.batch : 0;
+                if (n.switch_in == 0)
+                        n.channel = n.next;
+        }
+
+        const Environment e = environment();
+        std::vector<uint8_t> d = {
+                n.id,
+                static_cast<uint8_t>(fmin(255, e.battery/4.2*255)),
+                n.lost,
+                n.retransmits,
+        };
+        const double interval = scenario.slotted ? 256 : scenario.outdoor_interval;
+        for (int k = n.samples - 1; k >= 0; k--) {
+                const double age = k*interval/samples_per_cycle;
+                const Environment s = environment_at(t - age);
+                const double temperature = (n.id == 1) ? s.temperature_outdoor : s.temperature_indoor - 2*(n.id - 1);
+                const int16_t t16 = floor(temperature*16);
+                d.push_back(t16 & 0xff);
+                d.push_back(t16 >> 8);
+                d.push_back(lround(fmin(255, age/4)));
+        }
+        n.samples = samples_per_cycle*n.batch;
+        std::vector<uint8_t> addr(outdoor_addr, outdoor_addr + sizeof(outdoor_addr));
+        addr[0] += (n.id - 1) % 5;
+
+        node_counts.sent++;
+        transmit_acked(n.channel, addr, d, scenario.outdoor_loss, true, [i, addr, d](int arc) {
+                Node &m = nodes[i];
+                if (arc >= 0 || ++m.misses < hunt_after) {
+                        outdoor_sent(i, arc);
+                        return;
+                }
+                m.misses = 0;
+                node_counts.hunts++;
+                hunt(addr, d, scenario.outdoor_loss, true, [i](int found, Channel channel) {
+                        if (found >= 0) {
+                                nodes[i].channel = channel;
+                                nodes[i].switch_in = 0;
+                        }
+                        outdoor_sent(i, found);
+                });
+        });
+}
+
+void Sim::base_transmit(const Channel &channel, const uint8_t *addr, const std::vector<uint8_t> &data)
+{
+        if (memcmp(addr, beacon_addr, sizeof(beacon_addr)) != 0)
+                return;
+
+        on_air(channel, data.size(), [channel, data](bool ok) {
+                if (!ok || !scenario.slotted)
+                        return;
+                for (uint8_t i = 0; i < nodes.size(); i++) {
+                        if (!nodes[i].listening || !(nodes[i].channel == channel) ||
+                                        data.size() != 2 + beacon_nodes + 3 + 1)
+                                continue;
+                        nodes[i].listening = false;
+                        node_counts.beacons++;
+                        outdoor_beacon(i, data);
+                }
+        });
+}
+
+Sim::NodeStats Sim::node_stats()
+{
+        node_counts.nodes = nodes.size();
+        node_counts.slotted = scenario.slotted;
+        return node_counts;
+}
+
+/* pc-link: hours, minutes, seconds */
+static void pc_link_transmit()
+{
+        const double t = elapsed();
+        if (scenario.sync_until >= 0 && t > scenario.sync_until)
+                return;
+
+        const uint32_t tod = time_of_day();
+        const std::vector<uint8_t> d = {
+                static_cast<uint8_t>(tod/3600),
+                static_cast<uint8_t>(tod/60%60),
+                static_cast<uint8_t>(tod%60),
+        };
+        const std::vector<uint8_t> addr(pc_link_addr, pc_link_addr + sizeof(pc_link_addr));
+        transmit_acked(pc_link_channel, addr, d, 0, false, [addr, d](int arc) {
+                if (arc < 0)
+                        hunt(addr, d, 0, false, [](int found, Channel channel) {
+                                if (found >= 0)
+                                        pc_link_channel = channel;
+                        });
+        });
+
+        at(now() + seconds(scenario.sync_interval), pc_link_transmit);
+}
+
+/* pc-link: text for the display, held for push_timeout or until it scrolls to the end */
+static void pc_link_push(const std::string &text)
+{
+        const size_t width = 6*text.size();
+        const size_t timeout = (width > 24) ? (width - 24 + push_scroll_speed - 1)/push_scroll_speed + 3 : 0;
+        std::vector<uint8_t> d = {pc_link_text, static_cast<uint8_t>(std::max<size_t>(push_timeout, timeout))};
+        d.insert(d.end(), text.begin(), text.end());
+        const std::vector<uint8_t> addr(pc_link_addr, pc_link_addr + sizeof(pc_link_addr));
+        transmit_acked(pc_link_channel, addr, d, 0, false, [](int) {});
+}
+
+/* One detent of the encoder: a quadrature cycle, B leads A to the right */
+static void encoder_step(const EncoderEvent &e)
+{
+        const uint64_t t = seconds(e.time);
+        const uint64_t ms = seconds(1e-3);
+        const Gpio::Pin first = e.right ? enc_b : enc_a, second = e.right ? enc_a : enc_b;
+
+        if (e.pressed)
+                at(t, [] { drive(enc_button, 0); });
+        at(t + 5*ms, [first] { drive(first, 0); });
+        at(t + 15*ms, [second] { drive(second, 0); });
+        at(t + 25*ms, [first] { drive(first, 1); });
+        at(t + 35*ms, [second] { drive(second, 1); });
+        if (e.pressed)
+                at(t + 50*ms, [] { drive(enc_button, 1); });
+}
+
+void Sim::start_world(const Scenario &s)
+{
+        scenario = s;
+        rng.seed(s.seed);
+
+        drive(enc_a, 1);
+        drive(enc_b, 1);
+        drive(enc_button, 1);
+
+        /* Node 1 starts in the middle of the interval, others at random, or all together */
+        std::uniform_real_distribution<double> phase(0, s.outdoor_interval), error(-0.1, 0.1);
+        for (unsigned id = 1; id <= s.nodes; id++) {
+                const bool first = (id == 1 || s.nodes_together);
+                Node n;
+                n.id = id;
+                n.error = s.outdoor_drift + (first ? 0 : error(rng));
+                nodes.push_back(n);
+                const uint8_t i = id - 1;
+                at(seconds(1 + (first ? s.outdoor_interval/2 : phase(rng))), [i] { outdoor_wake(i); });
+        }
+        if (s.sync_interval > 0)
+                at(seconds(30), pc_link_transmit);
+        for (const auto &e : s.encoder)
+                encoder_step(e);
+        for (const auto &p : s.pushes)
+                at(seconds(p.time), [p] { pc_link_push(p.text); });
+}
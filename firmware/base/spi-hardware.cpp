@@ -6,27 +6,90 @@
 SpiHardware::SpiHardware(Gpio::Pin mosi_, Gpio::Pin miso_, Gpio::Pin sck_):
         mosi(mosi_), miso(miso_), sck(sck_) {}
 
-void SpiHardware::init(Divider div, Mode m)
+static inline void wait()
+{
+        while ((SPSR & 1<<SPIF) == 0)
+                memory_barrier();
+}
+
+void SpiHardware::init()
 {
         Gpio::write(mosi, 0);
         Gpio::set(miso, Gpio::tri);
-        SPCR = 1<<SPE | 1<<MSTR | (div & 3);
-        set_bits(SPSR, 1<<SPI2X, div == div_2);
-        set_mode(m);
+        SPCR = 1<<SPE | 1<<MSTR | 1<<SPR1 | 1<<SPR0;
+        SPSR = 0;
+        forget_mode();
 }
 
 uint8_t SpiHardware::transfer(uint8_t out)
 {
         SPDR = out;
-        while ((SPSR & 1<<SPIF) == 0)
-                memory_barrier();
+        wait();
         return SPDR;
 }
 
-void SpiHardware::set_mode(Mode m)
+/*
+ * SPR selects the divider 4, 16, 64 or 128, SPI2X halves the first three:
+ * F_CPU >> k is SPR = (k-1)/2, with SPI2X for an odd k below 7.
+ */
+void SpiHardware::apply_mode(Mode m)
 {
-        set_bits(SPCR, 1<<CPOL, m.cpol);
-        set_bits(SPCR, 1<<CPHA, m.cpha);
-        set_bits(SPCR, 1<<DORD, !m.msb_first);
+        const uint8_t spr = (m.clock - 1) / 2;
+        SPCR = 1<<SPE | 1<<MSTR | !m.msb_first << DORD |
+                m.cpol << CPOL | m.cpha << CPHA | spr;
+        SPSR = (m.clock % 2 != 0 && m.clock != 7) << SPI2X;
         Gpio::write(sck, m.cpol);
 }
+
+/*
+ * Writing SPDR during a transfer is a collision, so the next byte is loaded
+ * into a register first and written as soon as SPIF is set. The received
+ * byte is read before the next transfer starts: an interrupt between them
+ * can't overrun it.
+ */
+
+void SpiHardware::write(const uint8_t *data, size_t len)
+{
+        if (len == 0)
+                return;
+        SPDR = *data++;
+        while (--len != 0) {
+                const uint8_t next = *data++;
+                wait();
+                SPDR = next;
+        }
+        wait();
+}
+
+void SpiHardware::read(uint8_t *data, size_t len)
+{
+        if (len == 0)
+                return;
+        SPDR = 0;
+        while (--len != 0) {
+                wait();
+                const uint8_t in = SPDR;
+                SPDR = 0;
+                *data++ = in;
+        }
+        wait();
+        *data = SPDR;
+}
+
+void SpiHardware::write(const uint16_t *data, size_t len)
+{
+        if (len == 0)
+                return;
+        uint16_t word = *data++;
+        SPDR = word >> 8;
+        for (;;) {
+                wait();
+                SPDR = word & 0xff;
+                if (--len == 0)
+                        break;
+                word = *data++;
+                wait();
+                SPDR = word >> 8;
+        }
+        wait();
+}
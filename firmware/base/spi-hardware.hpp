@@ -4,25 +4,25 @@
 #define SPI_HARDWARE_HPP_
 
 #include <stdint.h>
+#include <stddef.h>
 #include "spi.hpp"
 #include "gpio.hpp"
 
-class SpiHardware: public Spi {
+class SpiHardware: public Spi<SpiHardware> {
 private:
         const Gpio::Pin mosi, miso, sck;
 public:
-        /* F_CPU dividers for SCK */
-        enum Divider: uint8_t {
-                div_2   = 4,
-                div_4   = 0,
-                div_16  = 1,
-                div_64  = 2,
-                div_128 = 3,
-        };
         SpiHardware(Gpio::Pin mosi, Gpio::Pin miso, Gpio::Pin sck);
-        void init(Divider div = div_128, Mode m = {0, 0, 1});
-        uint8_t transfer(uint8_t out) override;
-        void set_mode(Mode m) override;
+        void init();                    /* The mode is set by the drivers */
+        uint8_t transfer(uint8_t out);
+        void apply_mode(Mode m);
+
+        /* Bulk transfers load the next byte while the previous one shifts */
+        using Spi<SpiHardware>::write;
+        using Spi<SpiHardware>::read;
+        void write(const uint8_t *data, size_t len);
+        void read(uint8_t *data, size_t len);
+        void write(const uint16_t *data, size_t len);
 };
 
 #endif
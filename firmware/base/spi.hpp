@@ -1,4 +1,15 @@
-/* Abstract SPI interface (master) */
+/*
+ * SPI interface (master), bound at compile time
+ *
+ * A concrete SPI derives from Spi<Impl> and provides transfer() and
+ * apply_mode(), it may replace the bulk write() and read() with faster
+ * kernels. There are no virtual calls: the drivers use SpiBus of the
+ * firmware (spi-bus.hpp). The mode is cached, selecting the current one
+ * costs a comparison.
+ *
+ * The mode includes the clock: each driver asks for the fastest one its
+ * chip allows, so devices of different speeds share the bus.
+ */
 
 #ifndef SPI_HPP_
 #define SPI_HPP_
@@ -6,19 +17,48 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#ifndef F_CPU
+#  error "Define F_CPU to the CPU frequency in Hz"
+#endif
+
+struct SpiMode {
+        bool cpol: 1;
+        bool cpha: 1;
+        bool msb_first: 1;
+        uint8_t clock: 3;               /* SCK is F_CPU >> clock (1..7) */
+
+        /* The fastest clock up to max_hz */
+        static constexpr uint8_t clock_for(uint32_t max_hz, uint8_t shift = 1) {
+                return (shift == 7 || (F_CPU >> shift) <= max_hz) ?
+                        shift : clock_for(max_hz, shift + 1);
+        }
+};
+
+template<class Impl>
 class Spi {
+private:
+        static constexpr uint8_t no_mode = 0xff;
+        uint8_t mode_bits = no_mode;
+
+        Impl &impl() { return static_cast<Impl &>(*this); }
+        static constexpr uint8_t bits(SpiMode m) {
+                return m.cpol | m.cpha << 1 | m.msb_first << 2 | m.clock << 3;
+        }
+protected:
+        /* The hardware is reset, the next set_mode() applies the mode */
+        void forget_mode() { mode_bits = no_mode; }
 public:
-        struct Mode {
-                bool cpol: 1;
-                bool cpha: 1;
-                bool msb_first: 1;
-        };
+        using Mode = SpiMode;
 
-        virtual uint8_t transfer(uint8_t out) = 0;
-        virtual void set_mode(Mode m) = 0;
+        void set_mode(Mode m) {
+                if (bits(m) == mode_bits)
+                        return;
+                mode_bits = bits(m);
+                impl().apply_mode(m);
+        }
 
-        void write(uint8_t byte) { transfer(byte); }
-        uint8_t read() { return transfer(0); }
+        void write(uint8_t byte) { impl().transfer(byte); }
+        uint8_t read() { return impl().transfer(0); }
 
         void write(const uint8_t *data, size_t len) {
                 while (len-- != 0)
@@ -29,6 +69,14 @@ public:
                 while (len-- != 0)
                         *data++ = read();
         }
+
+        /* 16-bit words, MSB first */
+        void write(const uint16_t *data, size_t len) {
+                for (; len-- != 0; data++) {
+                        write(static_cast<uint8_t>(*data >> 8));
+                        write(static_cast<uint8_t>(*data & 0xff));
+                }
+        }
 };
 
 #endif
@@ -0,0 +1,69 @@
+/*
+ * Pressure tendency: the least-squares slope over the last N records of a
+ * ring, in running sums. With x = 0..N-1 from the oldest record, a new record
+ * y and the leaving one y0 change the sums as Sxy += (N-1)*y - (Sy - y0),
+ * Sy += y - y0. Bad records count as 0 and make the tendency unknown.
+ *
+ * Records are read by their ring index through a function, which returns
+ * tendency_bad for a bad record.
+ */
+
+#ifndef TENDENCY_HPP_
+#define TENDENCY_HPP_
+
+#include <stdint.h>
+
+constexpr int16_t tendency_bad = INT16_MIN;     /* A bad record */
+constexpr int16_t tendency_unknown = INT16_MAX; /* The tendency with bad records */
+
+/* N records in the window, the change is for Span records */
+template<uint8_t N, uint8_t Span>
+class Tendency {
+        static_assert(N >= 2, "");
+        static constexpr int32_t sx = static_cast<int32_t>(N)*(N - 1)/2;
+        static constexpr int32_t d = static_cast<int32_t>(N)*N*(static_cast<int32_t>(N)*N - 1)/12;  /* N*Sxx - Sx*Sx */
+        static_assert(d % Span == 0, "");
+public:
+        /* Sums for the N records before the index current (after the ring is filled) */
+        template<typename Sample>
+        void init(Sample sample, uint8_t size, uint8_t current) {
+                sy = sxy = 0;
+                bad = 0;
+                for (uint8_t k = N; k > 0; k--) {
+                        const int16_t y = sample((current + size - k) % size);
+                        if (y == tendency_bad)
+                                bad++;
+                        else {
+                                sy += y;
+                                sxy += static_cast<int32_t>(N - k)*y;
+                        }
+                }
+        }
+
+        /* Add the record i, the one N before it leaves */
+        template<typename Sample>
+        void add(Sample sample, uint8_t size, uint8_t i) {
+                int16_t y = sample(i), y0 = sample((i + size - N) % size);
+                bad += (y == tendency_bad) - (y0 == tendency_bad);
+                if (y == tendency_bad)
+                        y = 0;
+                if (y0 == tendency_bad)
+                        y0 = 0;
+                sxy += static_cast<int32_t>(N - 1)*y - (sy - y0);
+                sy += y - y0;
+        }
+
+        /* Change for Span records by the slope, tendency_unknown with bad records */
+        int16_t get() const {
+                if (bad != 0)
+                        return tendency_unknown;
+
+                /* slope = (N*Sxy - Sx*Sy)/d per record */
+                return (N*sxy - sx*sy)/(d/Span);
+        }
+private:
+        int32_t sy = 0, sxy = 0;
+        uint8_t bad = 0;                /* Bad records in the window */
+};
+
+#endif
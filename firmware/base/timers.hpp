@@ -0,0 +1,145 @@
+/*
+ * Software timers on a hardware tick
+ *
+ * A hierarchical timing wheel: 4 levels of 8 slots cover 4095 ticks. A timer
+ * is linked to the slot of its due tick at the level of its distance, and a
+ * slot of a higher level is moved down when the lower one wraps, so start,
+ * stop and expiry take the same time for any number of timers. Timers are
+ * identified by their number 0..N-1, an expired one is an event bit for the
+ * main loop (take()). Periodic timers are linked again when they expire.
+ *
+ * tick() is called from the interrupt, the other methods from the main loop.
+ */
+
+#ifndef TIMERS_HPP_
+#define TIMERS_HPP_
+
+#include <stdint.h>
+#include "shared.hpp"
+
+template<uint8_t N>
+class TimerWheel {
+        static_assert(N >= 1 && N <= 16, "");
+public:
+        static constexpr uint16_t max_ticks = 4095;
+
+        TimerWheel() {
+                for (auto &h : heads)
+                        h = none;
+                for (auto &t : timers)
+                        t.slot = none;
+        }
+
+        /* Expire after the given ticks (1..max_ticks), then every period if not 0 */
+        void start(uint8_t id, uint16_t ticks, uint16_t period = 0) {
+                atomic_block {
+                        Timer &t = timers[id];
+                        if (t.slot != none)
+                                unlink(id);
+                        t.due = now + ticks;
+                        t.period = period;
+                        link(id);
+                }
+        }
+
+        void stop(uint8_t id) {
+                atomic_block {
+                        if (timers[id].slot != none)
+                                unlink(id);
+                        events &= ~(1u << id);
+                }
+        }
+
+        /* Expired timers since the previous call, a bit each */
+        uint16_t take() {
+                uint16_t e;
+                atomic_block {
+                        e = events;
+                        events = 0;
+                }
+                return e;
+        }
+
+        void tick() {
+                now++;
+
+                /* Move the timers down from the levels that came round */
+                for (uint8_t level = 1; level < levels; level++) {
+                        if ((now & ((1u << bits*level) - 1)) != 0)
+                                break;
+                        uint8_t id = take_slot(level*slots + (now >> bits*level) % slots);
+                        while (id != none) {
+                                const uint8_t next = timers[id].next;
+                                link(id);
+                                id = next;
+                        }
+                }
+
+                /* Everything in the slot of this tick is due */
+                uint8_t id = take_slot(now % slots);
+                while (id != none) {
+                        Timer &t = timers[id];
+                        const uint8_t next = t.next;
+                        events |= 1u << id;
+                        if (t.period != 0) {
+                                t.due += t.period;
+                                link(id);
+                        }
+                        id = next;
+                }
+        }
+private:
+        static constexpr uint8_t bits = 3, slots = 1 << bits, levels = 4;
+        static constexpr uint8_t none = UINT8_MAX;
+        static_assert(max_ticks == (1u << bits*levels) - 1, "");
+
+        struct Timer {
+                uint16_t due;                   /* Tick */
+                uint16_t period;                /* Ticks, 0 is a one-shot */
+                uint8_t next, prev;             /* In the slot list */
+                uint8_t slot;                   /* level*slots + slot, none if stopped */
+        };
+
+        Timer timers[N];
+        uint8_t heads[levels*slots];            /* First timer of each slot */
+        uint16_t now = 0;
+        uint16_t events = 0;
+
+        void link(uint8_t id) {
+                Timer &t = timers[id];
+                const uint16_t distance = t.due - now;
+                uint8_t level = 0;
+                while (level < levels - 1 && distance >= 1u << bits*(level + 1))
+                        level++;
+                const uint8_t s = level*slots + (t.due >> bits*level) % slots;
+
+                t.slot = s;
+                t.prev = none;
+                t.next = heads[s];
+                if (t.next != none)
+                        timers[t.next].prev = id;
+                heads[s] = id;
+        }
+
+        void unlink(uint8_t id) {
+                Timer &t = timers[id];
+                if (t.prev != none)
+                        timers[t.prev].next = t.next;
+                else
+                        heads[t.slot] = t.next;
+                if (t.next != none)
+                        timers[t.next].prev = t.prev;
+                t.slot = none;
+        }
+
+        /* Detach the whole list of a slot, the timers are stopped until linked again */
+        uint8_t take_slot(uint8_t s) {
+                const uint8_t first = heads[s];
+                heads[s] = none;
+                for (uint8_t id = first; id != none; id = timers[id].next)
+                        timers[id].slot = none;
+                return first;
+        }
+};
+
+#endif
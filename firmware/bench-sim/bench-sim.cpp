@@ -0,0 +1,399 @@
+/*
+ * Cycle-accurate benchmark of the firmware under simavr
+ *
+ * The ELF file is run in a scripted scenario of its board with all peers
+ * emulated at the register level. Cycles of every ISR, every (non-inlined)
+ * function and every main loop pass are counted, as well as the time with
+ * interrupts disabled. The results are written as JSON, so they can be
+ * compared across commits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <map>
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include <avr_adc.h>
+#include <avr_uart.h>
+#include "profile.hpp"
+#include "peers.hpp"
+
+struct Bench {
+        avr_t *avr;
+        Profiler *profiler;
+        Schedule *schedule;
+        SpiBus spi;
+        std::map<std::string, Stats> loops;
+        std::map<std::string, uint64_t> counters;
+        std::function<void()> collect;          /* Fill counters at the end */
+};
+
+struct Board {
+        const char *name;
+        const char *mcu;
+        uint32_t f_cpu;
+        double duration;                        /* s */
+        void (*setup)(Bench &b);
+};
+
+/* Opcodes of the main loop markers */
+constexpr uint16_t op_wdr = 0x95a8, op_sleep = 0x9588;
+
+static void set_adc(avr_t *avr, int channel, uint32_t mv)
+{
+        avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), mv);
+}
+
+/*
+ * Base station: boot, a pc-link sync, an outdoor packet and the encoder
+ * rotated through all screens. Main loop passes end with wdr.
+ */
+static void setup_base(Bench &b)
+{
+        static const uint8_t pc_link_addr[] = {0xe7, 0x4f, 0xec, 0xe8, 0x37};
+        static const uint8_t outdoor_addr[] = {0xc8, 0xb4, 0xe1, 0x65, 0x3b};
+        /* As ScreenX and ScreenY in base.cpp */
+        static const char *const screens_x[] = {
+                "clock", "temperature_outdoor", "temperature_indoor", "humidity", "pressure",
+                "forecast", "radio",
+        };
+        static const char *const screens_y[] = {
+                "current", "change", "minimal", "maximal",
+                "change_week", "minimal_week", "maximal_week",
+                "change_month", "minimal_month", "maximal_month",
+        };
+        constexpr uint8_t nr_x = sizeof(screens_x)/sizeof(*screens_x);
+        constexpr uint8_t nr_y = sizeof(screens_y)/sizeof(*screens_y);
+
+        avr_t *avr = b.avr;
+        auto max = new Max7221Peer(avr, {'B', 1}, 3);
+        auto nrf = new Nrf24Peer(avr, {'D', 7}, {'B', 2}, {'D', 6});
+        auto dht = new Dht22Peer(avr, {'D', 5}, 215, 450);
+        auto bmp = new Bmp085Peer(avr);
+        auto enc = new Encoder(avr, *b.schedule, {'D', 2}, {'D', 3}, {'D', 4});
+        b.spi.connect_spi(avr);
+        b.spi.attach(*max);
+        b.spi.attach(*nrf);
+        set_adc(avr, 0, 500);   /* Ambient light */
+
+        b.schedule->at(2.0, [nrf] {
+                const uint8_t d[] = {12, 0, 0};
+                nrf->receive(pc_link_addr, d, sizeof(d));
+        });
+        b.schedule->at(2.5, [nrf] {
+                const uint8_t d[] = {1, 200, 0, 0, 0xb0, 0xff, 0};    /* -5 °C now */
+                nrf->receive(outdoor_addr, d, sizeof(d));
+        });
+
+        /* Visit every screen, 1.5 s each */
+        static std::string screen = "clock";
+        double t = 4;
+        for (uint8_t x = 1; x <= nr_x; x++) {
+                enc->turn(t, true, false);
+                const std::string sx = screens_x[x % nr_x];
+                b.schedule->at(t + 0.035, [sx] { screen = sx; });
+                t += 1.5;
+                for (uint8_t y = 1; x < nr_x && y <= nr_y; y++) {
+                        enc->turn(t, true, true);
+                        const std::string sy = sx + "/" + screens_y[y % nr_y];
+                        b.schedule->at(t + 0.035, [sy] { screen = sy; });
+                        t += 1.5;
+                }
+        }
+
+        /* Classify main loop passes by the work done */
+        static bool first = true;
+        static uint64_t prev, latches, commands, reads;
+        b.profiler->set_marker(op_wdr, [&b, max, nrf, dht](uint64_t awake) {
+                std::string label;
+                if (first)
+                        label = "boot";
+                else if (dht->reads != reads)
+                        label = "measure_indoor";
+                else if (nrf->commands != commands)
+                        label = "nrf24_receive";
+                else if (max->latches != latches)
+                        label = "refresh/" + screen;
+                else
+                        label = "idle";
+                b.loops[label].add(awake - prev);
+
+                first = false;
+                prev = awake;
+                latches = max->latches;
+                commands = nrf->commands;
+                reads = dht->reads;
+        });
+
+        b.collect = [&b, max, nrf, dht, bmp] {
+                b.counters["spi_bytes"] = b.spi.bytes;
+                b.counters["max7221_latches"] = max->latches;
+                b.counters["nrf24_received"] = nrf->model.received;
+                b.counters["dht22_reads"] = dht->reads;
+                b.counters["bmp085_conversions"] = bmp->conversions;
+        };
+}
+
+/*
+ * Outdoor node: wakes up by the watchdog, measures and transmits. Main loop
+ * passes end with sleep, only the awake cycles are counted.
+ */
+static void setup_outdoor(Bench &b)
+{
+        /* USI data space addresses of ATtiny84 */
+        constexpr uint16_t usicr = 0x2d, usisr = 0x2e, usidr = 0x2f, usibr = 0x30;
+
+        avr_t *avr = b.avr;
+        auto nrf = new Nrf24Peer(avr, {'B', 2}, {'B', 0}, {'A', 7});
+        auto max = new Max31723Peer(avr, {'A', 1}, -5);
+        b.spi.connect_usi(avr, usicr, usisr, usidr, usibr);
+        b.spi.attach(*nrf);
+        b.spi.attach(*max);
+        set_adc(avr, 2, 3000);  /* Battery */
+
+        static bool first = true;
+        static uint64_t prev;
+        static unsigned transmitted;
+        b.profiler->set_marker(op_sleep, [&b, nrf](uint64_t awake) {
+                const char *label = first ? "boot" :
+                        nrf->model.transmitted != transmitted ? "wake/transmit" : "wake";
+                b.loops[label].add(awake - prev);
+                first = false;
+                prev = awake;
+                transmitted = nrf->model.transmitted;
+        });
+
+        b.collect = [&b, nrf] {
+                b.counters["spi_bytes"] = b.spi.bytes;
+                b.counters["nrf24_transmitted"] = nrf->model.transmitted;
+        };
+}
+
+/*
+ * pc-link: sync packets from the host. There is no main loop marker, the
+ * latency is measured from the last byte of a packet to the ack and to the
+ * packet on air.
+ */
+static void setup_pc_link(Bench &b)
+{
+        avr_t *avr = b.avr;
+        auto nrf = new Nrf24Peer(avr, {'B', 2}, {'B', 1}, {'B', 0});
+        b.spi.connect_spi(avr);
+        b.spi.attach(*nrf);
+
+        uint32_t flags = 0;
+        avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+        flags &= ~AVR_UART_FLAG_STDIO;
+        avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+        static uint64_t sent;
+        avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+                [](avr_irq_t *, uint32_t, void *param) {
+                        auto bench = static_cast<Bench *>(param);
+                        bench->loops["packet_to_ack"].add(bench->avr->cycle - sent);
+                }, &b);
+        nrf->model.on_transmit([&b](const uint8_t *, const std::vector<uint8_t> &) {
+                b.loops["packet_to_air"].add(b.avr->cycle - sent);
+        });
+
+        /* Bytes at 9600 baud */
+        avr_irq_t *rx = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+        auto packet = [&b, rx](double t, uint8_t h, uint8_t m, uint8_t s, bool good) {
+                const uint8_t cks = ~(h^m^s) ^ (good ? 0 : 1);
+                const uint8_t d[] = {0xaa, h, m, s, cks};
+                for (size_t i = 0; i < sizeof(d); i++) {
+                        const uint8_t byte = d[i];
+                        const bool last = i == sizeof(d) - 1;
+                        b.schedule->at(t + i*10/9600.0, [&b, rx, byte, last] {
+                                avr_raise_irq(rx, byte);
+                                if (last)
+                                        sent = b.avr->cycle;
+                        });
+                }
+        };
+        packet(0.1, 12, 0, 0, true);
+        packet(0.6, 12, 0, 1, false);
+        packet(1.0, 12, 0, 2, true);
+
+        b.collect = [&b, nrf] {
+                b.counters["spi_bytes"] = b.spi.bytes;
+                b.counters["nrf24_transmitted"] = nrf->model.transmitted;
+        };
+}
+
+static const Board boards[] = {
+        {"base",        "atmega328p",   8000000, 110,   setup_base},
+        {"outdoor",     "attiny84",     1000000, 20,    setup_outdoor},
+        {"pc-link",     "atmega8",      1000000, 2,     setup_pc_link},
+};
+
+static void write_stats(FILE *f, const char *name, const std::map<std::string, Stats> &m, bool last)
+{
+        fprintf(f, "  \"%s\": {", name);
+        const char *sep = "\n";
+        for (const auto &s : m) {
+                fprintf(f, "%s    \"", sep);
+                for (const char *c = s.first.c_str(); *c; c++) {
+                        if (*c == '"' || *c == '\\')
+                                fputc('\\', f);
+                        fputc(*c, f);
+                }
+                fprintf(f, "\": ");
+                s.second.write_json(f);
+                sep = ",\n";
+        }
+        fprintf(f, "\n  }%s\n", last ? "" : ",");
+}
+
+static void write_json(FILE *f, const Board &board, const char *elf, const Bench &b)
+{
+        fprintf(f, "{\n");
+        fprintf(f, "  \"board\": \"%s\",\n", board.name);
+        fprintf(f, "  \"mcu\": \"%s\",\n", board.mcu);
+        fprintf(f, "  \"f_cpu\": %lu,\n", (unsigned long)board.f_cpu);
+        fprintf(f, "  \"elf\": \"%s\",\n", elf);
+        fprintf(f, "  \"cycles\": %llu,\n", (unsigned long long)b.avr->cycle);
+        fprintf(f, "  \"awake_cycles\": %llu,\n", (unsigned long long)b.profiler->awake());
+        fprintf(f, "  \"interrupts_disabled\": ");
+        b.profiler->irq_off().write_json(f);
+        fprintf(f, ",\n  \"interrupts_disabled_worst_at\": \"%s\",\n", b.profiler->irq_off_where().c_str());
+        fprintf(f, "  \"counters\": {");
+        const char *sep = "\n";
+        for (const auto &c : b.counters) {
+                fprintf(f, "%s    \"%s\": %llu", sep, c.first.c_str(), (unsigned long long)c.second);
+                sep = ",\n";
+        }
+        fprintf(f, "\n  },\n");
+        write_stats(f, "isr", b.profiler->isrs(), false);
+        write_stats(f, "loops", b.loops, false);
+        write_stats(f, "functions", b.profiler->functions(), true);
+        fprintf(f, "}\n");
+}
+
+static void print_stats(const char *title, const std::map<std::string, Stats> &m, uint32_t f_cpu)
+{
+        printf("%-40s %8s %10s %10s %10s\n", title, "count", "min", "mean", "max");
+        for (const auto &s : m)
+                printf("  %-38s %8llu %10llu %10llu %10llu  (%.0f us max)\n",
+                        s.first.c_str(),
+                        (unsigned long long)s.second.count,
+                        (unsigned long long)s.second.min,
+                        (unsigned long long)(s.second.total/s.second.count),
+                        (unsigned long long)s.second.max,
+                        s.second.max*1e6/f_cpu);
+}
+
+static void usage()
+{
+        fprintf(stderr,
+                "Usage: bench-sim [options] <board> <elf>\n"
+                "Boards: base, outdoor, pc-link\n"
+                "  -t <seconds>  Scenario duration (default per board)\n"
+                "  -o <file>     JSON output (default stdout)\n"
+                "  -q            No summary\n");
+}
+
+int main(int argc, char *argv[])
+{
+        double duration = 0;
+        const char *out_file = nullptr;
+        bool quiet = false;
+
+        int opt;
+        while ((opt = getopt(argc, argv, "t:o:qh")) != -1) {
+                switch (opt) {
+                case 't':
+                        duration = atof(optarg);
+                        break;
+                case 'o':
+                        out_file = optarg;
+                        break;
+                case 'q':
+                        quiet = true;
+                        break;
+                default:
+                        usage();
+                        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+                }
+        }
+        if (argc - optind != 2) {
+                usage();
+                return EXIT_FAILURE;
+        }
+
+        const char *board_name = argv[optind], *elf = argv[optind+1];
+        const Board *board = nullptr;
+        for (const auto &bd : boards)
+                if (strcmp(bd.name, board_name) == 0)
+                        board = &bd;
+        if (!board) {
+                fprintf(stderr, "bench-sim: unknown board %s\n", board_name);
+                return EXIT_FAILURE;
+        }
+        if (duration <= 0)
+                duration = board->duration;
+
+        /* The firmware has no .mmcu section, the board tells the MCU */
+        elf_firmware_t fw;
+        memset(&fw, 0, sizeof(fw));
+        if (elf_read_firmware(elf, &fw) != 0) {
+                fprintf(stderr, "bench-sim: can't read %s\n", elf);
+                return EXIT_FAILURE;
+        }
+        strcpy(fw.mmcu, board->mcu);
+        fw.frequency = board->f_cpu;
+
+        avr_t *avr = avr_make_mcu_by_name(fw.mmcu);
+        if (!avr) {
+                fprintf(stderr, "bench-sim: %s is not supported by simavr\n", fw.mmcu);
+                return EXIT_FAILURE;
+        }
+        avr_init(avr);
+        avr_load_firmware(avr, &fw);
+        avr->frequency = board->f_cpu;
+        avr->vcc = avr->avcc = avr->aref = 3300;
+        avr->log = LOG_WARNING;
+
+        Bench b;
+        b.avr = avr;
+        b.profiler = new Profiler(avr, elf, board->mcu);
+        b.schedule = new Schedule(avr);
+        board->setup(b);
+
+        const uint64_t end = duration*board->f_cpu;
+        while (avr->cycle < end) {
+                const int state = avr_run(avr);
+                if (state == cpu_Done || state == cpu_Crashed) {
+                        fprintf(stderr, "bench-sim: the firmware stopped at %#x\n", avr->pc);
+                        return EXIT_FAILURE;
+                }
+                b.profiler->step();
+        }
+        if (b.collect)
+                b.collect();
+
+        FILE *f = out_file ? fopen(out_file, "w") : stdout;
+        if (!f) {
+                perror(out_file);
+                return EXIT_FAILURE;
+        }
+        write_json(f, *board, elf, b);
+        if (out_file)
+                fclose(f);
+
+        if (!quiet && out_file) {
+                printf("%s (%s, %.0f s): %.1f %% awake, interrupts disabled up to %llu cycles in %s\n",
+                        board->name, board->mcu, duration,
+                        100.0*b.profiler->awake()/avr->cycle,
+                        (unsigned long long)b.profiler->irq_off().max,
+                        b.profiler->irq_off_where().c_str());
+                print_stats("ISR", b.profiler->isrs(), board->f_cpu);
+                print_stats("Main loop", b.loops, board->f_cpu);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,387 @@
+#include <string.h>
+#include <avr_ioport.h>
+#include <avr_spi.h>
+#include <avr_twi.h>
+#include <sim_io.h>
+#include <sim_cycle_timers.h>
+#include "peers.hpp"
+#include "nrf24.hpp"
+
+avr_irq_t *pin_irq(avr_t *avr, Pin pin)
+{
+        return avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(pin.port), pin.bit);
+}
+
+struct Watch {
+        std::function<void(bool)> f;
+        bool level;
+};
+
+static void watch_notify(avr_irq_t *, uint32_t value, void *param)
+{
+        auto w = static_cast<Watch *>(param);
+        if (!!value != w->level) {
+                w->level = value;
+                w->f(value);
+        }
+}
+
+void watch(avr_t *avr, Pin pin, std::function<void(bool)> f)
+{
+        /* Pins are pulled up at reset */
+        avr_irq_register_notify(pin_irq(avr, pin), watch_notify, new Watch {f, true});
+}
+
+void drive(avr_t *avr, Pin pin, bool level)
+{
+        avr_raise_irq(pin_irq(avr, pin), level);
+}
+
+/*
+ * Schedule
+ */
+
+Schedule::Schedule(avr_t *avr_): avr(avr_)
+{
+        avr_cycle_timer_register_usec(avr, 100, tick, this);
+}
+
+void Schedule::at(double seconds, std::function<void()> f)
+{
+        const uint64_t cycle = seconds*avr->frequency;
+        auto i = actions.begin();
+        while (i != actions.end() && i->cycle <= cycle)
+                ++i;
+        actions.insert(i, Action {cycle, f});
+}
+
+avr_cycle_count_t Schedule::tick(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+        auto s = static_cast<Schedule *>(param);
+        while (!s->actions.empty() && s->actions.front().cycle <= when) {
+                auto f = s->actions.front().f;
+                s->actions.pop_front();
+                f();
+        }
+        return when + avr_usec_to_cycles(avr, 100);
+}
+
+/*
+ * SPI
+ */
+
+uint8_t SpiBus::transfer(uint8_t out)
+{
+        uint8_t in = 0xff;      /* MISO is pulled up */
+        for (auto d : devices)
+                if (d->selected)
+                        in &= d->transfer(out);
+        bytes++;
+        return in;
+}
+
+void SpiBus::spi_out(avr_irq_t *, uint32_t value, void *param)
+{
+        auto bus = static_cast<SpiBus *>(param);
+        avr_raise_irq(bus->spi_in, bus->transfer(value));
+}
+
+void SpiBus::connect_spi(avr_t *avr)
+{
+        spi_in = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+        avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT),
+                spi_out, this);
+}
+
+/* USISR */
+constexpr uint8_t usioif = 1<<6, usi_flags = 0xe0, usi_counter = 0x0f;
+
+void SpiBus::usicr_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+        auto bus = static_cast<SpiBus *>(param);
+        avr->data[addr] = v & ~1;       /* USITC reads as zero */
+        if ((v & 1) == 0)
+                return;
+
+        /* Every strobe is a clock edge: 16 of them shift one byte */
+        uint8_t &sr = avr->data[bus->usisr];
+        const uint8_t cnt = (sr + 1) & usi_counter;
+        if (cnt == 1)
+                bus->usi_in = bus->transfer(avr->data[bus->usidr]);
+        if (cnt == 0) {
+                avr->data[bus->usidr] = avr->data[bus->usibr] = bus->usi_in;
+                sr |= usioif;
+        }
+        sr = (sr & usi_flags) | cnt;
+}
+
+void SpiBus::usisr_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *)
+{
+        /* Flags are cleared by writing one */
+        avr->data[addr] = (avr->data[addr] & usi_flags & ~v) | (v & usi_counter);
+}
+
+void SpiBus::connect_usi(avr_t *avr, uint16_t usicr, uint16_t usisr_, uint16_t usidr_, uint16_t usibr_)
+{
+        usisr = usisr_;
+        usidr = usidr_;
+        usibr = usibr_;
+        avr_register_io_write(avr, usicr, usicr_write, this);
+        avr_register_io_write(avr, usisr, usisr_write, this);
+}
+
+void wire_select(avr_t *avr, SpiDevice &dev, Pin pin, bool active_level)
+{
+        watch(avr, pin, [&dev, active_level](bool level) {
+                dev.selected = level == active_level;
+                dev.select(dev.selected);
+        });
+}
+
+/*
+ * NRF24L01+
+ */
+
+Nrf24Peer::Nrf24Peer(avr_t *avr_, Pin csn, Pin ce, Pin irq_): avr(avr_), irq(irq_)
+{
+        wire_select(avr, *this, csn, 0);
+        watch(avr, ce, [this](bool level) {
+                model.set_ce(level);
+                update_irq();
+        });
+        update_irq();
+}
+
+void Nrf24Peer::select(bool active)
+{
+        if (active)
+                model.select();
+        else {
+                model.deselect();
+                commands++;
+                update_irq();
+        }
+}
+
+uint8_t Nrf24Peer::transfer(uint8_t in)
+{
+        return model.transfer(in);
+}
+
+bool Nrf24Peer::receive(const uint8_t *addr, const uint8_t *data, size_t len)
+{
+        const bool ok = model.receive(addr, data, len);
+        update_irq();
+        return ok;
+}
+
+void Nrf24Peer::update_irq()
+{
+        drive(avr, irq, model.irq_pin());
+}
+
+/*
+ * MAX7221 chain
+ */
+
+Max7221Peer::Max7221Peer(avr_t *avr, Pin load, size_t nr_chips): model(nr_chips)
+{
+        wire_select(avr, *this, load, 0);
+}
+
+void Max7221Peer::select(bool active)
+{
+        if (active)
+                model.select();
+        else {
+                model.latch();
+                latches++;
+        }
+}
+
+uint8_t Max7221Peer::transfer(uint8_t in)
+{
+        model.transfer(in);
+        return 0xff;    /* DOUT is not connected back */
+}
+
+/*
+ * MAX31723
+ */
+
+Max31723Peer::Max31723Peer(avr_t *avr, Pin ce, int8_t temperature): addr(0), first(true)
+{
+        memset(regs, 0, sizeof(regs));
+        regs[2] = temperature;
+        wire_select(avr, *this, ce, 1);
+}
+
+void Max31723Peer::select(bool active)
+{
+        if (active)
+                first = true;
+}
+
+uint8_t Max31723Peer::transfer(uint8_t in)
+{
+        if (first) {
+                addr = in;
+                first = false;
+                return 0xff;
+        }
+
+        const uint8_t r = (addr & 0x7f) % sizeof(regs);
+        uint8_t out = regs[r];
+        if (addr & 0x80)
+                regs[r] = in & ~(1<<4);         /* One-shot conversion is instant */
+        addr = (addr & 0x80) | ((r + 1) % sizeof(regs));
+        return out;
+}
+
+/*
+ * DHT22
+ */
+
+Dht22Peer::Dht22Peer(avr_t *avr_, Pin data_, int16_t temperature, uint16_t humidity):
+        avr(avr_), data(data_), pulled(false), pulled_at(0), pos(0)
+{
+        const uint16_t t = (temperature < 0) ? (-temperature | 0x8000) : temperature;
+        frame[0] = humidity >> 8;
+        frame[1] = humidity;
+        frame[2] = t >> 8;
+        frame[3] = t;
+        frame[4] = frame[0] + frame[1] + frame[2] + frame[3];
+
+        /* Response: 80 us low, 80 us high, 40 bits, release */
+        wave.push_back({30, 0});
+        wave.push_back({80, 1});
+        wave.push_back({80, 0});
+        for (uint8_t i = 0; i < 40; i++) {
+                const bool bit = frame[i/8] & (0x80 >> i%8);
+                wave.push_back({50, 1});
+                wave.push_back({bit ? 70u : 26u, 0});
+        }
+        wave.push_back({50, 1});
+
+        /* START is the line held low by the MCU for at least 1 ms */
+        avr_irq_register_notify(
+                avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(data.port), IOPORT_IRQ_DIRECTION_ALL),
+                [](avr_irq_t *, uint32_t ddr, void *param) {
+                        auto p = static_cast<Dht22Peer *>(param);
+                        const bool out = ddr & 1 << p->data.bit;
+                        if (out && !p->pulled) {
+                                p->pulled = true;
+                                p->pulled_at = p->avr->cycle;
+                        } else if (!out && p->pulled) {
+                                p->pulled = false;
+                                if (p->avr->cycle - p->pulled_at >= avr_usec_to_cycles(p->avr, 1000)) {
+                                        p->reads++;
+                                        p->pos = 0;
+                                        avr_cycle_timer_register_usec(p->avr, p->wave[0].first, edge, p);
+                                }
+                        }
+                }, this);
+}
+
+avr_cycle_count_t Dht22Peer::edge(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+        auto p = static_cast<Dht22Peer *>(param);
+        drive(avr, p->data, p->wave[p->pos].second);
+        if (++p->pos == p->wave.size())
+                return 0;
+        return when + avr_usec_to_cycles(avr, p->wave[p->pos].first);
+}
+
+/*
+ * BMP085
+ */
+
+Bmp085Peer::Bmp085Peer(avr_t *avr_):
+        avr(avr_), ptr(0), selected(false), reading(false), first(false)
+{
+        static const int16_t cal[] = {
+                408, -72, -14383, (int16_t)32741, (int16_t)32757, 23153,
+                6190, 4, -32768, -8711, 2868,
+        };
+
+        memset(regs, 0, sizeof(regs));
+        for (size_t i = 0; i < sizeof(cal)/sizeof(cal[0]); i++) {
+                regs[0xaa + 2*i] = static_cast<uint16_t>(cal[i]) >> 8;
+                regs[0xab + 2*i] = cal[i];
+        }
+
+        twi_in = avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+        avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+                twi_out, this);
+}
+
+void Bmp085Peer::twi_out(avr_irq_t *, uint32_t value, void *param)
+{
+        auto p = static_cast<Bmp085Peer *>(param);
+        avr_twi_msg_irq_t v;
+        v.u.v = value;
+
+        constexpr uint8_t i2c_addr = 0x77;
+
+        if (v.u.twi.msg & TWI_COND_STOP)
+                p->selected = false;
+
+        if (v.u.twi.msg & TWI_COND_START) {
+                p->selected = (v.u.twi.addr >> 1) == i2c_addr;
+                p->reading = v.u.twi.addr & 1;
+                p->first = true;
+                if (p->selected)
+                        avr_raise_irq(p->twi_in, avr_twi_irq_msg(TWI_COND_ACK, v.u.twi.addr, 1));
+        }
+
+        if (!p->selected)
+                return;
+
+        if (v.u.twi.msg & TWI_COND_WRITE) {
+                avr_raise_irq(p->twi_in, avr_twi_irq_msg(TWI_COND_ACK, v.u.twi.addr, 1));
+                if (p->first) {
+                        p->ptr = v.u.twi.data;
+                        p->first = false;
+                } else {
+                        p->regs[p->ptr] = v.u.twi.data;
+                        if (p->ptr == 0xf4) {
+                                /* 15.0 °C, 699.64 hPa with oss = 3 */
+                                const uint32_t raw = (v.u.twi.data == 0x2e) ?
+                                        27898ul << 8 : (23843ul << 3) << 5;
+                                p->regs[0xf6] = raw >> 16;
+                                p->regs[0xf7] = raw >> 8;
+                                p->regs[0xf8] = raw;
+                                p->conversions++;
+                        }
+                        p->ptr++;
+                }
+        }
+
+        if (v.u.twi.msg & TWI_COND_READ)
+                avr_raise_irq(p->twi_in, avr_twi_irq_msg(TWI_COND_READ, v.u.twi.addr, p->regs[p->ptr++]));
+}
+
+/*
+ * Rotary encoder
+ */
+
+Encoder::Encoder(avr_t *avr_, Schedule &s, Pin a_, Pin b_, Pin button_):
+        avr(avr_), schedule(s), a(a_), b(b_), button(button_)
+{
+        drive(avr, a, 1);
+        drive(avr, b, 1);
+        drive(avr, button, 1);
+}
+
+void Encoder::turn(double at, bool right, bool pressed)
+{
+        /* A quadrature cycle, B leads A for the right direction */
+        auto avr_ = avr;
+        const Pin first = right ? b : a, second = right ? a : b, pbutton = button;
+        schedule.at(at, [=] { drive(avr_, pbutton, !pressed); });
+        schedule.at(at + 0.005, [=] { drive(avr_, first, 0); });
+        schedule.at(at + 0.015, [=] { drive(avr_, second, 0); });
+        schedule.at(at + 0.025, [=] { drive(avr_, first, 1); });
+        schedule.at(at + 0.035, [=] { drive(avr_, second, 1); });
+        schedule.at(at + 0.050, [=] { drive(avr_, pbutton, 1); });
+}
@@ -0,0 +1,167 @@
+/*
+ * Peripherals around the MCU, at the register and pin level of simavr
+ *
+ * SPI devices sit on a bus which is connected to the hardware SPI module or
+ * emulated USI (simavr has no USI). The NRF24L01+ and MAX7221 models are
+ * shared with the host simulator of the base station (base/sim).
+ */
+
+#ifndef PEERS_HPP_
+#define PEERS_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <sim_avr.h>
+#include <sim_irq.h>
+#include "nrf24-model.hpp"
+#include "max7221-model.hpp"
+
+/* MCU pin, e.g. {'B', 1} */
+struct Pin {
+        char port;
+        uint8_t bit;
+};
+
+avr_irq_t *pin_irq(avr_t *avr, Pin pin);
+
+/* Call f on every change of an output pin */
+void watch(avr_t *avr, Pin pin, std::function<void(bool)> f);
+
+/* Drive an input pin from outside */
+void drive(avr_t *avr, Pin pin, bool level);
+
+/* Actions at virtual time, checked every 100 us */
+class Schedule {
+public:
+        explicit Schedule(avr_t *avr);
+        void at(double seconds, std::function<void()> f);
+private:
+        struct Action {
+                uint64_t cycle;
+                std::function<void()> f;
+        };
+
+        avr_t *avr;
+        std::deque<Action> actions;     /* Sorted by time */
+
+        static avr_cycle_count_t tick(avr_t *avr, avr_cycle_count_t when, void *param);
+};
+
+class SpiDevice {
+public:
+        virtual ~SpiDevice() {}
+        virtual void select(bool active) = 0;
+        virtual uint8_t transfer(uint8_t in) = 0;
+        bool selected = false;
+};
+
+class SpiBus {
+public:
+        void attach(SpiDevice &dev) { devices.push_back(&dev); }
+        uint8_t transfer(uint8_t out);
+
+        /* Hardware SPI module */
+        void connect_spi(avr_t *avr);
+
+        /* USI in the three-wire mode, clocked by software strobes (USITC) */
+        void connect_usi(avr_t *avr, uint16_t usicr, uint16_t usisr, uint16_t usidr, uint16_t usibr);
+
+        unsigned bytes = 0;
+private:
+        std::vector<SpiDevice *> devices;
+        avr_irq_t *spi_in = nullptr;
+        uint16_t usisr = 0, usidr = 0, usibr = 0;
+        uint8_t usi_in = 0xff;
+
+        static void spi_out(avr_irq_t *irq, uint32_t value, void *param);
+        static void usicr_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param);
+        static void usisr_write(avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param);
+};
+
+/* Chip select wiring of a device */
+void wire_select(avr_t *avr, SpiDevice &dev, Pin pin, bool active_level);
+
+class Nrf24Peer: public SpiDevice {
+public:
+        Nrf24Peer(avr_t *avr, Pin csn, Pin ce, Pin irq);
+        void select(bool active) override;
+        uint8_t transfer(uint8_t in) override;
+
+        /* A packet on air for the MCU */
+        bool receive(const uint8_t *addr, const uint8_t *data, size_t len);
+
+        Nrf24Model model;
+        unsigned commands = 0;
+private:
+        avr_t *avr;
+        Pin irq;
+        void update_irq();
+};
+
+class Max7221Peer: public SpiDevice {
+public:
+        Max7221Peer(avr_t *avr, Pin load, size_t nr_chips);
+        void select(bool active) override;
+        uint8_t transfer(uint8_t in) override;
+
+        Max7221Model model;
+        unsigned latches = 0;
+};
+
+class Max31723Peer: public SpiDevice {
+public:
+        Max31723Peer(avr_t *avr, Pin ce, int8_t temperature);
+        void select(bool active) override;
+        uint8_t transfer(uint8_t in) override;
+private:
+        uint8_t regs[7];
+        uint8_t addr;
+        bool first;
+};
+
+/* DHT22 on a single-wire data line with a pull-up */
+class Dht22Peer {
+public:
+        Dht22Peer(avr_t *avr, Pin data, int16_t temperature, uint16_t humidity);
+        unsigned reads = 0;
+private:
+        avr_t *avr;
+        Pin data;
+        uint8_t frame[5];
+        bool pulled;
+        uint64_t pulled_at;
+        std::vector<std::pair<uint32_t, bool>> wave;    /* (us, level) */
+        size_t pos;
+
+        static avr_cycle_count_t edge(avr_t *avr, avr_cycle_count_t when, void *param);
+};
+
+/* BMP085 on the TWI bus (the datasheet calibration example) */
+class Bmp085Peer {
+public:
+        explicit Bmp085Peer(avr_t *avr);
+        unsigned conversions = 0;
+private:
+        avr_t *avr;
+        avr_irq_t *twi_in;
+        uint8_t regs[256];
+        uint8_t ptr;
+        bool selected, reading, first;
+
+        static void twi_out(avr_irq_t *irq, uint32_t value, void *param);
+};
+
+/* Quadrature rotary encoder with a button, one detent per call */
+class Encoder {
+public:
+        Encoder(avr_t *avr, Schedule &s, Pin a, Pin b, Pin button);
+        void turn(double at, bool right, bool pressed);
+private:
+        avr_t *avr;
+        Schedule &schedule;
+        Pin a, b, button;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "profile.hpp"
+
+/* Vector names as in avr-libc, by MCU */
+struct VectorNames {
+        const char *mcu;
+        std::vector<const char *> names;        /* From vector 1 */
+};
+
+static const VectorNames vector_names[] = {
+        {"atmega328p", {
+                "INT0_vect", "INT1_vect", "PCINT0_vect", "PCINT1_vect", "PCINT2_vect",
+                "WDT_vect", "TIMER2_COMPA_vect", "TIMER2_COMPB_vect", "TIMER2_OVF_vect",
+                "TIMER1_CAPT_vect", "TIMER1_COMPA_vect", "TIMER1_COMPB_vect",
+                "TIMER1_OVF_vect", "TIMER0_COMPA_vect", "TIMER0_COMPB_vect",
+                "TIMER0_OVF_vect", "SPI_STC_vect", "USART_RX_vect", "USART_UDRE_vect",
+                "USART_TX_vect", "ADC_vect", "EE_READY_vect", "ANALOG_COMP_vect",
+                "TWI_vect", "SPM_READY_vect",
+        }},
+        {"attiny84", {
+                "INT0_vect", "PCINT0_vect", "PCINT1_vect", "WATCHDOG_vect",
+                "TIM1_CAPT_vect", "TIM1_COMPA_vect", "TIM1_COMPB_vect", "TIM1_OVF_vect",
+                "TIM0_COMPA_vect", "TIM0_COMPB_vect", "TIM0_OVF_vect", "ANA_COMP_vect",
+                "ADC_vect", "EE_RDY_vect", "USI_STR_vect", "USI_OVF_vect",
+        }},
+        {"atmega8", {
+                "INT0_vect", "INT1_vect", "TIMER2_COMP_vect", "TIMER2_OVF_vect",
+                "TIMER1_CAPT_vect", "TIMER1_COMPA_vect", "TIMER1_COMPB_vect",
+                "TIMER1_OVF_vect", "TIMER0_OVF_vect", "SPI_STC_vect", "USART_RXC_vect",
+                "USART_UDRE_vect", "USART_TXC_vect", "ADC_vect", "EE_RDY_vect",
+                "ANA_COMP_vect", "TWI_vect", "SPM_RDY_vect",
+        }},
+};
+
+static std::string vector_name(const char *mcu, const std::string &sym)
+{
+        const unsigned n = atoi(sym.c_str() + strlen("__vector_"));
+        for (const auto &v : vector_names)
+                if (strcmp(v.mcu, mcu) == 0 && n >= 1 && n <= v.names.size())
+                        return v.names[n-1];
+        return sym;
+}
+
+void Stats::add(uint64_t cycles)
+{
+        count++;
+        total += cycles;
+        min = std::min(min, cycles);
+        max = std::max(max, cycles);
+}
+
+void Stats::write_json(FILE *f) const
+{
+        fprintf(f, "{\"count\": %llu, \"min\": %llu, \"max\": %llu, \"mean\": %llu, \"total\": %llu}",
+                (unsigned long long)count,
+                (unsigned long long)(count ? min : 0),
+                (unsigned long long)max,
+                (unsigned long long)(count ? total/count : 0),
+                (unsigned long long)total);
+}
+
+Profiler::Profiler(avr_t *avr_, const char *elf, const char *mcu):
+        avr(avr_), vectors_end(0), marker_opcode(0),
+        prev_cycle(avr_->cycle), prev_pc(avr_->pc), prev_running(avr_->state == cpu_Running), awake_cycles(0),
+        irq_armed(false), irq_enabled(false), irq_where_pending(false), irq_off_start(0)
+{
+        read_symbols(elf, mcu);
+}
+
+void Profiler::read_symbols(const char *elf, const char *mcu)
+{
+        const char *nm = getenv("NM") ? getenv("NM") : "avr-nm";
+        const std::string cmd = std::string(nm) + " -C -S --defined-only '" + elf + "'";
+
+        FILE *p = popen(cmd.c_str(), "r");
+        if (!p) {
+                perror(nm);
+                exit(EXIT_FAILURE);
+        }
+
+        /* "addr size type name" or "addr type name" */
+        char line[512];
+        while (fgets(line, sizeof(line), p)) {
+                line[strcspn(line, "\n")] = '\0';
+
+                char *end;
+                const uint32_t addr = strtoul(line, &end, 16);
+                uint32_t size = 0;
+                char type;
+                const char *name;
+                if (end[0] == ' ' && end[1] && end[2] == ' ') {
+                        type = end[1];
+                        name = end + 3;
+                } else {
+                        size = strtoul(end, &end, 16);
+                        if (end[0] != ' ' || !end[1] || end[2] != ' ')
+                                continue;
+                        type = end[1];
+                        name = end + 3;
+                }
+
+                if (type != 'T' && type != 't')
+                        continue;
+                if (strcmp(name, "__ctors_end") == 0)
+                        vectors_end = addr;
+                if (size == 0 || strcmp(name, "main") == 0)
+                        continue;
+
+                const bool isr = strncmp(name, "__vector_", 9) == 0;
+                symbols.push_back(Symbol {addr, size, isr ? vector_name(mcu, name) : name, isr});
+        }
+
+        if (pclose(p) != 0 || symbols.empty()) {
+                fprintf(stderr, "bench-sim: can't read symbols of %s with %s\n", elf, nm);
+                exit(EXIT_FAILURE);
+        }
+
+        std::sort(symbols.begin(), symbols.end(),
+                [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+
+        entries.assign(avr->flashend/2 + 1, -1);
+        for (size_t i = 0; i < symbols.size(); i++)
+                if (symbols[i].addr/2 < entries.size())
+                        entries[symbols[i].addr/2] = i;
+}
+
+const char *Profiler::symbol_at(uint32_t addr) const
+{
+        auto s = std::upper_bound(symbols.begin(), symbols.end(), addr,
+                [](uint32_t a, const Symbol &b) { return a < b.addr; });
+        if (s == symbols.begin())
+                return "?";
+        --s;
+        return (addr < s->addr + s->size) ? s->name.c_str() : "?";
+}
+
+void Profiler::set_marker(uint16_t op, Marker m)
+{
+        marker_opcode = op;
+        marker = m;
+}
+
+uint16_t Profiler::opcode(uint32_t addr) const
+{
+        return (addr + 1 <= avr->flashend) ? avr->flash[addr] | avr->flash[addr+1] << 8 : 0;
+}
+
+void Profiler::call(uint32_t target, uint64_t cycle)
+{
+        const int i = (target/2 < entries.size()) ? entries[target/2] : -1;
+        frames.push_back(Frame {i, cycle, false});
+        if (irq_where_pending && i >= 0) {
+                irq_off_start_where = symbols[i].name;
+                irq_where_pending = false;
+        }
+}
+
+void Profiler::ret(uint64_t cycle)
+{
+        if (frames.empty())
+                return;
+        const Frame &fr = frames.back();
+        if (fr.symbol >= 0) {
+                const Symbol &s = symbols[fr.symbol];
+                (s.isr ? isr_stats : function_stats)[s.name].add(cycle - fr.start);
+        }
+        frames.pop_back();
+}
+
+void Profiler::step()
+{
+        const uint64_t cycle = avr->cycle;
+        const uint32_t pc = avr->pc;
+
+        if (avr->state != cpu_Sleeping)
+                awake_cycles += cycle - prev_cycle;
+
+        /* Calls and returns by the executed instruction (an interrupt may follow it in the same step) */
+        if (prev_running) {
+                const uint16_t op = opcode(prev_pc);
+                if ((op & 0xfe0e) == 0x940e) {                  /* call k */
+                        const uint32_t k = ((op & 0x01f0) >> 3 | (op & 1)) << 16 | opcode(prev_pc + 2);
+                        call(2*k, cycle);
+                } else if ((op & 0xf000) == 0xd000) {           /* rcall k */
+                        const int16_t k = static_cast<int16_t>(op << 4) >> 4;
+                        call((prev_pc + 2 + 2*k) & avr->flashend, cycle);
+                } else if (op == 0x9509 || op == 0x9519) {      /* icall, eicall (no EIND here) */
+                        call(2*(avr->data[30] | avr->data[31] << 8), cycle);
+                } else if (op == 0x9508 || op == 0x9518)        /* ret, reti */
+                        ret(cycle);
+        }
+
+        /* Interrupts: the jump into the vector table, then to the ISR (a reset drops all calls) */
+        if (pc == 0) {
+                frames.clear();
+        } else if (pc < vectors_end && prev_pc >= vectors_end) {
+                frames.push_back(Frame {-1, cycle, true});
+        } else if (!frames.empty() && frames.back().vector && frames.back().symbol < 0 &&
+                        pc/2 < entries.size() && entries[pc/2] >= 0) {
+                frames.back().symbol = entries[pc/2];
+                if (irq_where_pending) {
+                        irq_off_start_where = symbols[entries[pc/2]].name;
+                        irq_where_pending = false;
+                }
+        }
+
+        /* Interrupts disabled */
+        const bool i_bit = avr->sreg[S_I];
+        if (irq_armed && irq_enabled && !i_bit) {
+                irq_off_start = cycle;
+                if (pc < vectors_end) {
+                        irq_off_start_where = "interrupt entry";
+                        irq_where_pending = true;
+                } else
+                        irq_off_start_where = symbol_at(prev_pc);
+        } else if (irq_armed && !irq_enabled && i_bit) {
+                const uint64_t span = cycle - irq_off_start;
+                if (span > irq_off_stats.max)
+                        irq_off_worst_where = irq_off_start_where;
+                irq_off_stats.add(span);
+        }
+        irq_enabled = i_bit;
+        irq_armed |= i_bit;
+
+        /* Main loop marker */
+        if (marker && pc + 1 <= avr->flashend && opcode(pc) == marker_opcode)
+                marker(awake_cycles);
+
+        prev_cycle = cycle;
+        prev_pc = pc;
+        prev_running = (avr->state == cpu_Running);
+}
@@ -0,0 +1,95 @@
+/*
+ * Cycle accounting of a firmware running under simavr
+ *
+ * The profiler is called after every executed instruction, and follows the
+ * instructions: call, rcall and icall start a call of their target, the jump
+ * into the vector table starts an interrupt, ret and reti end the latest one.
+ * Calls are named by the symbol table of the ELF file (avr-nm) when the target
+ * is the first address of a function or an ISR, so only functions that survived
+ * inlining are seen, under their real names. A jump into a function (a tail
+ * call) is counted in its caller.
+ */
+
+#ifndef PROFILE_HPP_
+#define PROFILE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <sim_avr.h>
+
+struct Stats {
+        uint64_t count = 0;
+        uint64_t total = 0;
+        uint64_t min = UINT64_MAX;
+        uint64_t max = 0;
+
+        void add(uint64_t cycles);
+        void write_json(FILE *f) const;
+};
+
+class Profiler {
+public:
+        /* Called when an instruction with the marker opcode is about to run */
+        using Marker = std::function<void(uint64_t awake_cycles)>;
+
+        Profiler(avr_t *avr, const char *elf, const char *mcu);
+
+        /* Main loop iteration marker, e.g. wdr or sleep */
+        void set_marker(uint16_t op, Marker m);
+
+        void step();
+
+        const std::map<std::string, Stats> &isrs() const { return isr_stats; }
+        const std::map<std::string, Stats> &functions() const { return function_stats; }
+
+        /* Interrupts disabled (after the first sei) */
+        const Stats &irq_off() const { return irq_off_stats; }
+        const std::string &irq_off_where() const { return irq_off_worst_where; }
+
+        uint64_t awake() const { return awake_cycles; }
+private:
+        struct Symbol {
+                uint32_t addr;
+                uint32_t size;
+                std::string name;
+                bool isr;
+        };
+
+        struct Frame {
+                int symbol;                     /* -1 is unnamed */
+                uint64_t start;
+                bool vector;                    /* An interrupt, named at its ISR */
+        };
+
+        avr_t *avr;
+        std::vector<Symbol> symbols;            /* Sorted by address */
+        std::vector<int> entries;               /* Symbol by a word address */
+        uint32_t vectors_end;
+        std::vector<Frame> frames;
+        std::map<std::string, Stats> isr_stats, function_stats;
+
+        uint16_t marker_opcode;
+        Marker marker;
+
+        uint64_t prev_cycle;
+        uint32_t prev_pc;
+        bool prev_running;                      /* The instruction at prev_pc is executed in this step */
+        uint64_t awake_cycles;
+
+        bool irq_armed, irq_enabled, irq_where_pending;
+        uint64_t irq_off_start;
+        std::string irq_off_start_where, irq_off_worst_where;
+        Stats irq_off_stats;
+
+        void read_symbols(const char *elf, const char *mcu);
+        const char *symbol_at(uint32_t addr) const;
+        uint16_t opcode(uint32_t addr) const;
+        void call(uint32_t target, uint64_t cycle);
+        void ret(uint64_t cycle);
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * Bootloader of the base station: firmware update over the radio from the
+ * PC through pc-link (`matrix-clock --flash`)
+ *
+ * It lives in the 4 KB boot section (BOOTSZ = 2048 words, BOOTRST). After a
+ * watchdog reset, which is also how the application asks for an update, it
+ * listens at the pc-link address for a while, otherwise it starts the
+ * application at once. An interrupted update is resumed: the image info in
+ * the last page of the application section says the update is pending, and
+ * how far it got.
+ *
+ * Packets from the PC (dynamic length, pipe 0):
+ *   'S' size, CRC (LSB first)     start or resume the update of the image
+ *   'D' offset (LSB first), data  bytes of the image
+ *   'E'                           verify the CRC of the whole image
+ *   'Q'                           nothing, for the acknowledgement
+ *   'R'                           start the application if the image is valid
+ *
+ * Every packet is acknowledged with the payload: state, the next expected
+ * offset (LSB first). It's the state before the packet: the payload is
+ * loaded in advance, so it lags one packet behind. Data at another offset
+ * are dropped, the PC goes back to the expected one.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include "common.hpp"
+#include "delay.hpp"
+#include "shared.hpp"
+#include "gpio.hpp"
+#include "spi-hardware.hpp"
+#include "nrf24.hpp"
+
+/* Peripherals are configured for 8 MHz system clock (the same as in base.cpp) */
+static_assert(F_CPU == 8e6, "");
+
+constexpr Gpio::Pin nrf_csn = Gpio::D7, nrf_ce = Gpio::B2;
+constexpr Gpio::Pin mosi = Gpio::B3, miso = Gpio::B4, sck = Gpio::B5;
+
+/* NRF24 address of pc-link and the home channel (the same as in base.cpp) */
+constexpr uint8_t pc_link_addr[] = {0xe7, 0x4f, 0xec, 0xe8, 0x37};
+constexpr uint8_t home_channel = 2;
+
+/* Flash: the application, its image info in the last page, then the bootloader */
+constexpr uint16_t boot_start = 0x7000;
+constexpr uint16_t info_page = boot_start - SPM_PAGESIZE;
+constexpr uint16_t app_size = info_page;
+constexpr uint16_t checkpoint_interval = 1024;  /* Save the progress (bytes) */
+
+constexpr uint16_t listen_time = 1000;          /* For the update after a watchdog reset (ms) */
+
+enum State: uint8_t {
+        state_idle      = 'I',
+        state_update    = 'U',
+        state_valid     = 'V',
+        state_failed    = 'X',
+};
+
+enum Magic: uint16_t {
+        magic_none      = 0xffff,               /* Erased, the application is flashed by ISP */
+        magic_pending   = 0x5055,
+        magic_valid     = 0x5056,
+};
+
+struct Info {
+        uint16_t magic;
+        uint16_t size;
+        uint16_t crc;                           /* CRC-CCITT of the image */
+        uint16_t done;                          /* Bytes written, a multiple of the page */
+};
+
+static SpiHardware spi {mosi, miso, sck};
+static Nrf24 nrf24 {spi, nrf_csn, nrf_ce};
+
+static State state = state_idle;
+static Info info;
+static uint16_t expected;                       /* Offset of the next data */
+static uint8_t page[SPM_PAGESIZE];
+
+static void write_page(uint16_t addr, const uint8_t *data)
+{
+        boot_page_erase(addr);
+        boot_spm_busy_wait();
+        for (uint8_t i = 0; i < SPM_PAGESIZE; i += 2)
+                boot_page_fill(addr + i, concat16(data[i + 1], data[i]));
+        boot_page_write(addr);
+        boot_spm_busy_wait();
+        boot_rww_enable();
+}
+
+static void save_info()
+{
+        uint8_t d[SPM_PAGESIZE];
+        memcpy_P(d, reinterpret_cast<const void *>(info_page), sizeof(d));
+        memcpy(d, &info, sizeof(info));
+        write_page(info_page, d);
+}
+
+static uint16_t image_crc(uint16_t len)
+{
+        uint16_t crc = 0xffff;
+        for (uint16_t a = 0; a < len; a++)
+                crc = _crc_ccitt_update(crc, pgm_read_byte(a));
+        return crc;
+}
+
+static void start(uint16_t len, uint16_t crc)
+{
+        if (len == 0 || len > app_size) {
+                state = state_failed;
+                return;
+        }
+
+        /* The same image: resume from the last checkpoint */
+        if (!(info.magic == magic_pending && info.size == len && info.crc == crc)) {
+                info = Info {magic_pending, len, crc, 0};
+                save_info();
+        }
+        expected = info.done;
+        state = state_update;
+}
+
+static void data(uint16_t offset, const uint8_t *d, uint8_t len)
+{
+        if (state != state_update || offset != expected || len > info.size - offset)
+                return;
+
+        while (len-- != 0) {
+                page[expected++ % SPM_PAGESIZE] = *d++;
+                if (expected % SPM_PAGESIZE != 0 && expected != info.size)
+                        continue;
+
+                /* A full page, or the last one */
+                write_page((expected - 1) & ~(SPM_PAGESIZE - 1), page);
+                if (expected % checkpoint_interval == 0 && expected != info.size) {
+                        info.done = expected;
+                        save_info();
+                }
+        }
+}
+
+static void verify()
+{
+        if (state != state_update || expected != info.size)
+                return;
+
+        if (image_crc(info.size) == info.crc) {
+                info.magic = magic_valid;
+                info.done = info.size;
+                state = state_valid;
+        } else {
+                info.done = 0;
+                state = state_failed;
+        }
+        save_info();
+}
+
+/* Load the acknowledgement payload for the next packet */
+static void acknowledge()
+{
+        const uint8_t d[] = {state, static_cast<uint8_t>(expected), static_cast<uint8_t>(expected >> 8)};
+        nrf24.write(Nrf24::CMD_FLUSH_TX);
+        nrf24.write(Nrf24::CMD_W_ACK_PAYLOAD, d, size(d));
+}
+
+/* Handle a received packet, return true to start the application */
+static bool receive()
+{
+        uint8_t d[32];
+        const uint8_t len = nrf24.read(Nrf24::CMD_R_RX_PL_WID);
+        if (len == 0 || len > size(d)) {
+                nrf24.write(Nrf24::CMD_FLUSH_RX);
+                return false;
+        }
+        nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, d, len);
+
+        switch (d[0]) {
+        case 'S':
+                if (len == 5)
+                        start(concat16(d[2], d[1]), concat16(d[4], d[3]));
+                break;
+        case 'D':
+                if (len > 3)
+                        data(concat16(d[2], d[1]), d + 3, len - 3);
+                break;
+        case 'E':
+                verify();
+                break;
+        case 'R':
+                if (info.magic != magic_pending)
+                        return true;
+                break;
+        }
+
+        acknowledge();
+        return false;
+}
+
+static void nrf24_setup()
+{
+        /* The receiver at the home channel and 1 Mbit/s, with acknowledgement payloads */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
+                Nrf24::MASK_RX_DR | Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT |
+                Nrf24::EN_CRC | Nrf24::CRC0 | Nrf24::PWR_UP | Nrf24::PRIM_RX);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_CH, home_channel);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP, Nrf24::RF_DR_1Mbps | Nrf24::RF_PWR_0dBm);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DPL | Nrf24::EN_ACK_PAY);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_AW, Nrf24::AW_5_BYTES);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_AA, Nrf24::ENAA_P0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR, Nrf24::ERX_P0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_DYNPD, Nrf24::DPL_P0);
+        static_assert(size(pc_link_addr) == 5, "");
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P0, pc_link_addr, size(pc_link_addr));
+        nrf24.write(Nrf24::CMD_FLUSH_RX);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
+                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT);
+
+        /* Start the receiver */
+        delay_ms(Nrf24::tpd2stby);
+        acknowledge();
+        nrf24.set_ce(1);
+}
+
+int main()
+{
+        /* Reset cause, passed to the application */
+        const uint8_t reset_cause = MCUSR;
+        MCUSR = 0;
+
+        /* Watchdog Timer (4 s), it stays on after a watchdog reset */
+        wdt_reset();
+        WDTCSR = 1<<WDCE | 1<<WDE;
+        WDTCSR = 1<<WDE | 1<<WDP3;
+
+        memcpy_P(&info, reinterpret_cast<const void *>(info_page), sizeof(info));
+        if (info.magic == magic_pending) {
+                state = state_update;
+                expected = info.done;
+        }
+
+        if (state == state_update || (reset_cause & 1<<WDRF)) {
+                /* GPIO init (the same as in base.cpp) */
+                PORTB = 0b00000011;
+                DDRB  = 0b00101110;
+                PORTD = 0b10000011;
+                DDRD  = 0b00000000;
+
+                spi.init();
+                nrf24.init();
+                nrf24_setup();
+
+                /* Until the update is done, or the PC is silent after a watchdog reset */
+                uint16_t silent = 0;
+                while (state == state_update || state == state_failed || silent < listen_time) {
+                        wdt_reset();
+                        if ((nrf24.status() & Nrf24::RX_P_NO) == Nrf24::RX_P_NO) {
+                                delay_ms(1);
+                                if (silent < listen_time)
+                                        silent++;
+                                continue;
+                        }
+                        silent = 0;
+                        if (receive())
+                                break;
+                }
+
+                /* Leave the peripherals as after a reset */
+                nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG, Nrf24::EN_CRC);
+                SPCR = 0;
+                SPSR = 0;
+                PORTB = 0;
+                DDRB = 0;
+                PORTD = 0;
+                DDRD = 0;
+        }
+
+        /* The application reads the reset cause from GPIOR0 */
+        GPIOR0 = reset_cause;
+        reinterpret_cast<void (*)()>(0)();
+
+        return 0;  /* Never be here */
+}
@@ -0,0 +1 @@
+../base/common.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../base/delay.hpp
\ No newline at end of file
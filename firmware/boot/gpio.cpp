@@ -0,0 +1 @@
+../base/gpio.cpp
\ No newline at end of file
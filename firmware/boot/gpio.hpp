@@ -0,0 +1 @@
+../base/gpio.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../base/nrf24.cpp
\ No newline at end of file
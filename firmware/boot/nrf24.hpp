@@ -0,0 +1 @@
+../base/nrf24.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../base/shared.hpp
\ No newline at end of file
@@ -0,0 +1 @@
+../base/spi-hardware.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../base/spi-hardware.hpp
\ No newline at end of file
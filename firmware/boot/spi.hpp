@@ -0,0 +1 @@
+../base/spi.hpp
\ No newline at end of file
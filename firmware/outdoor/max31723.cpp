@@ -1,12 +1,13 @@
 #include "max31723.hpp"
 
-constexpr Spi::Mode spi_mode = {
+constexpr SpiMode spi_mode = {
         .cpol = 0,
         .cpha = 1,
         .msb_first = 1,
+        .clock = SpiMode::clock_for(5000000),
 };
 
-Max31723::Max31723(Spi &spi_, Gpio::Pin ce_):
+Max31723::Max31723(SpiBus &spi_, Gpio::Pin ce_):
         spi(spi_), ce(ce_) {}
 
 void Max31723::init()
@@ -5,12 +5,12 @@
 
 #include <stdint.h>
 #include <stddef.h>
-#include "spi.hpp"
+#include "spi-bus.hpp"
 #include "gpio.hpp"
 
 class Max31723 {
 private:
-        Spi &spi;
+        SpiBus &spi;
         const Gpio::Pin ce;
 public:
         /* Registers */
@@ -35,7 +35,7 @@ public:
                 CONF_STATUS_MEMW        = 1 << 6,
         };
 
-        Max31723(Spi &spi, Gpio::Pin ce);
+        Max31723(SpiBus &spi, Gpio::Pin ce);
         void init();
 
         void write(uint8_t reg, uint8_t data);
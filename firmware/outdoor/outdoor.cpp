@@ -4,8 +4,8 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <avr/wdt.h>
 #include "common.hpp"
-#include "delay.hpp"
 #include "shared.hpp"
 #include "gpio.hpp"
 #include "spi-usi.hpp"
@@ -22,79 +22,295 @@ constexpr Gpio::Pin led = Gpio::A0;
 
 constexpr uint8_t battery_adc_channel = 2;
 
-constexpr uint8_t my_addr[] = {0xc8, 0xb4, 0xe1, 0x65, 0x3b};
+/* Node ID for the base station (1..255, set with 'make NODE_ID=<n>') */
+#ifndef NODE_ID
+#define NODE_ID 1
+#endif
+constexpr uint8_t node_id = NODE_ID;
+static_assert(node_id != 0, "");
+
+/* Nodes are spread over the base pipes 1..5, which differ in the LSB */
+constexpr uint8_t my_addr[] = {static_cast<uint8_t>(0xc8 + (node_id - 1) % 5), 0xb4, 0xe1, 0x65, 0x3b};
+
+/* Retransmits until the base acknowledges, and the delay between them */
+constexpr uint8_t retransmit_count = Nrf24::ARC_3;
+constexpr uint8_t retransmit_delay = Nrf24::ARD_500us;
+
+/*
+ * Radio channel and air rate: nodes power on at the home channel and 1 Mbit/s,
+ * and follow the handover announced by the beacon. After a few packets not
+ * delivered in a row (a missed handover, a reset base), the node hunts for the
+ * base over the channels and rates it may choose (the same as in base.cpp).
+ */
+constexpr uint8_t home_channel = 2;             /* 2402 MHz */
+constexpr uint8_t hunt_first = 1, hunt_last = 82;
+constexpr uint8_t hunt_rates[] = {Nrf24::RF_DR_2Mbps, Nrf24::RF_DR_1Mbps, Nrf24::RF_DR_250kbps};
+constexpr uint8_t hunt_after = 4;               /* Packets not delivered */
+
+/*
+ * Beacon from the base after every packet: the base time in the 256 s cycle
+ * (1/256 s, LSB first), node IDs by slots, the handover (channel, rate and
+ * cycles until the switch, 0 is none), and the batch cycles. The node in the
+ * slot i transmits in the middle of the 32 s from i*32 s of the cycle (the
+ * same as in base.cpp).
+ */
+constexpr uint8_t beacon_addr[] = {0xa5, 0xb4, 0xe1, 0x65, 0x3b};
+constexpr uint8_t beacon_nodes = 5;
+constexpr uint8_t beacon_payload_length = 2 + beacon_nodes + 3 + 1;
+constexpr uint8_t beacon_window = 2;           /* How long to listen for the beacon (1 << n watchdog ticks, 64 ms) */
+constexpr uint16_t slot_length = 32*256;        /* 1/256 s */
+constexpr uint8_t no_slot = UINT8_MAX;
+
+/*
+ * Samples of the temperature (1/16 °C) are taken samples_per_cycle times a
+ * beacon cycle, and sent in one packet once in the batch cycles given by the
+ * beacon (every cycle until the first one), which bounds the latency of the
+ * freshest sample. Packet: node ID, battery level, link statistics, then every
+ * sample as the temperature (LSB first) and its age (4 s), the freshest one last.
+ */
+constexpr uint8_t samples_per_cycle = 2;
+constexpr uint8_t max_batch_cycles = 4;
+constexpr uint8_t batch_size = samples_per_cycle*max_batch_cycles;
+constexpr uint8_t header_length = 4, sample_length = 3;
+static_assert(header_length + batch_size*sample_length <= 32, "");
+constexpr uint8_t conversion_ticks = 13;        /* 12-bit conversion, 200 ms */
+
+/*
+ * Time is slept in watchdog ticks (2K cycles of the 128 kHz oscillator,
+ * 16 ms nominal). The tick length is measured between beacons, as the
+ * oscillator is off by up to 10 % and drifts with temperature.
+ */
+constexpr uint16_t tick_nominal = 16e-3*256*1024;     /* 1/256 s, 6.10 fixed point */
+constexpr uint16_t tick_min = tick_nominal*3/4, tick_max = tick_nominal*5/4;
 
 static SpiUsi spi {usi_do, usi_di, usi_usck};
 static Nrf24 nrf24 {spi, nrf_csn, nrf_ce};
 static Max31723 max31723 {spi, max_ce};
 
+static uint16_t tick = tick_nominal;            /* Watchdog tick (1/256 s, 6.10 fixed point) */
+static uint32_t ticks_slept;                    /* Since the last beacon */
+static uint8_t batch_cycles = 1;                /* Cycles between transmissions */
+static uint32_t clock_ticks;                    /* Since power on */
+
+struct Sample {
+        int16_t temperature;                    /* 1/16 °C */
+        uint32_t time;                          /* Clock ticks */
+};
+
+static Sample samples[batch_size];
+static uint8_t nr_samples;
+
+/* Link statistics for the base: packets lost since the last delivered one, and its retransmits */
+static uint8_t lost;
+static uint8_t retransmits;
+
+/* Radio channel and rate, the announced handover, and packets not delivered since the last hunt */
+static uint8_t channel = home_channel, rate = Nrf24::RF_DR_1Mbps;
+static uint8_t next_channel, next_rate, switch_in;
+static uint8_t misses = hunt_after - 1;         /* Hunt at once after power on */
+
 EMPTY_INTERRUPT(WATCHDOG_vect);  /* Wake up only */
+EMPTY_INTERRUPT(PCINT0_vect);    /* NRF24 interrupt, wake up only */
+
+/* Sleep for the given number of watchdog ticks */
+static void sleep_ticks(uint32_t n);
+
+/*
+ * Sleep until the NRF24 interrupt, at most 1 << p watchdog ticks, return true
+ * if it came. Only the timeout is counted as slept, waking up by the radio is
+ * early enough not to matter for the clock.
+ */
+static bool sleep_radio(uint8_t p)
+{
+        const uint8_t wdp = (p & 8 ? 1<<WDP3 : 0) | (p & 7);
+
+        atomic_block {
+                wdt_reset();
+                WDTCSR = 1<<WDCE | 1<<WDE;
+                WDTCSR = 1<<WDIF | 1<<WDIE | wdp;
+        }
+
+        /* The pin change interrupt wakes up from power-down, check the pin before sleeping */
+        GIFR = 1<<PCIF0;
+        GIMSK = 1<<PCIE0;
+        cli();
+        if (Gpio::read(nrf_irq) != 0) {
+                sleep_enable();
+                sei();
+                sleep_cpu();
+                sleep_disable();
+        }
+        sei();
+        GIMSK = 0;
+
+        if (Gpio::read(nrf_irq) == 0)
+                return true;
+        ticks_slept += 1ul << p;
+        clock_ticks += 1ul << p;
+        return false;
+}
+
+static void nrf24_tune()
+{
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_CH, channel);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP, rate | Nrf24::RF_PWR_0dBm);
+}
 
 static void nrf24_setup()
 {
-        /* 3-byte address, 2402 MHz, 1 Mbit/s */
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR, Nrf24::ERX_P0);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP,
-                Nrf24::RF_DR_1Mbps | Nrf24::RF_PWR_0dBm);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DYN_ACK);
+        /* 3-byte address, the home channel and rate */
+        nrf24_tune();
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DYN_ACK | Nrf24::EN_DPL);
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_AW, Nrf24::AW_5_BYTES);
 
+        /* Dynamic payload length for the batch, also on pipe 0 for the acknowledgement */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_DYNPD, Nrf24::DPL_P0);
+
         /* Set my address */
         static_assert(size(my_addr) == 5, "");
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_TX_ADDR, my_addr, size(my_addr));
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P0, my_addr, size(my_addr));
+
+        /* Wait for the acknowledgement on pipe 0, retransmit if none */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_AA, Nrf24::ENAA_P0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_RETR, retransmit_delay | retransmit_count);
+
+        /* Receive the beacon on pipe 1 */
+        static_assert(size(beacon_addr) == 5, "");
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR, Nrf24::ERX_P0 | Nrf24::ERX_P1);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P1, beacon_addr, size(beacon_addr));
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_PW_P1, beacon_payload_length);
 }
 
-static void nrf24_power(bool on)
+/* The interrupt is unmasked for what the node waits for: the transmission, or the beacon */
+static void nrf24_power(bool on, bool receive = false)
 {
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
                 on ?
-                Nrf24::MASK_RX_DR | Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT |
+                (receive ? Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT | Nrf24::PRIM_RX : Nrf24::MASK_RX_DR) |
                 Nrf24::EN_CRC | Nrf24::PWR_UP | Nrf24::CRC0
                 :
                 Nrf24::MASK_RX_DR | Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT |
                 Nrf24::EN_CRC | Nrf24::CRC0);
 }
 
-static void nrf24_transmit(int8_t temperature, uint8_t battery_level)
+/* Wait until acknowledged, or all retransmits are done, clear the flags, return the status */
+static uint8_t nrf24_wait()
+{
+        uint8_t status;
+        while (((status = nrf24.status()) & (Nrf24::TX_DS | Nrf24::MAX_RT)) == 0)
+                sleep_radio(0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
+                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT); 
+        return status;
+}
+
+/*
+ * Retransmit the packet left in TX FIFO on every channel and rate until
+ * acknowledged, return true if it was, otherwise stay where it was
+ */
+static bool nrf24_hunt()
+{
+        const uint8_t prev_channel = channel, prev_rate = rate;
+
+        for (uint8_t r : hunt_rates) {
+                for (channel = hunt_first; channel <= hunt_last; channel++) {
+                        rate = r;
+                        nrf24_tune();
+                        nrf24.ce_pulse();
+                        if (nrf24_wait() & Nrf24::TX_DS) {
+                                switch_in = 0;
+                                return true;
+                        }
+                }
+        }
+
+        channel = prev_channel;
+        rate = prev_rate;
+        nrf24_tune();
+        return false;
+}
+
+/*
+ * Transmit the samples, then listen for the beacon if the base acknowledged
+ * them, return true if the beacon was received
+ */
+static bool nrf24_transmit(uint8_t battery_level, uint8_t (&beacon)[beacon_payload_length])
 {
-        /* Power up the RF chip */
+        /* Power up the RF chip, a watchdog tick is longer than the start up */
         nrf24_power(1);
-        delay_ms(Nrf24::tpd2stby);
+        sleep_ticks(1);
 
         /* Flush TX FIFO */
         nrf24.write(Nrf24::CMD_FLUSH_TX);
 
         /* Transmit the data */
-        const uint8_t d[] = {static_cast<uint8_t>(temperature), battery_level};
-        nrf24.write(Nrf24::CMD_W_TX_PAYLOAD_NOACK, d, size(d));
+        uint8_t d[header_length + batch_size*sample_length] = {node_id, battery_level, lost, retransmits};
+        uint8_t *p = d + header_length;
+        for (uint8_t i = 0; i < nr_samples; i++) {
+                const Sample &s = samples[i];
+                const uint32_t age = (clock_ticks - s.time)*tick >> 20;        /* 4 s */
+                *p++ = s.temperature;
+                *p++ = s.temperature >> 8;
+                *p++ = min<uint32_t>(age, UINT8_MAX);
+        }
+        nrf24.write(Nrf24::CMD_W_TX_PAYLOAD, d, p - d);
         nrf24.ce_pulse();
 
-        /* Wait until done */
-        while ((nrf24.status() & (Nrf24::TX_DS | Nrf24::MAX_RT)) == 0)
-                memory_barrier();
+        /* Not delivered: the packet stays in TX FIFO, hunt for the base with it */
+        bool delivered = nrf24_wait() & Nrf24::TX_DS;
+        if (!delivered && ++misses >= hunt_after) {
+                misses = 0;
+                delivered = nrf24_hunt();
+        }
 
-        /* Clear interrupt flags */
+        /* No beacon will come */
+        if (!delivered) {
+                if (lost < UINT8_MAX)
+                        lost++;
+                nrf24.write(Nrf24::CMD_FLUSH_TX);
+                nrf24_power(0);
+                return false;
+        }
+        lost = 0;
+        misses = 0;
+        retransmits = nrf24.read(Nrf24::CMD_R_REGISTER | Nrf24::REG_OBSERVE_TX) & Nrf24::ARC_CNT;
+
+        /* Listen for the beacon, sleep until it comes or the window is over */
+        nrf24_power(1, true);
+        nrf24.set_ce(1);
+        sleep_radio(beacon_window);
+        const bool received = nrf24.status() & Nrf24::RX_DR;
+        nrf24.set_ce(0);
+        if (received)
+                nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, beacon, size(beacon));
+        nrf24.write(Nrf24::CMD_FLUSH_RX);
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
-                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT); 
+                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT);
 
         /* Shut down the RF chip */
         nrf24_power(0);
+
+        return received;
 }
 
-static int8_t get_temperature()
+/* Temperature (1/16 °C) */
+static int16_t get_temperature()
 {
-        /* Start a single conversion */
+        /* Start a single 12-bit conversion */
         max31723.write(Max31723::REG_CONF_STATUS,
-                Max31723::CONF_STATUS_1SHOT | Max31723::CONF_STATUS_SD);
+                Max31723::CONF_STATUS_1SHOT | Max31723::CONF_STATUS_R1 |
+                Max31723::CONF_STATUS_R0 | Max31723::CONF_STATUS_SD);
 
-        /* Wait until done */
-        delay_ms(25);
+        /* Sleep until done */
+        sleep_ticks(conversion_ticks);
         while (max31723.read(Max31723::REG_CONF_STATUS) & Max31723::CONF_STATUS_1SHOT)
                 memory_barrier();
 
-        /* Return the MSB (°C, signed) */
-        return max31723.read(Max31723::REG_TEMPERATURE_MSB);
+        /* 12 bits of MSB and LSB (signed) */
+        const uint8_t lsb = max31723.read(Max31723::REG_TEMPERATURE_LSB);
+        const uint8_t msb = max31723.read(Max31723::REG_TEMPERATURE_MSB);
+        return static_cast<int16_t>(concat16(msb, lsb)) >> 4;
 }
 
 static uint8_t get_battery_level()
@@ -119,6 +335,75 @@ static uint8_t get_battery_level()
         return msb;
 }
 
+static void sleep_ticks(uint32_t n)
+{
+        ticks_slept += n;
+        clock_ticks += n;
+
+        /* Watchdog periods are 1 << p ticks, p = 0..9 */
+        for (int8_t p = 9; p >= 0; p--) {
+                const uint8_t wdp = (p & 8 ? 1<<WDP3 : 0) | (p & 7);
+                while (n >= 1ul << p) {
+                        atomic_block {
+                                wdt_reset();
+                                WDTCSR = 1<<WDCE | 1<<WDE;
+                                WDTCSR = 1<<WDIF | 1<<WDIE | wdp;
+                        }
+                        sleep_mode();
+                        n -= 1ul << p;
+                }
+        }
+}
+
+/*
+ * Time to the middle of my slot (1/256 s) by the beacon, or the whole cycle
+ * without the slot. The watchdog tick is measured by the base time since the
+ * previous beacon, if only a few cycles were missed.
+ */
+static uint32_t beacon_sync(const uint8_t (&beacon)[beacon_payload_length])
+{
+        static bool synced = false;
+        static uint16_t prev_time;
+
+        const uint16_t time = concat16(beacon[1], beacon[0]);
+        if (synced && ticks_slept != 0 && ticks_slept < 2*max_batch_cycles*65536ul*1024/tick_max) {
+                /* Whole cycles are counted by the previous tick */
+                const uint32_t expected = ticks_slept*tick >> 10;
+                uint32_t actual = static_cast<uint16_t>(time - prev_time);
+                while (actual + 0x8000 < expected)
+                        actual += 65536;
+                const uint32_t t = (actual << 10)/ticks_slept;
+                if (t >= tick_min && t <= tick_max)
+                        tick = t;
+        }
+        synced = true;
+        prev_time = time;
+        ticks_slept = 0;
+
+        /* Handover: switch after the given number of cycles */
+        const uint8_t *handover = beacon + 2 + beacon_nodes;
+        if (handover[2] != 0) {
+                next_channel = handover[0];
+                next_rate = handover[1];
+                switch_in = handover[2];
+        }
+        batch_cycles = clamp<uint8_t>(handover[3], 1, max_batch_cycles);
+
+        uint8_t slot = no_slot;
+        for (uint8_t i = 0; i < beacon_nodes; i++)
+                if (beacon[2 + i] == node_id)
+                        slot = i;
+        if (slot == no_slot)
+                return 65536;
+
+        /* Not less than a half of the slot, to keep out of other slots */
+        const uint16_t target = slot*slot_length + slot_length/2;
+        uint32_t delay = static_cast<uint16_t>(target - time);
+        if (delay < slot_length/2)
+                delay += 65536;
+        return delay;
+}
+
 int main()
 {
         /* GPIO init */
@@ -131,9 +416,12 @@ int main()
         ACSR = 1<<ACD;
         PRR = 1<<PRTIM1 | 1<<PRTIM0;
 
-        /* Watchdog interrupt every 8 sec */
+        /* Watchdog interrupt, the period is set for every sleep */
         WDTCSR = 1<<WDIF | 1<<WDIE | 1<<WDP3 | 1<<WDP0;
 
+        /* Pin change interrupt of the NRF24 IRQ, enabled in sleep_radio() */
+        PCMSK0 = 1<<PCINT7;
+
         /* ADC setup */
         static_assert(battery_adc_channel <= 7, "");
         ADMUX = battery_adc_channel;
@@ -147,15 +435,39 @@ int main()
         set_sleep_mode(SLEEP_MODE_PWR_DOWN);
         sei();
 
-        delay_ms(500);  /* Skip transients */
+        sleep_ticks(32);  /* Skip transients (~0.5 s) */
+
+        /* Time to the next transmission (1/256 s), the first one is at once */
+        uint32_t remaining = 0;
 
-        for (uint8_t cnt = 0; ; cnt++) {
-                if ((cnt % 32) == 0) {  /* Every 256 sec */
-                        int8_t temp = get_temperature();
+        while (true) {
+                samples[nr_samples++] = Sample {get_temperature(), clock_ticks};
+
+                if (remaining == 0) {
+                        uint8_t beacon[beacon_payload_length];
                         uint8_t bat = get_battery_level();
-                        nrf24_transmit(temp, bat);
+
+                        /* A transmission is once in batch_cycles */
+                        if (switch_in != 0) {
+                                switch_in = (switch_in > batch_cycles) ? switch_in - batch_cycles : 0;
+                                if (switch_in == 0) {
+                                        channel = next_channel;
+                                        rate = next_rate;
+                                        nrf24_tune();
+                                }
+                        }
+
+                        /* Without the beacon, nodes which collided part by their IDs */
+                        remaining = nrf24_transmit(bat, beacon) ?
+                                beacon_sync(beacon) : 65536 + node_id*256ul;  /* 256 sec + ID sec */
+                        remaining += (batch_cycles - 1)*65536ul;
+                        nr_samples = 0;
                 }
-                sleep_mode();
+
+                /* Spread the samples evenly, the last one is at the transmission */
+                const uint32_t delay = remaining/(samples_per_cycle*batch_cycles - nr_samples);
+                remaining -= delay;
+                sleep_ticks((delay << 10)/tick);
         }
 
         return 0;  /* Never be here */
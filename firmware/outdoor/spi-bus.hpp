@@ -0,0 +1,10 @@
+/* SPI of the firmware, the drivers are bound to it at compile time */
+
+#ifndef SPI_BUS_HPP_
+#define SPI_BUS_HPP_
+
+#include "spi-usi.hpp"
+
+using SpiBus = SpiUsi;
+
+#endif
@@ -1,44 +1,88 @@
 #include <avr/io.h>
 #include "spi-usi.hpp"
+#include "common.hpp"
 
 SpiUsi::SpiUsi(Gpio::Pin usi_do_, Gpio::Pin usi_di_, Gpio::Pin usi_usck_):
         usi_do(usi_do_), usi_di(usi_di_), usi_usck(usi_usck_) {}
 
-static uint8_t mirror(uint8_t d)
+/*
+ * CPHA = 0, MSB first: 16 stores of USICR, one cycle each, so SCK is F_CPU/2.
+ * Every store toggles USCK (USITC), every second one also shifts (USICLK
+ * software strobe) at the trailing edge. The slave samples DO at the leading
+ * one. The counter is cleared for the models counting USITC strobes.
+ */
+#define USI_BIT "out %[cr], %[lead]\n\tout %[cr], %[trail]\n\t"
+
+static inline uint8_t shift_strobe(uint8_t out)
 {
-        uint8_t m = 0;
-        for (uint8_t i = 0; i < 8; i++) {
-                m <<= 1;
-                m |= d & 1;
-                d >>= 1;
-        }
-        return m;
+        const uint8_t lead = 1<<USIWM0 | 1<<USITC;
+        const uint8_t trail = 1<<USIWM0 | 1<<USITC | 1<<USICLK;
+
+        USIDR = out;
+        USISR = 1<<USIOIF;
+        asm volatile (USI_BIT USI_BIT USI_BIT USI_BIT USI_BIT USI_BIT USI_BIT USI_BIT
+                :: [cr] "I" (_SFR_IO_ADDR(USICR)), [lead] "r" (lead), [trail] "r" (trail));
+        return USIDR;
+}
+
+/*
+ * CPHA = 1 needs DO to change at the leading edge and DI to be read at the
+ * trailing one: USCK toggled by USITC clocks the shift register at the edge
+ * of the mode, the counter overflows after 16 toggles.
+ */
+static inline uint8_t shift_edge(uint8_t out, bool cpol)
+{
+        const uint8_t r = cpol ?
+                1<<USIWM0 | 1<<USICS1 | 1<<USICLK | 1<<USITC :               /* Read at posedge, write at negedge */
+                1<<USIWM0 | 1<<USICS1 | 1<<USICS0 | 1<<USICLK | 1<<USITC;   /* Read at negedge, write at posedge */
+
+        USIDR = out;
+        USISR = 1<<USIOIF;
+        do {
+                USICR = r;
+        } while ((USISR & 1<<USIOIF) == 0);
+        return USIBR;
 }
 
-void SpiUsi::init(Mode m)
+void SpiUsi::init()
 {
         Gpio::write(usi_do, 0);
         Gpio::set(usi_di, Gpio::tri);
-        set_mode(m);
+        forget_mode();
 }
 
 uint8_t SpiUsi::transfer(uint8_t out)
 {
-        USIDR = mode.msb_first ? out : mirror(out);
-        USISR = 1<<USIOIF;
+        if (fast())
+                return shift_strobe(out);
 
-        const uint8_t r = (mode.cpha != mode.cpol) ?
-                1<<USIWM0 | 1<<USICS1 | 1<<USICS0 | 1<<USICLK | 1<<USITC :  /* Read at negedge, write at posedge */
-                1<<USIWM0 | 1<<USICS1 | 1<<USICLK | 1<<USITC;               /* Read at posedge, write at negedge */
+        if (!mode.msb_first)
+                out = reverse_bits(out);
+        const uint8_t in = mode.cpha ? shift_edge(out, mode.cpol) : shift_strobe(out);
+        return mode.msb_first ? in : reverse_bits(in);
+}
 
-        do {
-                USICR = r;
-        } while ((USISR & 1<<USIOIF) == 0);
+void SpiUsi::write(const uint8_t *data, size_t len)
+{
+        if (!fast()) {
+                Spi<SpiUsi>::write(data, len);
+                return;
+        }
+        while (len-- != 0)
+                shift_strobe(*data++);
+}
 
-        return mode.msb_first ? USIBR : mirror(USIBR);
+void SpiUsi::read(uint8_t *data, size_t len)
+{
+        if (!fast()) {
+                Spi<SpiUsi>::read(data, len);
+                return;
+        }
+        while (len-- != 0)
+                *data++ = shift_strobe(0);
 }
 
-void SpiUsi::set_mode(Mode m)
+void SpiUsi::apply_mode(Mode m)
 {
         mode = m;
         Gpio::write(usi_usck, m.cpol);
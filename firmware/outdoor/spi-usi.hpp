@@ -1,21 +1,29 @@
-/* SPI implementation for AVR using USI */
+/* SPI implementation for AVR using USI (strobed in software, the clock of the mode is ignored) */
 
 #ifndef SPI_USI_HPP_
 #define SPI_USI_HPP_
 
 #include <stdint.h>
+#include <stddef.h>
 #include "spi.hpp"
 #include "gpio.hpp"
 
-class SpiUsi: public Spi {
+class SpiUsi: public Spi<SpiUsi> {
 private:
         const Gpio::Pin usi_do, usi_di, usi_usck;
         Mode mode;
+        bool fast() const { return mode.msb_first && !mode.cpha; }
 public:
         SpiUsi(Gpio::Pin usi_do, Gpio::Pin usi_di, Gpio::Pin usi_usck);
-        void init(Mode m = {0, 0, 1});
-        uint8_t transfer(uint8_t out) override;
-        void set_mode(Mode m) override;
+        void init();
+        uint8_t transfer(uint8_t out);
+        void apply_mode(Mode m);
+
+        /* Bulk transfers run the unrolled kernel back to back */
+        using Spi<SpiUsi>::write;
+        using Spi<SpiUsi>::read;
+        void write(const uint8_t *data, size_t len);
+        void read(uint8_t *data, size_t len);
 };
 
 #endif
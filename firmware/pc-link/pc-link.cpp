@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "common.hpp"
 #include "delay.hpp"
 #include "shared.hpp"
@@ -18,58 +19,162 @@ constexpr Gpio::Pin spi_mosi = Gpio::B3, spi_miso = Gpio::B4, spi_sck = Gpio::B5
 constexpr Gpio::Pin led = Gpio::D6;
 
 constexpr uint32_t uart_baudrate = 9600;
+constexpr double blink_time = 300e-3;           /* LED on for the time sync (s) */
+
+/*
+ * Serial packets from the PC, every one is acked with my checksum:
+ *   0xaa, hours, minutes, seconds, checksum: sync the time, then the report
+ *   0x55, length, payload, checksum: transmit the payload (firmware update,
+ *     see boot.cpp), then the report, length of the acknowledgement payload
+ *     of the base, and the payload
+ * The PC may send the next packet while the radio transmits the previous
+ * one: the received bytes are buffered.
+ */
+constexpr uint8_t sync_time = 0xaa, sync_forward = 0x55;
 
 constexpr uint8_t my_addr[] = {0xe7, 0x4f, 0xec, 0xe8, 0x37};
 
+/* Retransmits until the base acknowledges, and the delay between them */
+constexpr uint8_t retransmit_count = Nrf24::ARC_3;
+constexpr uint8_t retransmit_delay = Nrf24::ARD_500us;
+
+/* Transmit report for the PC: retransmits, and this bit if not delivered */
+constexpr uint8_t report_lost = 0x80;
+
+/*
+ * Radio channel and air rate: pc-link starts at the home channel and 1 Mbit/s,
+ * and hunts for the base over the channels and rates it may choose (the same
+ * as in base.cpp) when a packet is not delivered.
+ */
+constexpr uint8_t home_channel = 2;             /* 2402 MHz */
+constexpr uint8_t hunt_first = 1, hunt_last = 82;
+constexpr uint8_t hunt_rates[] = {Nrf24::RF_DR_2Mbps, Nrf24::RF_DR_1Mbps, Nrf24::RF_DR_250kbps};
+
 static UartHardware uart;
 static SpiHardware spi {spi_mosi, spi_miso, spi_sck};
 static Nrf24 nrf24 {spi, nrf_csn, nrf_ce};
 
+static uint8_t channel = home_channel, rate = Nrf24::RF_DR_1Mbps;
+
+static void nrf24_tune()
+{
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_CH, channel);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP, rate | Nrf24::RF_PWR_0dBm);
+}
+
 static void nrf24_setup()
 {
-        /* 3-byte address, 2402 MHz, 1 Mbit/s */
+        /* 3-byte address, the home channel and rate */
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_CONFIG,
                 Nrf24::MASK_RX_DR | Nrf24::MASK_TX_DS | Nrf24::MASK_MAX_RT |
                 Nrf24::EN_CRC | Nrf24::CRC0 | Nrf24::PWR_UP);
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_RXADDR, Nrf24::ERX_P0);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RF_SETUP,
-                Nrf24::RF_DR_1Mbps | Nrf24::RF_PWR_0dBm);
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE, Nrf24::EN_DYN_ACK);
+        nrf24_tune();
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_FEATURE,
+                Nrf24::EN_DYN_ACK | Nrf24::EN_DPL | Nrf24::EN_ACK_PAY);
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_AW, Nrf24::AW_5_BYTES);
 
+        /* Dynamic payload length, also for the acknowledgement payloads */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_DYNPD, Nrf24::DPL_P0);
+
         /* Set my address */
         static_assert(size(my_addr) == 5, "");
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_TX_ADDR, my_addr, size(my_addr));
         nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_RX_ADDR_P0, my_addr, size(my_addr));
 
+        /* Wait for the acknowledgement on pipe 0, retransmit if none */
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_EN_AA, Nrf24::ENAA_P0);
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_SETUP_RETR, retransmit_delay | retransmit_count);
+
         /* Wait for Standby mode */
         delay_ms(Nrf24::tpd2stby);
 }
 
-static void nrf24_transmit(uint8_t hours, uint8_t minutes, uint8_t seconds)
+/* Wait until acknowledged, or all retransmits are done, clear the flags, return the status */
+static uint8_t nrf24_wait()
 {
-        /* Flush TX FIFO */
+        uint8_t status;
+        while (((status = nrf24.status()) & (Nrf24::TX_DS | Nrf24::MAX_RT)) == 0)
+                memory_barrier();
+        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
+                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT); 
+        return status;
+}
+
+/*
+ * Retransmit the packet left in TX FIFO on every channel and rate until
+ * acknowledged, return true if it was, otherwise stay where it was
+ */
+static bool nrf24_hunt()
+{
+        const uint8_t prev_channel = channel, prev_rate = rate;
+
+        for (uint8_t r : hunt_rates) {
+                for (channel = hunt_first; channel <= hunt_last; channel++) {
+                        rate = r;
+                        nrf24_tune();
+                        nrf24.ce_pulse();
+                        if (nrf24_wait() & Nrf24::TX_DS)
+                                return true;
+                }
+        }
+
+        channel = prev_channel;
+        rate = prev_rate;
+        nrf24_tune();
+        return false;
+}
+
+/*
+ * Transmit the data, return the report, and the acknowledgement payload of
+ * the base if any (ack_len is 0 if none)
+ */
+static uint8_t nrf24_transmit(const uint8_t *d, uint8_t len, uint8_t (&ack)[32], uint8_t &ack_len)
+{
+        /* Flush TX and RX FIFOs */
         nrf24.write(Nrf24::CMD_FLUSH_TX);
+        nrf24.write(Nrf24::CMD_FLUSH_RX);
 
         /* Transmit the data */
-        const uint8_t d[] = {hours, minutes, seconds};
-        nrf24.write(Nrf24::CMD_W_TX_PAYLOAD_NOACK, d, size(d));
+        nrf24.write(Nrf24::CMD_W_TX_PAYLOAD, d, len);
         nrf24.ce_pulse();
 
-        /* Wait until done */
-        while ((nrf24.status() & (Nrf24::TX_DS | Nrf24::MAX_RT)) == 0)
-                memory_barrier();
+        /* Not delivered: the packet stays in TX FIFO, hunt for the base with it */
+        const bool delivered = (nrf24_wait() & Nrf24::TX_DS) || nrf24_hunt();
+        uint8_t report = nrf24.read(Nrf24::CMD_R_REGISTER | Nrf24::REG_OBSERVE_TX) & Nrf24::ARC_CNT;
+        if (!delivered) {
+                nrf24.write(Nrf24::CMD_FLUSH_TX);
+                report |= report_lost;
+        }
 
-        /* Clear interrupt flags */
-        nrf24.write(Nrf24::CMD_W_REGISTER | Nrf24::REG_STATUS,
-                Nrf24::RX_DR | Nrf24::TX_DS | Nrf24::MAX_RT); 
+        ack_len = 0;
+        if ((nrf24.status() & Nrf24::RX_P_NO) != Nrf24::RX_P_NO) {
+                ack_len = nrf24.read(Nrf24::CMD_R_RX_PL_WID);
+                if (ack_len <= size(ack))
+                        nrf24.read(Nrf24::CMD_R_RX_PAYLOAD, ack, ack_len);
+                else {
+                        ack_len = 0;
+                        nrf24.write(Nrf24::CMD_FLUSH_RX);
+                }
+        }
+        return report;
 }
 
-static void blink()
+/* End of the blink, Timer1 stops itself */
+ISR(TIMER1_COMPA_vect)
 {
-        Gpio::write(led, 1);
-        delay_ms(300);
         Gpio::write(led, 0);
+        TCCR1B = 0;
+}
+
+/* Turn the LED on, Timer1 turns it off while the UART keeps receiving */
+static void blink()
+{
+        atomic_block {
+                Gpio::write(led, 1);
+                TCNT1 = 0;
+                TCCR1B = 1<<WGM12 | 1<<CS11 | 1<<CS10;
+        }
 }
 
 int main()
@@ -85,32 +190,49 @@ int main()
         /* Disable Analog Comparator */
         ACSR = 1<<ACD;
 
+        /* 16-bit T/C1 for the blink: a one-shot in CTC mode (1/64 prescaler), started by blink() */
+        OCR1A = blink_time*F_CPU/64 - 1;
+        TIMSK = 1<<OCIE1A;
+
         /* Other setups */
         uart.init(uart_baudrate);
-        spi.init(SpiHardware::div_2);
+        spi.init();
         nrf24.init();
         nrf24_setup();
+        sei();
 
         while (true)
         {
                 /* Synchronization */
-                while (uart.read() != 0xaa)
+                uint8_t sync;
+                while ((sync = uart.read()) != sync_time && sync != sync_forward)
                         memory_barrier();
 
-                /* Read the packet: hours, minutes, seconds, checksum */
-                uint8_t d[4];
-                uart.read(d, size(d));
+                /* Read the packet: hours, minutes, seconds, or the length and the payload */
+                uint8_t d[32], len = 3;
+                if (sync == sync_forward && ((len = uart.read()) == 0 || len > size(d)))
+                        continue;
+                uart.read(d, len);
 
                 /* Ack with my checksum */
-                uint8_t checksum = ~(d[0]^d[1]^d[2]);
+                uint8_t checksum = (sync == sync_forward) ? len : 0;
+                for (uint8_t i = 0; i < len; i++)
+                        checksum ^= d[i];
+                checksum = ~checksum;
+                const bool ok = (uart.read() == checksum);
                 uart.write(checksum);
+                if (!ok)
+                        continue;
 
-                /* If ok, transmit the time */
-                if (d[3] == checksum) {
-                        nrf24_transmit(d[0], d[1], d[2]);
+                /* Transmit the packet and report how it went */
+                uint8_t ack[32], ack_len;
+                uart.write(nrf24_transmit(d, len, ack, ack_len));
+                if (sync == sync_time)
                         blink();
+                else {
+                        uart.write(ack_len);
+                        uart.write(ack, ack_len);
                 }
-
         }
 
         return 0;  /* Never be here */
@@ -0,0 +1 @@
+../base/spi-bus.hpp
\ No newline at end of file
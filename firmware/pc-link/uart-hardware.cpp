@@ -1,7 +1,17 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "uart-hardware.hpp"
 #include "shared.hpp"
 
+/* Shared variables (changed in interrupts) */
+static Queue<uint8_t, 64> s_rx;                 /* Received bytes, while the main loop is busy */
+
+ISR(USART_RXC_vect)
+{
+        const uint8_t data = UDR;
+        s_rx.push(data);
+}
+
 bool UartHardware::init(uint32_t baudrate)
 {
         const uint16_t ubrr = F_CPU/8/baudrate - 1;
@@ -13,7 +23,7 @@ bool UartHardware::init(uint32_t baudrate)
         UBRRL = ubrr & 0xff;
 
         UCSRA = 1<<TXC | 1<<U2X;
-        UCSRB = 1<<RXEN | 1<<TXEN;
+        UCSRB = 1<<RXCIE | 1<<RXEN | 1<<TXEN;
         UCSRC = 1<<URSEL | 1<<UCSZ1 | 1<<UCSZ0;
 
         return true;
@@ -28,7 +38,8 @@ void UartHardware::write(uint8_t data)
 
 uint8_t UartHardware::read()
 {
-        while ((UCSRA & 1<<RXC) == 0)
+        uint8_t data;
+        while (!s_rx.pop(data))
                 memory_barrier();
-        return UDR;
+        return data;
 }
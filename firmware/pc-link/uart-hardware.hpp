@@ -1,4 +1,4 @@
-/* AVR hardware UART (always 8N1) */
+/* AVR hardware UART (always 8N1), received bytes are buffered in the interrupt */
 
 #ifndef UART_HARDWARE_HPP_
 #define UART_HARDWARE_HPP_
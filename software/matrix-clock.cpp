@@ -3,10 +3,20 @@
 #include <ctime>
 #include <cstring>
 #include <cerrno>
-#include <ctime>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -28,6 +38,7 @@ static bool configure_port(int uart)
         ts.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
         ts.c_cflag &= ~(PARENB | CSTOPB | CSIZE);
         ts.c_cflag |= CS8;
+        ts.c_cc[VMIN] = 0;
         ts.c_cc[VTIME] = 5;
 
         tcflush(uart, TCIOFLUSH);
@@ -38,27 +49,17 @@ static bool configure_port(int uart)
         return true;
 }
 
-int main(int argc, char **argv)
+/* Read a byte, waiting up to tries*0.5 s */
+static bool read_byte(int uart, uint8_t &byte, int tries = 1)
 {
-        if (argc <= 1 || strcmp(argv[1], "--sync-time")) {
-                fprintf(stderr, "Usage: matrix-clock [--sync-time [port]]\n");
-                return 1;
-        }
-
-        /* Open serial port */
-        const char *uart_name = (argc > 2) ? argv[2] : "/dev/ttyUSB0";
-        int uart = open(uart_name, O_RDWR | O_NOCTTY | O_NDELAY);
-        if (uart < 0) {
-                fprintf(stderr, "Can't open %s: %s\n", uart_name, strerror(errno));
-                return 2;
-        }
-
-        /* Configure the port */
-        if (!configure_port(uart)) {
-                fprintf(stderr, "Can't configure %s: %s\n", uart_name, strerror(errno));
-                return 3;
-        }
+        ssize_t n = 0;
+        for (int i = 0; i < tries && n == 0; i++)
+                n = read(uart, &byte, 1);
+        return n == 1;
+}
 
+static int sync_time(int uart, const char *uart_name)
+{
         /* Get current time */
         time_t now = time(0);
         tm *t = localtime(&now);
@@ -82,9 +83,914 @@ int main(int argc, char **argv)
                 return 6;
         }
 
+        /*
+         * Check the transmit report (retransmits, bit 7 if not delivered), older
+         * firmware has none. It takes up to a second when pc-link hunts for the
+         * base over the channels.
+         */
+        if (read_byte(uart, d[0], 3) && (d[0] & 0x80)) {
+                fprintf(stderr, "Not delivered to the base station (%u retransmits)\n", d[0] & 0x0f);
+                return 7;
+        }
+
+        return 0;
+}
+
+/*
+ * Firmware update of the base station (see firmware/boot/boot.cpp): pc-link
+ * forwards the packets to the bootloader, and returns its acknowledgement
+ * payloads. Data packets are pipelined: the next one goes to pc-link while
+ * the radio transmits the previous one, and up to a window of data goes
+ * ahead of the offset acknowledged by the base (go-back-N).
+ */
+constexpr size_t chunk_length = 29;             /* Radio payload less the command and the offset */
+constexpr size_t window = 8*chunk_length;
+constexpr unsigned max_stalls = 3;              /* Acknowledged queries without progress, then go back */
+constexpr unsigned max_silence = 100;           /* Packets without progress, then fail */
+constexpr size_t app_size = 0x7000 - 128;       /* Up to the image info page (the same as in boot.cpp) */
+
+struct Packet {
+        uint8_t d[32];
+        uint8_t len;
+        size_t offset;                          /* Of the data */
+};
+
+struct Reply {
+        bool delivered;
+        bool acked;                             /* There is an acknowledgement payload */
+        uint8_t state;
+        size_t offset;
+};
+
+/* Read an Intel HEX file, the gaps are 0xff */
+static bool read_hex(const char *name, vector<uint8_t> &image)
+{
+        FILE *f = fopen(name, "r");
+        if (f == nullptr)
+                return false;
+
+        uint32_t base = 0;
+        char line[600];
+        bool ok = false;
+        while (fgets(line, sizeof(line), f)) {
+                unsigned len, addr, type;
+                if (sscanf(line, ":%2x%4x%2x", &len, &addr, &type) != 3 || strlen(line) < 11 + 2*len)
+                        break;
+                uint8_t sum = len + (addr >> 8) + addr + type, d[256];
+                for (unsigned i = 0; i <= len; i++) {
+                        unsigned x;
+                        sscanf(line + 9 + 2*i, "%2x", &x);
+                        d[i] = x;
+                        sum += x;
+                }
+                if (sum != 0)
+                        break;
+                if (type == 0) {
+                        if (image.size() < base + addr + len)
+                                image.resize(base + addr + len, 0xff);
+                        memcpy(&image[base + addr], d, len);
+                } else if (type == 1) {
+                        ok = true;
+                        break;
+                } else if (type == 2 && len == 2)
+                        base = (d[0] << 8 | d[1]) << 4;
+                else if (type == 4 && len == 2)
+                        base = (d[0] << 8 | d[1]) << 16;
+        }
+        fclose(f);
+        return ok && !image.empty();
+}
+
+/* CRC-CCITT, the same as _crc_ccitt_update() of avr-libc */
+static uint16_t crc_ccitt(const vector<uint8_t> &d)
+{
+        uint16_t crc = 0xffff;
+        for (uint8_t b : d) {
+                b ^= crc & 0xff;
+                b ^= b << 4;
+                crc = (static_cast<uint16_t>(b) << 8 | crc >> 8) ^ (b >> 4) ^ (static_cast<uint16_t>(b) << 3);
+        }
+        return crc;
+}
+
+static Packet command(uint8_t cmd, uint16_t a = 0, uint16_t b = 0)
+{
+        Packet p = {{cmd, static_cast<uint8_t>(a), static_cast<uint8_t>(a >> 8),
+                static_cast<uint8_t>(b), static_cast<uint8_t>(b >> 8)}, 1, 0};
+        if (cmd == 'S')
+                p.len = 5;
+        return p;
+}
+
+/* Send the packet to pc-link for forwarding, return its checksum */
+static bool send(int uart, const Packet &p, uint8_t &checksum)
+{
+        uint8_t d[3 + 32] = {0x55, p.len};
+        checksum = p.len;
+        for (uint8_t i = 0; i < p.len; i++) {
+                d[2 + i] = p.d[i];
+                checksum ^= p.d[i];
+        }
+        checksum = ~checksum;
+        d[2 + p.len] = checksum;
+        return write(uart, d, p.len + 3) == p.len + 3;
+}
+
+/* Read the transmit report and the acknowledgement payload of the base */
+static bool read_report(int uart, Reply &r)
+{
+        uint8_t report, len, d[32];
+        if (!read_byte(uart, report, 3) || !read_byte(uart, len) || len > sizeof(d))
+                return false;
+        for (uint8_t i = 0; i < len; i++)
+                if (!read_byte(uart, d[i]))
+                        return false;
+
+        r.delivered = !(report & 0x80);
+        r.acked = (len == 3);
+        r.state = d[0];
+        r.offset = d[1] | d[2] << 8;
+        return true;
+}
+
+/* Send the packet and wait for the reply */
+static bool transact(int uart, const Packet &p, Reply &r)
+{
+        uint8_t checksum, ack;
+        return send(uart, p, checksum) && read_byte(uart, ack) && ack == checksum && read_report(uart, r);
+}
+
+static int flash(int uart, const char *image_name)
+{
+        vector<uint8_t> image;
+        if (!read_hex(image_name, image)) {
+                fprintf(stderr, "Can't read Intel HEX from %s\n", image_name);
+                return 8;
+        }
+        if (image.size() > app_size) {
+                fprintf(stderr, "The image of %zu bytes is larger than the application section (%zu bytes)\n",
+                        image.size(), app_size);
+                return 8;
+        }
+        const uint16_t crc = crc_ccitt(image);
+        auto start = chrono::steady_clock::now();
+
+        /*
+         * Reset the application into the bootloader, then start or resume the
+         * update. The state is known from the reply to the second start that
+         * reached the bootloader (the application has no acknowledgement payload).
+         */
+        Reply r = {};
+        transact(uart, command('B'), r);
+        usleep(100000);
+        bool booted = false;
+        for (int i = 0; i < 20; i++) {
+                if (!transact(uart, command('S', image.size(), crc), r)) {
+                        usleep(100000);
+                        continue;
+                }
+                if (booted && r.acked)
+                        break;
+                booted = r.acked;
+        }
+        if (!r.acked || r.state != 'U') {
+                fprintf(stderr, "No bootloader, or the image of %zu bytes is too large\n", image.size());
+                return 9;
+        }
+        size_t acked = r.offset, sent = acked;
+        if (acked != 0)
+                printf("Resuming at %zu of %zu bytes\n", acked, image.size());
+
+        /* Data, a packet is sent before the report of the previous one */
+        Packet flight = {};
+        bool in_flight = false;
+        unsigned stalls = 0, silence = 0;
+        while (acked < image.size() || in_flight) {
+                Packet p = command('Q');
+                const bool more = (acked < image.size());
+                if (more && sent < image.size() && sent - acked < window) {
+                        const size_t n = min(chunk_length, image.size() - sent);
+                        p = command('D', sent);
+                        memcpy(p.d + 3, &image[sent], n);
+                        p.len = 3 + n;
+                        p.offset = sent;
+                        sent += n;
+                }
+
+                uint8_t checksum = 0;
+                if (more && !send(uart, p, checksum)) {
+                        fprintf(stderr, "Can't write to pc-link: %s\n", strerror(errno));
+                        return 4;
+                }
+
+                if (in_flight) {
+                        if (!read_report(uart, r)) {
+                                fprintf(stderr, "No report from pc-link\n");
+                                return 5;
+                        }
+                        const size_t prev = acked;
+                        if (r.acked && r.state == 'U') {
+                                /* Less than acknowledged: the base restarted from a checkpoint */
+                                if (r.offset < acked || sent < r.offset)
+                                        sent = r.offset;
+                                acked = r.offset;
+                        } else if (r.acked && r.state != 'V') {
+                                fprintf(stderr, "Update failed at %zu bytes (state %c)\n", acked, r.state);
+                                return 9;
+                        }
+                        if (!r.delivered || (flight.d[0] == 'Q' && r.acked && acked == prev &&
+                                        ++stalls >= max_stalls)) {
+                                sent = acked;
+                                stalls = 0;
+                        }
+                        if (acked != prev)
+                                stalls = silence = 0;
+                        else
+                                silence++;
+                        if (silence > max_silence) {
+                                fprintf(stderr, "The base stopped at %zu of %zu bytes\n", acked, image.size());
+                                return 7;
+                        }
+                        if (acked/1024 != prev/1024) {
+                                printf("\r%zu of %zu bytes", acked, image.size());
+                                fflush(stdout);
+                        }
+                }
+
+                in_flight = more;
+                if (more) {
+                        uint8_t ack;
+                        if (!read_byte(uart, ack) || ack != checksum) {
+                                /* Not forwarded, go back to it */
+                                if (p.d[0] == 'D')
+                                        sent = min(sent, p.offset);
+                                in_flight = false;
+                        }
+                        flight = p;
+                }
+        }
+
+        /* Verify the image, and start it */
+        transact(uart, command('E'), r);
+        for (int i = 0; i < 20 && (!r.acked || r.state == 'U'); i++) {
+                usleep(50000);          /* The CRC of the whole flash takes a while */
+                transact(uart, command('Q'), r);
+        }
+        if (!r.acked || r.state != 'V') {
+                fprintf(stderr, "\nImage verification failed (CRC 0x%04x)\n", crc);
+                return 9;
+        }
+        transact(uart, command('R'), r);
+
+        const double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("\rFlashed %zu bytes in %.1f s (%.0f bytes/s)\n", image.size(), t, image.size()/t);
+        return 0;
+}
+
+/*
+ * Content pushed to the base display (see remote_frame() and remote_text() in
+ * firmware/base/base.cpp): text, or a stream of frames in the frame log
+ * format of base-sim, 8 lines of '#' and '.' a frame, the top row first, the
+ * other lines separate frames. A frame carries the columns changed since the
+ * previous one, or all of them after a lost packet. Frames are pipelined as
+ * the firmware update, and the display holds the last one for a while.
+ */
+constexpr size_t display_width = 24;            /* The same as in base.cpp */
+constexpr size_t mask_length = (display_width + 7)/8;
+constexpr uint8_t text_timeout = 10;            /* s, at least */
+constexpr uint8_t frame_timeout = 3;            /* s */
+constexpr size_t scroll_speed = 16;             /* px/s, the same as in base.cpp */
+
+static int push_text(int uart, const char *text)
+{
+        Packet p = {{'T', text_timeout}, 2, 0};
+        const size_t n = strlen(text);
+        if (n > sizeof(p.d) - p.len) {
+                fprintf(stderr, "The text is longer than %zu characters\n", sizeof(p.d) - p.len);
+                return 8;
+        }
+        memcpy(p.d + p.len, text, n);
+        p.len += n;
+
+        /* Hold a wide text until it scrolls to the end, with the holds at both ends */
+        const size_t width = 6*n;
+        if (width > display_width)
+                p.d[1] = max<size_t>(text_timeout, (width - display_width + scroll_speed - 1)/scroll_speed + 3);
+
+        Reply r;
+        if (!transact(uart, p, r)) {
+                fprintf(stderr, "No reply from pc-link\n");
+                return 5;
+        }
+        if (!r.delivered) {
+                fprintf(stderr, "Not delivered to the base station\n");
+                return 7;
+        }
+        return 0;
+}
+
+/* Read the next frame, a byte per column with the top row in bit 7 */
+static bool read_frame(FILE *f, uint8_t (&frame)[display_width])
+{
+        char line[256];
+        unsigned row = 0;
+        memset(frame, 0, sizeof(frame));
+        while (row < 8 && fgets(line, sizeof(line), f)) {
+                if (line[0] != '#' && line[0] != '.') {
+                        row = 0;
+                        memset(frame, 0, sizeof(frame));
+                        continue;
+                }
+                for (size_t x = 0; x < display_width && (line[x] == '#' || line[x] == '.'); x++)
+                        if (line[x] == '#')
+                                frame[x] |= 0x80 >> row;
+                row++;
+        }
+        return row == 8;
+}
+
+/* Skip what pc-link still sends after an error, until it's silent */
+static void drain(int uart)
+{
+        uint8_t byte;
+        while (read_byte(uart, byte))
+                continue;
+}
+
+/* A frame with the columns changed since the previous one, or all of them without it */
+static Packet frame_packet(uint8_t number, const uint8_t *frame, const uint8_t *prev)
+{
+        Packet p = {{'F', number, frame_timeout}, 3 + mask_length, 0};
+        for (size_t x = 0; x < display_width; x++) {
+                if (prev && frame[x] == prev[x])
+                        continue;
+                p.d[3 + x/8] |= 1 << x%8;
+                p.d[p.len++] = frame[x];
+        }
+        return p;
+}
+
+static int push_frames(int uart, const char *name)
+{
+        FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+        if (f == nullptr) {
+                fprintf(stderr, "Can't read frames from %s\n", name);
+                return 8;
+        }
+        auto start = chrono::steady_clock::now();
+
+        uint8_t frame[display_width], prev[display_width] = {};
+        uint8_t number = 0;
+        bool full = true;                       /* The base may have missed the previous frame */
+        bool in_flight = false;
+        unsigned frames = 0, lost = 0;
+        while (true) {
+                const bool more = read_frame(f, frame);
+                uint8_t checksum = 0;
+                if (more) {
+                        const Packet p = frame_packet(number++, frame, full ? nullptr : prev);
+                        memcpy(prev, frame, sizeof(prev));
+                        full = false;
+                        if (!send(uart, p, checksum)) {
+                                fprintf(stderr, "Can't write to pc-link: %s\n", strerror(errno));
+                                return 4;
+                        }
+                }
+
+                bool ok = true;
+                if (in_flight) {
+                        Reply r;
+                        ok = read_report(uart, r);
+                        if (ok && !r.delivered) {
+                                full = true;
+                                lost++;
+                        }
+                }
+                if (!more)
+                        break;
+
+                /* Not forwarded, or out of step: the next frame goes in full */
+                uint8_t ack;
+                in_flight = ok && read_byte(uart, ack) && ack == checksum;
+                if (!in_flight) {
+                        drain(uart);
+                        full = true;
+                }
+                frames++;
+        }
+        if (f != stdin)
+                fclose(f);
+
+        /* The last frame is missing on the display */
+        for (int i = 0; i < 3 && full && frames != 0; i++) {
+                Reply r;
+                full = !(transact(uart, frame_packet(number++, prev, nullptr), r) && r.delivered);
+        }
+
+        const double t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("Pushed %u frames in %.1f s (%.1f frames/s), %u lost\n", frames, t, frames/t, lost);
+        return 0;
+}
+
+/*
+ * Weather archive: a directory of segment files, each one holds up to
+ * segment_capacity samples in time order and is named by the time of its
+ * first one. A segment is the header, then every column as a fixed-width
+ * array of the full capacity (the file is sparse until filled): the time (s
+ * since the epoch), temperature, humidity, pressure and battery level, and
+ * the reliability bits by column. Samples are only appended, the count in
+ * the header is written after their data. A query maps the segments
+ * read-only, finds the time range by binary search of the time column (the
+ * index), and aggregates the columns with SIMD.
+ */
+constexpr uint32_t archive_magic = 0x3157434d;  /* "MCW1" */
+constexpr uint32_t segment_capacity = 1 << 20;  /* ~2 years of 1-minute samples */
+constexpr size_t header_size = 64;              /* The columns are aligned */
+
+enum Column: uint8_t {
+        col_temperature,                        /* 1/10 °C */
+        col_humidity,                           /* 1/10 % */
+        col_pressure,                           /* 1/10 mmHg */
+        col_battery,                            /* 0..255, 255 is 4.2 V */
+        nr_columns
+};
+
+static const char *const column_names[nr_columns] = {"temperature", "humidity", "pressure", "battery"};
+static const int column_scale[nr_columns] = {10, 10, 10, 1};
+
+struct SegmentHeader {
+        uint32_t magic;
+        uint32_t count;                         /* Samples, written after their data */
+        uint32_t first, last;                   /* Time of the first and the last sample */
+};
+static_assert(sizeof(SegmentHeader) <= header_size, "");
+
+constexpr size_t time_offset = header_size;
+constexpr size_t column_offset(uint8_t c)
+{
+        return time_offset + segment_capacity*sizeof(uint32_t) + c*segment_capacity*sizeof(int16_t);
+}
+constexpr size_t flags_offset = column_offset(nr_columns);
+constexpr size_t segment_size = flags_offset + segment_capacity;
+
+/* A mapped segment file */
+struct Segment {
+        uint8_t *map;
+
+        SegmentHeader &header() const { return *reinterpret_cast<SegmentHeader *>(map); }
+        uint32_t *time() const { return reinterpret_cast<uint32_t *>(map + time_offset); }
+        int16_t *column(uint8_t c) const { return reinterpret_cast<int16_t *>(map + column_offset(c)); }
+        uint8_t *flags() const { return map + flags_offset; }
+};
+
+/* Map a segment, a new one is created if writable */
+static bool map_segment(const string &name, bool writable, Segment &s)
+{
+        const int fd = open(name.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (fd < 0)
+                return false;
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        const bool created = ok && st.st_size == 0 && writable;
+        if (created)
+                ok = ftruncate(fd, segment_size) == 0;
+        else if (ok && static_cast<size_t>(st.st_size) != segment_size) {
+                errno = EINVAL;
+                ok = false;
+        }
+
+        void *p = MAP_FAILED;
+        if (ok)
+                p = mmap(nullptr, segment_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+                return false;
+
+        s.map = static_cast<uint8_t *>(p);
+        if (created)
+                s.header().magic = archive_magic;
+        if (s.header().magic != archive_magic || s.header().count > segment_capacity) {
+                munmap(s.map, segment_size);
+                errno = EINVAL;
+                return false;
+        }
+        return true;
+}
+
+static void unmap_segment(Segment &s, bool sync = false)
+{
+        if (s.map == nullptr)
+                return;
+        if (sync)
+                msync(s.map, segment_size, MS_SYNC);
+        munmap(s.map, segment_size);
+        s.map = nullptr;
+}
+
+/* Segment files of the archive in time order */
+static vector<string> list_segments(const char *dir)
+{
+        vector<string> names;
+        DIR *d = opendir(dir);
+        if (d == nullptr)
+                return names;
+        while (const dirent *e = readdir(d)) {
+                const size_t len = strlen(e->d_name);
+                if (len > 4 && !strcmp(e->d_name + len - 4, ".seg"))
+                        names.push_back(string(dir) + "/" + e->d_name);
+        }
+        closedir(d);
+        sort(names.begin(), names.end());
+        return names;
+}
+
+/*
+ * A sample line: time (s since the epoch), temperature (°C), humidity (%),
+ * pressure (mmHg), battery level (0..255), '-' for an unreliable value
+ */
+static bool parse_sample(const char *line, uint32_t &t, int16_t (&values)[nr_columns], uint8_t &flags)
+{
+        char *end;
+        const unsigned long long tt = strtoull(line, &end, 10);
+        if (end == line || tt > UINT32_MAX)
+                return false;
+        t = tt;
+
+        flags = 0;
+        for (uint8_t c = 0; c < nr_columns; c++) {
+                const char *p = end + strspn(end, " \t");
+                if (p[0] == '-' && (p[1] == '\0' || strchr(" \t\r\n", p[1]) != nullptr)) {
+                        values[c] = 0;
+                        end = const_cast<char *>(p + 1);
+                        continue;
+                }
+                const long v = lround(strtod(p, &end)*column_scale[c]);
+                if (end == p || v < INT16_MIN || v > INT16_MAX)
+                        return false;
+                values[c] = v;
+                flags |= 1 << c;
+        }
+        return true;
+}
+
+/* Append samples from a file ('-' for the standard input) to the archive */
+static int archive_import(const char *dir, const char *name)
+{
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+                return 2;
+        }
+        FILE *f = strcmp(name, "-") ? fopen(name, "r") : stdin;
+        if (f == nullptr) {
+                fprintf(stderr, "Can't open %s: %s\n", name, strerror(errno));
+                return 2;
+        }
+
+        /* Continue the last segment */
+        Segment s = {nullptr};
+        const vector<string> names = list_segments(dir);
+        if (!names.empty() && !map_segment(names.back(), true, s)) {
+                fprintf(stderr, "Can't map %s: %s\n", names.back().c_str(), strerror(errno));
+                return 2;
+        }
+
+        unsigned added = 0, skipped = 0;
+        char line[256];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+                if (line[0] == '#' || line[0] == '\n')
+                        continue;
+
+                uint32_t t;
+                int16_t values[nr_columns];
+                uint8_t flags;
+                if (!parse_sample(line, t, values, flags) ||
+                    (s.map != nullptr && s.header().count != 0 && t <= s.header().last)) {
+                        skipped++;
+                        continue;
+                }
+
+                if (s.map == nullptr || s.header().count == segment_capacity) {
+                        unmap_segment(s, true);
+                        char seg[16];
+                        snprintf(seg, sizeof(seg), "/%010u.seg", t);
+                        if (!map_segment(dir + string(seg), true, s)) {
+                                fprintf(stderr, "Can't create %s%s: %s\n", dir, seg, strerror(errno));
+                                return 2;
+                        }
+                }
+
+                SegmentHeader &h = s.header();
+                const uint32_t i = h.count;
+                s.time()[i] = t;
+                for (uint8_t c = 0; c < nr_columns; c++)
+                        s.column(c)[i] = values[c];
+                s.flags()[i] = flags;
+                if (i == 0)
+                        h.first = t;
+                h.last = t;
+                h.count = i + 1;
+                added++;
+        }
+        unmap_segment(s, true);
+        if (f != stdin)
+                fclose(f);
+
+        printf("Added %u samples, skipped %u (malformed or not after the last one)\n", added, skipped);
+        return 0;
+}
+
+/* Aggregate of a column over the samples with its reliability bit */
+struct Aggregate {
+        int16_t min = INT16_MAX, max = INT16_MIN;
+        int64_t sum = 0;
+        uint64_t count = 0;
+};
+
+using Kernel = void (*)(const int16_t *v, const uint8_t *flags, uint8_t bit, size_t n, Aggregate &a);
+
+static void aggregate_scalar(const int16_t *v, const uint8_t *flags, uint8_t bit, size_t n, Aggregate &a)
+{
+        for (size_t i = 0; i < n; i++) {
+                if (!(flags[i] & 1<<bit))
+                        continue;
+                a.min = min(a.min, v[i]);
+                a.max = max(a.max, v[i]);
+                a.sum += v[i];
+                a.count++;
+        }
+}
+
+#ifdef __SSE2__
+/*
+ * The vector kernels mask out the unreliable lanes: the flags are widened to
+ * 16 bits and compared with the bit. The sums are 32-bit and the counts 16-bit
+ * per lane, so they are added up after every block of 4096 vectors.
+ */
+constexpr size_t block_vectors = 4096;
+
+static void aggregate_sse2(const int16_t *v, const uint8_t *flags, uint8_t bit, size_t n, Aggregate &a)
+{
+        const __m128i mask = _mm_set1_epi16(1 << bit), ones = _mm_set1_epi16(1), zero = _mm_setzero_si128();
+        const __m128i top = _mm_set1_epi16(INT16_MAX), bottom = _mm_set1_epi16(INT16_MIN);
+        __m128i vmin = top, vmax = bottom;
+
+        size_t i = 0;
+        while (n - i >= 8) {
+                const size_t end = i + min((n - i) & ~size_t(7), 8*block_vectors);
+                __m128i vsum = zero, vcount = zero;
+                for (; i < end; i += 8) {
+                        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v + i));
+                        const __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(flags + i)), zero);
+                        const __m128i r = _mm_cmpeq_epi16(_mm_and_si128(f, mask), mask);
+                        const __m128i xr = _mm_and_si128(r, x);
+                        vmin = _mm_min_epi16(vmin, _mm_or_si128(xr, _mm_andnot_si128(r, top)));
+                        vmax = _mm_max_epi16(vmax, _mm_or_si128(xr, _mm_andnot_si128(r, bottom)));
+                        vsum = _mm_add_epi32(vsum, _mm_madd_epi16(xr, ones));
+                        vcount = _mm_sub_epi16(vcount, r);
+                }
+
+                int32_t sums[4];
+                uint16_t counts[8];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(sums), vsum);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(counts), vcount);
+                for (int32_t x : sums)
+                        a.sum += x;
+                for (uint16_t x : counts)
+                        a.count += x;
+        }
+
+        int16_t mins[8], maxs[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(mins), vmin);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(maxs), vmax);
+        for (int k = 0; k < 8; k++) {
+                a.min = min(a.min, mins[k]);
+                a.max = max(a.max, maxs[k]);
+        }
+
+        aggregate_scalar(v + i, flags + i, bit, n - i, a);
+}
+
+__attribute__((target("avx2")))
+static void aggregate_avx2(const int16_t *v, const uint8_t *flags, uint8_t bit, size_t n, Aggregate &a)
+{
+        const __m256i mask = _mm256_set1_epi16(1 << bit), ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+        const __m256i top = _mm256_set1_epi16(INT16_MAX), bottom = _mm256_set1_epi16(INT16_MIN);
+        __m256i vmin = top, vmax = bottom;
+
+        size_t i = 0;
+        while (n - i >= 16) {
+                const size_t end = i + min((n - i) & ~size_t(15), 16*block_vectors);
+                __m256i vsum = zero, vcount = zero;
+                for (; i < end; i += 16) {
+                        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + i));
+                        const __m256i f = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(flags + i)));
+                        const __m256i r = _mm256_cmpeq_epi16(_mm256_and_si256(f, mask), mask);
+                        const __m256i xr = _mm256_and_si256(r, x);
+                        vmin = _mm256_min_epi16(vmin, _mm256_blendv_epi8(top, x, r));
+                        vmax = _mm256_max_epi16(vmax, _mm256_blendv_epi8(bottom, x, r));
+                        vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(xr, ones));
+                        vcount = _mm256_sub_epi16(vcount, r);
+                }
+
+                int32_t sums[8];
+                uint16_t counts[16];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(sums), vsum);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(counts), vcount);
+                for (int32_t x : sums)
+                        a.sum += x;
+                for (uint16_t x : counts)
+                        a.count += x;
+        }
+
+        int16_t mins[16], maxs[16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(mins), vmin);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(maxs), vmax);
+        for (int k = 0; k < 16; k++) {
+                a.min = min(a.min, mins[k]);
+                a.max = max(a.max, maxs[k]);
+        }
+
+        aggregate_scalar(v + i, flags + i, bit, n - i, a);
+}
+#endif
+
+/* The widest kernel the CPU has */
+static Kernel pick_kernel(const char *&name)
+{
+#ifdef __SSE2__
+        if (__builtin_cpu_supports("avx2")) {
+                name = "AVX2";
+                return aggregate_avx2;
+        }
+        name = "SSE2";
+        return aggregate_sse2;
+#else
+        name = "scalar";
+        return aggregate_scalar;
+#endif
+}
+
+/* Local time as YYYY-MM-DD[THH:MM[:SS]], or @<s since the epoch> */
+static bool parse_time(const char *arg, uint32_t &t)
+{
+        if (arg[0] == '@') {
+                char *end;
+                const unsigned long long v = strtoull(arg + 1, &end, 10);
+                if (end == arg + 1 || *end != '\0' || v > UINT32_MAX)
+                        return false;
+                t = v;
+                return true;
+        }
+
+        for (const char *format : {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d"}) {
+                tm tm = {};
+                const char *end = strptime(arg, format, &tm);
+                if (end == nullptr || *end != '\0')
+                        continue;
+                tm.tm_isdst = -1;
+                const time_t v = mktime(&tm);
+                if (v < 0 || v > UINT32_MAX)
+                        return false;
+                t = v;
+                return true;
+        }
+        return false;
+}
+
+static const char *format_time(uint32_t t, char (&buf)[32])
+{
+        const time_t tt = t;
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
+        return buf;
+}
+
+/* Min, max, mean and delta (the last reliable value less the first one) of every column in [from, to) */
+static int archive_query(const char *dir, const char *from_arg, const char *to_arg)
+{
+        uint32_t from, to;
+        if (!parse_time(from_arg, from) || !parse_time(to_arg, to)) {
+                fprintf(stderr, "Bad time: use YYYY-MM-DD[THH:MM[:SS]] or @<seconds>\n");
+                return 1;
+        }
+        const vector<string> names = list_segments(dir);
+        if (names.empty()) {
+                fprintf(stderr, "No archive in %s\n", dir);
+                return 2;
+        }
+
+        const char *kernel_name;
+        const Kernel kernel = pick_kernel(kernel_name);
+        Aggregate a[nr_columns];
+        int16_t first[nr_columns], last[nr_columns];
+        bool seen[nr_columns] = {};
+        uint64_t samples = 0;
+
+        const auto start = chrono::steady_clock::now();
+        for (const string &name : names) {
+                Segment s;
+                if (!map_segment(name, false, s)) {
+                        fprintf(stderr, "Can't map %s: %s\n", name.c_str(), strerror(errno));
+                        return 2;
+                }
+                const SegmentHeader &h = s.header();
+                if (h.count == 0 || h.last < from || h.first >= to) {
+                        unmap_segment(s);
+                        continue;
+                }
+
+                const uint32_t *t = s.time();
+                const size_t lo = lower_bound(t, t + h.count, from) - t;
+                const size_t hi = lower_bound(t + lo, t + h.count, to) - t;
+                const uint8_t *flags = s.flags();
+                samples += hi - lo;
+
+                for (uint8_t c = 0; c < nr_columns; c++) {
+                        const int16_t *v = s.column(c);
+                        kernel(v + lo, flags + lo, c, hi - lo, a[c]);
+
+                        for (size_t i = lo; i < hi && !seen[c]; i++)
+                                if (flags[i] & 1<<c) {
+                                        first[c] = v[i];
+                                        seen[c] = true;
+                                }
+                        for (size_t i = hi; i-- > lo; )
+                                if (flags[i] & 1<<c) {
+                                        last[c] = v[i];
+                                        break;
+                                }
+                }
+                unmap_segment(s);
+        }
+        const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        char b1[32], b2[32];
+        printf("From %s to %s: %llu samples\n", format_time(from, b1), format_time(to, b2),
+                static_cast<unsigned long long>(samples));
+        printf("%-12s %9s %9s %9s %9s %9s\n", "", "min", "max", "mean", "delta", "reliable");
+        for (uint8_t c = 0; c < nr_columns; c++) {
+                const double k = column_scale[c];
+                if (a[c].count == 0) {
+                        printf("%-12s %9s %9s %9s %9s %9d\n", column_names[c], "-", "-", "-", "-", 0);
+                        continue;
+                }
+                printf("%-12s %9.1f %9.1f %9.2f %+9.1f %9llu\n", column_names[c],
+                        a[c].min/k, a[c].max/k, a[c].sum/k/a[c].count, (last[c] - first[c])/k,
+                        static_cast<unsigned long long>(a[c].count));
+        }
+        printf("Scanned in %.2f ms (%s)\n", ms, kernel_name);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        const char *mode = (argc > 1) ? argv[1] : "";
+
+        /* The archive needs no port */
+        if (!strcmp(mode, "--import") && argc > 2)
+                return archive_import(argv[2], (argc > 3) ? argv[3] : "-");
+        if (!strcmp(mode, "--query") && argc > 4)
+                return archive_query(argv[2], argv[3], argv[4]);
+
+        const bool with_arg = !strcmp(mode, "--flash") || !strcmp(mode, "--text") || !strcmp(mode, "--frames");
+        if (with_arg ? argc <= 2 : strcmp(mode, "--sync-time") != 0) {
+                fprintf(stderr, "Usage: matrix-clock [--sync-time [port]]\n"
+                        "       matrix-clock --flash <image.hex> [port]\n"
+                        "       matrix-clock --text <text> [port]\n"
+                        "       matrix-clock --frames <file> [port]\n"
+                        "       matrix-clock --import <archive> [file]\n"
+                        "       matrix-clock --query <archive> <from> <to>\n");
+                return 1;
+        }
+
+        /* Open serial port */
+        const int port_arg = with_arg ? 3 : 2;
+        const char *uart_name = (argc > port_arg) ? argv[port_arg] : "/dev/ttyUSB0";
+        int uart = open(uart_name, O_RDWR | O_NOCTTY | O_NDELAY);
+        if (uart < 0) {
+                fprintf(stderr, "Can't open %s: %s\n", uart_name, strerror(errno));
+                return 2;
+        }
+
+        /* Configure the port */
+        if (!configure_port(uart)) {
+                fprintf(stderr, "Can't configure %s: %s\n", uart_name, strerror(errno));
+                return 3;
+        }
+
+        int rc;
+        if (!strcmp(mode, "--flash"))
+                rc = flash(uart, argv[2]);
+        else if (!strcmp(mode, "--text"))
+                rc = push_text(uart, argv[2]);
+        else if (!strcmp(mode, "--frames"))
+                rc = push_frames(uart, argv[2]);
+        else
+                rc = sync_time(uart, uart_name);
+
         /* Flush and close the port */
         tcflush(uart, TCIOFLUSH);
         close(uart);
 
-        return 0;
+        return rc;
 }
@@ -0,0 +1,775 @@
+/*
+ * pc-link emulator
+ *
+ * Opens a pseudo-terminal pair and plays the pc-link side of the serial
+ * protocol exactly as the firmware does (see firmware/pc-link/pc-link.cpp):
+ * wait for the 0xaa sync byte, read hours, minutes, seconds and checksum,
+ * ack with the locally computed checksum, and if it matches, transmit the
+ * payload to the (simulated) radio, write the transmit report and blink the
+ * LED for 300 ms. The radio retransmits up to 3 times until the base station
+ * acknowledges, the acknowledgements can be lost on purpose. Forwarded packets
+ * (0x55, length, payload, checksum) go to an emulated base station with the
+ * bootloader (see firmware/boot/boot.cpp), which acknowledges them with its
+ * payload, and can lose power on purpose in the middle of an update. Out of
+ * the bootloader it shows the frames and text pushed to the display.
+ *
+ * The serial line is emulated at the byte level: every byte takes 10 bit
+ * times on the wire, in both directions at once, the receiver buffers 64
+ * bytes in the interrupt while the firmware is busy, and bytes can be
+ * delayed, corrupted or dropped on purpose.
+ *
+ * In the benchmark mode the emulator runs `matrix-clock --sync-time` against
+ * itself a number of times and reports the round-trip latency percentiles
+ * and the message rate. In the update mode it runs `matrix-clock --flash`
+ * until the image is verified by the emulated bootloader (resuming after a
+ * failed run), and reports the throughput against the line rate. In the push
+ * mode it runs `matrix-clock --frames` and reports the sustained frame rate,
+ * and whether the display ends with the last frame of the file.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+#include <array>
+#include <deque>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct Options {
+        unsigned baudrate = 9600;       /* Emulated line rate (0 is unlimited) */
+        double latency = 0;             /* Extra delay before the ack (ms) */
+        double corrupt = 0;             /* Probability of a corrupted byte */
+        double drop = 0;                /* Probability of a dropped byte */
+        double blink = 300;             /* LED blink after a transmission (ms) */
+        double no_ack = 0;              /* Probability of a radio attempt not acknowledged */
+        unsigned seed = 1;
+        unsigned bench = 0;             /* Number of benchmark runs (0 is off) */
+        double bench_timeout = 2000;    /* Kill a stuck client after this (ms) */
+        const char *client = "./matrix-clock";
+        bool quiet = false;
+        const char *image = nullptr;    /* Update mode: flash the image */
+        unsigned power_loss = 0;        /* The base loses power after these data bytes (0 is never) */
+        double kill_first = 0;          /* Kill the first update run after this (ms, 0 is never) */
+        const char *frames = nullptr;   /* Push mode: the frames for the display */
+};
+
+struct Stats {
+        atomic<unsigned> rx_bytes {0};
+        atomic<unsigned> tx_bytes {0};
+        atomic<unsigned> overruns {0};  /* Bytes lost in the full receiver buffer */
+        atomic<unsigned> packets {0};   /* Packets with a valid checksum */
+        atomic<unsigned> bad_packets {0};
+        atomic<unsigned> radio_packets {0};
+        atomic<unsigned> retransmits {0};
+        atomic<unsigned> radio_lost {0}; /* Not acknowledged after all retransmits */
+        atomic<unsigned> data_bytes {0}; /* Update data received by the base, with the repeated ones */
+        atomic<unsigned> power_losses {0};
+        atomic<unsigned> frames {0};    /* Pushed frames shown by the base */
+        atomic<unsigned> stale_frames {0}; /* Changes to a missed frame, dropped by the base */
+};
+
+static Options opt;
+static Stats stats;
+static atomic<bool> stop_requested {false};
+static mt19937 radio_rng;
+
+/* Radio settings of pc-link.cpp */
+constexpr unsigned retransmit_count = 3;
+constexpr double retransmit_delay = 0.5;        /* ms */
+
+/* Transmit report: retransmits, and this bit if not delivered */
+constexpr uint8_t report_lost = 0x80;
+
+/* Serial sync bytes: the time, and a payload to forward */
+constexpr uint8_t sync_time = 0xaa, sync_forward = 0x55;
+
+/* The display of the base (the same as in base.cpp), a byte per column */
+constexpr size_t display_width = 24;
+constexpr size_t mask_length = (display_width + 7)/8;
+using Frame = array<uint8_t, display_width>;
+
+static void sleep_ms(double ms)
+{
+        if (ms > 0)
+                this_thread::sleep_for(chrono::duration<double, milli>(ms));
+}
+
+/* Time to transfer one 8N1 character (ms) */
+static double byte_time()
+{
+        return opt.baudrate ? 10e3/opt.baudrate : 0;
+}
+
+class Line {
+private:
+        int fd;
+        mt19937 rng;
+        uniform_real_distribution<double> uniform {0, 1};
+        static constexpr size_t rx_buffer = 64;
+
+        /* Received bytes, and when they are through the wire */
+        deque<pair<uint8_t, Clock::time_point>> fifo;
+        Clock::time_point wire_free;
+
+        /* Apply drops and corruption, return false if the byte is lost */
+        bool mangle(uint8_t &byte) {
+                if (uniform(rng) < opt.drop)
+                        return false;
+                if (uniform(rng) < opt.corrupt)
+                        byte ^= 1 << (rng() % 8);
+                return true;
+        }
+
+        /* Move everything pending in the PTY into the receiver */
+        bool pump(int timeout_ms) {
+                pollfd p = {fd, POLLIN, 0};
+                if (poll(&p, 1, timeout_ms) <= 0)
+                        return false;
+
+                uint8_t buf[64];
+                ssize_t n = ::read(fd, buf, sizeof(buf));
+                for (ssize_t i = 0; i < n; i++) {
+                        uint8_t b = buf[i];
+                        stats.rx_bytes++;
+                        if (!mangle(b))
+                                continue;
+                        if (fifo.size() >= rx_buffer) {
+                                stats.overruns++;
+                                continue;
+                        }
+                        wire_free = max(wire_free, Clock::now()) +
+                                chrono::microseconds(static_cast<long>(byte_time()*1000));
+                        fifo.push_back({b, wire_free});
+                }
+                return n > 0;
+        }
+public:
+        Line(int fd_, unsigned seed): fd(fd_), rng(seed) {}
+
+        /* Drain the PTY for a period of time, as the hardware would do */
+        void idle(double ms) {
+                auto end = Clock::now() + chrono::duration<double, milli>(ms);
+                while (!stop_requested && Clock::now() < end) {
+                        auto left = chrono::duration_cast<chrono::milliseconds>(end - Clock::now());
+                        pump(max<int>(1, left.count()));
+                }
+        }
+
+        /* Blocking read of a single byte, return false on stop request */
+        bool read(uint8_t &byte) {
+                while (fifo.empty()) {
+                        if (stop_requested)
+                                return false;
+                        pump(50);
+                }
+                this_thread::sleep_until(fifo.front().second);
+                byte = fifo.front().first;
+                fifo.pop_front();
+                return true;
+        }
+
+        /* The receiver works meanwhile */
+        void write(uint8_t byte) {
+                pump(0);
+                sleep_ms(byte_time());
+                stats.tx_bytes++;
+                if (mangle(byte) && ::write(fd, &byte, 1) < 1)
+                        fprintf(stderr, "Can't write to PTY: %s\n", strerror(errno));
+        }
+};
+
+static double since(Clock::time_point t)
+{
+        return chrono::duration<double, milli>(Clock::now() - t).count();
+}
+
+/*
+ * Base station with the bootloader of boot.cpp: the application resets into
+ * it on the 'B' packet, it writes pages of the image, saves the progress
+ * every checkpoint and verifies the CRC. The acknowledgement payload is
+ * loaded when the previous packet is done, the flash is busy meanwhile. The
+ * application takes the frames and text pushed to the display as
+ * remote_frame() and remote_text() of base.cpp do.
+ */
+class Base {
+private:
+        static constexpr size_t app_size = 0x7000 - 128;
+        static constexpr size_t page_size = 128;
+        static constexpr size_t checkpoint_interval = 1024;
+        static constexpr double listen_time = 1000;     /* ms */
+        static constexpr double page_time = 9;          /* Erase and write (ms) */
+
+        struct Info {
+                bool pending = false, valid = false;
+                uint16_t size = 0, crc = 0, done = 0;
+        };
+
+        /* Flash survives a power loss, RAM doesn't */
+        vector<uint8_t> flash = vector<uint8_t>(app_size, 0xff);
+        Info info;
+        bool boot = false;
+        uint8_t state = 'I';
+        uint16_t expected = 0;
+        uint8_t page[page_size];
+        Clock::time_point last, ready;          /* The last packet, and the payload is loaded */
+        double work = 0;                        /* For the current packet (ms) */
+        Frame display = {};
+        bool delta = false;                     /* The next frame may change the previous one */
+        uint8_t frame = 0;
+
+        void application(const uint8_t *d, size_t len) {
+                if (len == 1 && d[0] == 'B')
+                        reset();
+                if (d[0] == 'T')
+                        delta = false;
+                if (d[0] != 'F' || len < 3 + mask_length)
+                        return;
+
+                const uint8_t *mask = d + 3, *c = d + 3 + mask_length;
+                size_t n = 0;
+                for (size_t x = 0; x < display_width; x++)
+                        n += (mask[x/8] >> x%8) & 1;
+                if (n != len - 3 - mask_length)
+                        return;
+                if (n != display_width && !(delta && d[1] == static_cast<uint8_t>(frame + 1))) {
+                        stats.stale_frames++;
+                        return;
+                }
+                for (size_t x = 0; x < display_width; x++)
+                        if ((mask[x/8] >> x%8) & 1)
+                                display[x] = *c++;
+                delta = true;
+                frame = d[1];
+                stats.frames++;
+        }
+
+        void save_page(size_t addr, const uint8_t *d) {
+                memcpy(&flash[addr], d, page_size);
+                work += page_time;
+        }
+
+        uint16_t crc() const {
+                uint16_t c = 0xffff;
+                for (size_t a = 0; a < info.size; a++) {
+                        uint8_t b = flash[a] ^ (c & 0xff);
+                        b ^= b << 4;
+                        c = (static_cast<uint16_t>(b) << 8 | c >> 8) ^ (b >> 4) ^ (static_cast<uint16_t>(b) << 3);
+                }
+                return c;
+        }
+
+        void reset() {
+                boot = true;
+                last = ready = Clock::now();
+                state = info.pending ? 'U' : 'I';
+                expected = info.pending ? info.done : 0;
+        }
+
+        void data(uint16_t offset, const uint8_t *d, size_t len) {
+                if (state != 'U' || offset != expected || len > static_cast<size_t>(info.size - offset))
+                        return;
+                while (len-- != 0) {
+                        page[expected++ % page_size] = *d++;
+                        if (expected % page_size != 0 && expected != info.size)
+                                continue;
+                        save_page((expected - 1) & ~(page_size - 1), page);
+                        if (expected % checkpoint_interval == 0 && expected != info.size) {
+                                info.done = expected;
+                                work += page_time;
+                        }
+                }
+        }
+
+        void handle(const uint8_t *d, size_t len) {
+                switch (d[0]) {
+                case 'S': {
+                        if (len != 5)
+                                break;
+                        const uint16_t size = d[1] | d[2] << 8, c = d[3] | d[4] << 8;
+                        if (size == 0 || size > app_size) {
+                                state = 'X';
+                                break;
+                        }
+                        if (!(info.pending && info.size == size && info.crc == c)) {
+                                info = Info {true, false, size, c, 0};
+                                work += page_time;
+                        }
+                        expected = info.done;
+                        state = 'U';
+                        break;
+                }
+                case 'D':
+                        if (len > 3) {
+                                stats.data_bytes += len - 3;
+                                data(d[1] | d[2] << 8, d + 3, len - 3);
+                        }
+                        break;
+                case 'E':
+                        if (state != 'U' || expected != info.size)
+                                break;
+                        work += info.size*10e3/8e6 + page_time;
+                        if (crc() == info.crc) {
+                                info.pending = false;
+                                info.valid = true;
+                                state = 'V';
+                        } else {
+                                info.done = 0;
+                                state = 'X';
+                        }
+                        break;
+                case 'R':
+                        if (!info.pending)
+                                boot = false;
+                        break;
+                }
+        }
+public:
+        /* A packet delivered, return the acknowledgement payload (empty if none) */
+        vector<uint8_t> receive(const uint8_t *d, size_t len) {
+                const bool silent = since(last) > listen_time;
+                last = Clock::now();
+
+                if (boot && silent && !info.pending)
+                        boot = false;
+                if (!boot) {
+                        application(d, len);
+                        return {};
+                }
+
+                /* The payload of the previous packet, if it's loaded by now */
+                vector<uint8_t> ack;
+                if (Clock::now() >= ready)
+                        ack = ack_payload;
+
+                if (opt.power_loss && stats.data_bytes >= opt.power_loss && !stats.power_losses) {
+                        stats.power_losses++;
+                        reset();
+                        return {};
+                }
+
+                work = 0;
+                handle(d, len);
+                ready = max(ready, Clock::now()) + chrono::microseconds(static_cast<long>(work*1000));
+                ack_payload = {state, static_cast<uint8_t>(expected), static_cast<uint8_t>(expected >> 8)};
+                return ack;
+        }
+
+        bool verified() const {
+                return info.valid;
+        }
+
+        Frame shown() const {
+                return display;
+        }
+
+        vector<uint8_t> ack_payload = {'I', 0, 0};
+};
+
+static Base base_station;
+static mutex base_mutex;
+
+/*
+ * Simulated NRF24 radio: the payload goes on air with CMD_W_TX_PAYLOAD,
+ * return the report, and the acknowledgement payload of the base
+ */
+static uint8_t radio_transmit(const uint8_t *d, size_t len, vector<uint8_t> &ack)
+{
+        /* Preamble, 5-byte address, 9-bit PCF, payload and 1-byte CRC at 1 Mbit/s */
+        const double air_time = (1 + 5 + len + 1)*8e-3 + 9e-3;
+        const double ack_time = (1 + 5 + 1)*8e-3 + 9e-3;
+        uniform_real_distribution<double> uniform {0, 1};
+
+        uint8_t arc = 0;
+        bool acked;
+        while (true) {
+                sleep_ms(0.13 + air_time);      /* Standby -> TX settling, then the air time */
+                stats.radio_packets++;
+                acked = uniform(radio_rng) >= opt.no_ack;
+                if (acked) {
+                        sleep_ms(0.13 + ack_time);
+                        break;
+                }
+                if (arc == retransmit_count)
+                        break;
+                sleep_ms(retransmit_delay);
+                arc++;
+                stats.retransmits++;
+        }
+        if (!acked)
+                stats.radio_lost++;
+        else {
+                lock_guard<mutex> lock(base_mutex);
+                ack = base_station.receive(d, len);
+        }
+
+        if (!opt.quiet) {
+                printf("radio:");
+                for (size_t i = 0; i < len; i++)
+                        printf(" %02x", d[i]);
+                if (len == 3)
+                        printf(" (%02u:%02u:%02u)", d[0], d[1], d[2]);
+                if (arc)
+                        printf(", %u retransmits", arc);
+                printf(acked ? "\n" : ", not delivered\n");
+                fflush(stdout);
+        }
+        return arc | (acked ? 0 : report_lost);
+}
+
+/* The main loop of pc-link.cpp */
+static void emulate(Line &uart)
+{
+        while (!stop_requested)
+        {
+                /* Synchronization */
+                uint8_t sync;
+                do {
+                        if (!uart.read(sync))
+                                return;
+                } while (sync != sync_time && sync != sync_forward);
+
+                /* Read the packet: hours, minutes, seconds, or the length and the payload */
+                uint8_t d[32], len = 3, cks;
+                if (sync == sync_forward && (!uart.read(len) || len == 0 || len > sizeof(d))) {
+                        stats.bad_packets++;
+                        continue;
+                }
+                for (uint8_t i = 0; i < len; i++)
+                        if (!uart.read(d[i]))
+                                return;
+                if (!uart.read(cks))
+                        return;
+
+                /* Ack with my checksum */
+                sleep_ms(opt.latency);
+                uint8_t checksum = (sync == sync_forward) ? len : 0;
+                for (uint8_t i = 0; i < len; i++)
+                        checksum ^= d[i];
+                checksum = ~checksum;
+                uart.write(checksum);
+                if (cks != checksum) {
+                        stats.bad_packets++;
+                        continue;
+                }
+
+                /* Transmit the packet and report how it went */
+                stats.packets++;
+                vector<uint8_t> ack;
+                const uint8_t report = radio_transmit(d, len, ack);
+                uart.write(report);
+                if (sync == sync_time)
+                        uart.idle(opt.blink);
+                else {
+                        uart.write(ack.size());
+                        for (uint8_t b : ack)
+                                uart.write(b);
+                }
+        }
+}
+
+static int open_pty(int &slave, char *slave_name, size_t len)
+{
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+                return -1;
+        if (ptsname_r(master, slave_name, len) != 0)
+                return -1;
+
+        /* Keep the slave open, so the master doesn't get EIO between clients */
+        slave = open(slave_name, O_RDWR | O_NOCTTY);
+        if (slave < 0)
+                return -1;
+
+        /* Raw mode until a client configures the port itself */
+        termios ts;
+        if (tcgetattr(slave, &ts) == 0) {
+                cfmakeraw(&ts);
+                tcsetattr(slave, TCSANOW, &ts);
+        }
+
+        return master;
+}
+
+static double percentile(vector<double> v, double p)
+{
+        if (v.empty())
+                return 0;
+        sort(v.begin(), v.end());
+        size_t i = static_cast<size_t>(p/100*(v.size() - 1) + 0.5);
+        return v[min(i, v.size() - 1)];
+}
+
+/* Run the client once, return its exit code (-1 if killed), and the run time */
+static int run_client(const char *port, double &ms, double timeout)
+{
+        auto start = Clock::now();
+        ms = 0;
+
+        pid_t pid = fork();
+        if (pid < 0)
+                return -1;
+        if (pid == 0) {
+                int null = open("/dev/null", O_WRONLY);
+                if (null >= 0) {
+                        dup2(null, STDOUT_FILENO);
+                        dup2(null, STDERR_FILENO);
+                }
+                if (opt.image)
+                        execl(opt.client, opt.client, "--flash", opt.image, port, (char *)nullptr);
+                else if (opt.frames)
+                        execl(opt.client, opt.client, "--frames", opt.frames, port, (char *)nullptr);
+                else
+                        execl(opt.client, opt.client, "--sync-time", port, (char *)nullptr);
+                _exit(127);
+        }
+
+        int status = 0;
+        bool killed = false;
+        while (waitpid(pid, &status, WNOHANG) == 0) {
+                ms = chrono::duration<double, milli>(Clock::now() - start).count();
+                if (!killed && timeout > 0 && ms > timeout) {
+                        kill(pid, SIGKILL);
+                        killed = true;
+                }
+                sleep_ms(0.1);
+        }
+        ms = chrono::duration<double, milli>(Clock::now() - start).count();
+
+        if (killed || !WIFEXITED(status))
+                return -1;
+        return WEXITSTATUS(status);
+}
+
+static int bench(const char *port)
+{
+        vector<double> ok_ms;
+        unsigned failures[8] = {};
+        unsigned killed = 0;
+
+        auto start = Clock::now();
+        for (unsigned i = 0; i < opt.bench; i++) {
+                double ms;
+                int rc = run_client(port, ms, opt.bench_timeout);
+                if (rc == 0)
+                        ok_ms.push_back(ms);
+                else if (rc < 0)
+                        killed++;
+                else
+                        failures[min(rc, 7)]++;
+        }
+        double total = chrono::duration<double>(Clock::now() - start).count();
+
+        printf("runs:          %u\n", opt.bench);
+        printf("acked:         %zu\n", ok_ms.size());
+        printf("no ack:        %u\n", failures[5]);
+        printf("bad ack:       %u\n", failures[6]);
+        printf("not delivered: %u\n", failures[7]);
+        printf("other errors:  %u\n", failures[1] + failures[2] + failures[3] + failures[4]);
+        printf("killed:        %u\n", killed);
+        printf("radio packets: %u (%u retransmits, %u lost)\n", stats.radio_packets.load(),
+                stats.retransmits.load(), stats.radio_lost.load());
+        printf("overruns:      %u\n", stats.overruns.load());
+        printf("round trip:    p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                percentile(ok_ms, 50), percentile(ok_ms, 90), percentile(ok_ms, 99),
+                percentile(ok_ms, 100));
+        printf("rate:          %.2f msg/s acked, %.2f msg/s on air\n",
+                ok_ms.size()/total, stats.radio_packets/total);
+
+        return ok_ms.size() == opt.bench ? 0 : 1;
+}
+
+/* Flash the image, a failed run is resumed by the next one */
+static int update(const char *port)
+{
+        constexpr unsigned max_runs = 3;
+
+        double total = 0;
+        unsigned runs = 0;
+        int rc = -1;
+        while (runs < max_runs && rc != 0) {
+                double ms;
+                rc = run_client(port, ms, runs == 0 ? opt.kill_first : 0);
+                total += ms;
+                runs++;
+                printf("run %u:         exit code %d, %.2f s\n", runs, rc, ms/1000);
+        }
+
+        const unsigned line_rate = opt.baudrate/10;
+        const double rate = stats.data_bytes/(total/1000);
+        printf("verified:      %s\n", base_station.verified() ? "yes" : "no");
+        printf("power losses:  %u\n", stats.power_losses.load());
+        printf("data bytes:    %u on air, %u radio packets (%u retransmits, %u lost)\n",
+                stats.data_bytes.load(), stats.radio_packets.load(), stats.retransmits.load(),
+                stats.radio_lost.load());
+        printf("throughput:    %.0f bytes/s, %.0f %% of the line rate (%u bytes/s)\n",
+                rate, line_rate ? 100*rate/line_rate : 0, line_rate);
+
+        return base_station.verified() ? 0 : 1;
+}
+
+/* The last frame of the file, in the format of `matrix-clock --frames` */
+static bool last_frame(const char *name, Frame &frame)
+{
+        FILE *f = fopen(name, "r");
+        if (f == nullptr)
+                return false;
+
+        Frame cur = {};
+        char line[256];
+        unsigned row = 0;
+        bool found = false;
+        while (fgets(line, sizeof(line), f)) {
+                if (line[0] != '#' && line[0] != '.') {
+                        row = 0;
+                        cur = {};
+                        continue;
+                }
+                for (size_t x = 0; x < display_width && (line[x] == '#' || line[x] == '.'); x++)
+                        if (line[x] == '#')
+                                cur[x] |= 0x80 >> row;
+                if (++row == 8) {
+                        frame = cur;
+                        found = true;
+                        row = 0;
+                        cur = {};
+                }
+        }
+        fclose(f);
+        return found;
+}
+
+/* Push the frames to the display, report the frame rate */
+static int push(const char *port)
+{
+        double ms;
+        const int rc = run_client(port, ms, 0);
+
+        Frame expected;
+        const bool match = last_frame(opt.frames, expected) && base_station.shown() == expected;
+        const unsigned line_rate = opt.baudrate/10;
+        const double rate = stats.rx_bytes/(ms/1000);
+        printf("exit code:     %d, %.2f s\n", rc, ms/1000);
+        printf("frames:        %u shown, %u dropped as changes to a missed one\n",
+                stats.frames.load(), stats.stale_frames.load());
+        printf("radio packets: %u (%u retransmits, %u lost)\n", stats.radio_packets.load(),
+                stats.retransmits.load(), stats.radio_lost.load());
+        printf("frame rate:    %.1f frames/s\n", stats.frames/(ms/1000));
+        printf("line:          %.0f bytes/s from the PC, %.0f %% of the line rate (%u bytes/s)\n",
+                rate, line_rate ? 100*rate/line_rate : 0, line_rate);
+        printf("display:       %s\n", match ? "the last frame" : "not the last frame");
+
+        return (rc == 0 && match) ? 0 : 1;
+}
+
+static void on_signal(int)
+{
+        stop_requested = true;
+}
+
+static void usage()
+{
+        fprintf(stderr,
+                "Usage: pc-link-emu [options]\n"
+                "  -r <baud>    Emulated line rate, 0 is unlimited (default 9600)\n"
+                "  -l <ms>      Extra latency before the ack (default 0)\n"
+                "  -c <p>       Probability of a corrupted byte (default 0)\n"
+                "  -d <p>       Probability of a dropped byte (default 0)\n"
+                "  -k <ms>      LED blink time after a transmission (default 300)\n"
+                "  -a <p>       Probability of a radio attempt not acknowledged (default 0)\n"
+                "  -s <seed>    Random seed (default 1)\n"
+                "  -b <n>       Benchmark: run the client n times and report\n"
+                "  -p <path>    Client for the benchmark (default ./matrix-clock)\n"
+                "  -t <ms>      Kill a stuck client after this time (default 2000)\n"
+                "  -u <path>    Update: flash the image (Intel HEX) with the client and report\n"
+                "  -i <bytes>   The base loses power after this much update data (default never)\n"
+                "  -K <ms>      Kill the first update run after this time, the next one resumes\n"
+                "  -f <path>    Push: the frames to the display with the client and report\n"
+                "  -q           Don't print radio packets\n");
+}
+
+int main(int argc, char **argv)
+{
+        int c;
+        while ((c = getopt(argc, argv, "r:l:c:d:k:a:s:b:p:t:u:i:K:f:qh")) != -1) {
+                switch (c) {
+                case 'r': opt.baudrate = strtoul(optarg, nullptr, 0); break;
+                case 'l': opt.latency = atof(optarg); break;
+                case 'c': opt.corrupt = atof(optarg); break;
+                case 'd': opt.drop = atof(optarg); break;
+                case 'k': opt.blink = atof(optarg); break;
+                case 'a': opt.no_ack = atof(optarg); break;
+                case 's': opt.seed = strtoul(optarg, nullptr, 0); break;
+                case 'b': opt.bench = strtoul(optarg, nullptr, 0); break;
+                case 'p': opt.client = optarg; break;
+                case 't': opt.bench_timeout = atof(optarg); break;
+                case 'u': opt.image = optarg; break;
+                case 'i': opt.power_loss = strtoul(optarg, nullptr, 0); break;
+                case 'K': opt.kill_first = atof(optarg); break;
+                case 'f': opt.frames = optarg; break;
+                case 'q': opt.quiet = true; break;
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+
+        int slave;
+        char slave_name[64];
+        int master = open_pty(slave, slave_name, sizeof(slave_name));
+        if (master < 0) {
+                fprintf(stderr, "Can't open a PTY: %s\n", strerror(errno));
+                return 2;
+        }
+
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+
+        radio_rng.seed(opt.seed + 1);
+        Line uart {master, opt.seed};
+        thread firmware {emulate, ref(uart)};
+
+        int rc = 0;
+        if (opt.image) {
+                opt.quiet = true;
+                rc = update(slave_name);
+                stop_requested = true;
+        } else if (opt.frames) {
+                opt.quiet = true;
+                rc = push(slave_name);
+                stop_requested = true;
+        } else if (opt.bench) {
+                opt.quiet = true;
+                rc = bench(slave_name);
+                stop_requested = true;
+        } else {
+                printf("pc-link: %s\n", slave_name);
+                fflush(stdout);
+                while (!stop_requested)
+                        pause();
+                fprintf(stderr, "%u packets, %u bad, %u overruns, %u retransmits, %u not delivered\n",
+                        stats.packets.load(), stats.bad_packets.load(), stats.overruns.load(),
+                        stats.retransmits.load(), stats.radio_lost.load());
+        }
+
+        firmware.join();
+        close(slave);
+        close(master);
+
+        return rc;
+}